@@ -0,0 +1,163 @@
+import {ChatRoomEvent, ChatRoomMember, ResponseMessage} from './protobufs/comm_protobufs/message_pb'
+
+// Member list and message feed of one chat room, shared by every watch of the room (see ChatRoomEvent in
+// message.proto). Changes are coalesced for flushDelayMs and go out as a single delta; the most recent deltas are kept
+// so that a client re-watching with a known version only gets what it missed.
+export class ChatRoomFeed {
+    version: bigint = 0n;
+    members: Map<string, ChatRoomMember> = new Map();
+
+    private deltas: ChatRoomEvent[] = [];  // member changes only, oldest first
+    private joined: Map<string, ChatRoomMember> = new Map();
+    private left: Set<string> = new Set();
+    private messages: ResponseMessage[] = [];
+    private timer: NodeJS.Timeout | undefined;
+    private listeners: Set<(event: ChatRoomEvent) => void> = new Set();
+
+    constructor(private flushDelayMs: number = 50,
+                private deltaLogSize: number = 256,
+                private maxQueued: number = 64,  // events a watcher may fall behind before it is sent a reset instead
+                private maxQueuedMessages: number = 2000) {
+    }
+
+    reset(members: ChatRoomMember[]) {
+        this.flush();
+        this.members = new Map(members.map((member) => [member.id, member]));
+        this.version += 1n;
+        this.deltas = [];
+        this.emit(this.snapshot());
+    }
+
+    join(member: ChatRoomMember) {  // also for a member whose name or state changed
+        this.members.set(member.id, member);
+        this.left.delete(member.id);
+        this.joined.set(member.id, member);
+        this.schedule();
+    }
+
+    leave(id: string) {
+        if (!this.members.delete(id)) {
+            return;
+        }
+        this.joined.delete(id);
+        this.left.add(id);
+        this.schedule();
+    }
+
+    message(message: ResponseMessage) {
+        this.messages.push(message);
+        this.schedule();
+    }
+
+    snapshot(): ChatRoomEvent {
+        return new ChatRoomEvent({version: this.version, reset: true, joined: [...this.members.values()]});
+    }
+
+    // What a client that has applied knownVersion needs to be up to date, or undefined if it already is
+    catchUp(knownVersion?: bigint): ChatRoomEvent | undefined {
+        if (knownVersion === this.version) {
+            return undefined;
+        }
+        if (knownVersion === undefined || knownVersion > this.version || this.deltas.length == 0 ||
+            this.deltas[0].version > knownVersion + 1n) {
+            return this.snapshot();
+        }
+        const joined: Map<string, ChatRoomMember> = new Map();
+        const left: Set<string> = new Set();
+        for (const delta of this.deltas) {
+            if (delta.version <= knownVersion) {
+                continue;
+            }
+            for (const member of delta.joined) {
+                left.delete(member.id);
+                joined.set(member.id, member);
+            }
+            for (const id of delta.left) {
+                joined.delete(id);
+                left.add(id);
+            }
+        }
+        return new ChatRoomEvent({version: this.version, joined: [...joined.values()], left: [...left]});
+    }
+
+    // Events for one watcher, starting with its catch-up; ends when signal is aborted
+    async* watch(knownVersion?: bigint, signal?: AbortSignal) {
+        let queue: ChatRoomEvent[] = [];
+        let wake: (() => void) | undefined;
+        const listener = (event: ChatRoomEvent) => {
+            queue.push(event);
+            if (queue.length > this.maxQueued) {
+                // a slow watcher gets the current member list and the latest messages instead of every delta
+                const messages = queue.flatMap((event) => event.messages).slice(-this.maxQueuedMessages);
+                const reset = this.snapshot();
+                reset.messages = messages;
+                queue = [reset];
+            }
+            wake?.();
+        };
+        const onAbort = () => wake?.();
+        this.listeners.add(listener);
+        signal?.addEventListener('abort', onAbort);
+        try {
+            const first = this.catchUp(knownVersion);
+            if (first) {
+                yield first;
+            }
+            while (!signal?.aborted) {
+                if (queue.length == 0) {
+                    await new Promise<void>((resolve) => wake = resolve);
+                    wake = undefined;
+                    continue;
+                }
+                const events = queue;
+                queue = [];
+                yield* events;
+            }
+        } finally {
+            this.listeners.delete(listener);
+            signal?.removeEventListener('abort', onAbort);
+        }
+    }
+
+    private schedule() {
+        if (!this.timer) {
+            this.timer = setTimeout(() => this.flush(), this.flushDelayMs);
+        }
+    }
+
+    private flush() {
+        clearTimeout(this.timer);
+        this.timer = undefined;
+        const membersChanged = this.joined.size > 0 || this.left.size > 0;
+        if (!membersChanged && this.messages.length == 0) {
+            return;
+        }
+        if (membersChanged) {
+            this.version += 1n;
+            this.deltas.push(new ChatRoomEvent({
+                version: this.version,
+                joined: [...this.joined.values()],
+                left: [...this.left],
+            }));
+            if (this.deltas.length > this.deltaLogSize) {
+                this.deltas.splice(0, this.deltas.length - this.deltaLogSize);
+            }
+        }
+        const event = new ChatRoomEvent({
+            version: this.version,
+            joined: [...this.joined.values()],
+            left: [...this.left],
+            messages: this.messages,
+        });
+        this.joined = new Map();
+        this.left = new Set();
+        this.messages = [];
+        this.emit(event);
+    }
+
+    private emit(event: ChatRoomEvent) {
+        for (const listener of this.listeners) {
+            listener(event);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+import {PollRequest} from './protobufs/comm_protobufs/message_pb'
+import {requestTime} from "./wire";
+
+// Position of a message in a conversation; messages sharing a timestamp are told apart by their ordinal
+export interface HistoryPosition {
+    time: number;  // ms
+    ordinal: number;
+}
+
+export function comparePositions(a: HistoryPosition, b: HistoryPosition): number {
+    return a.time != b.time ? a.time - b.time : a.ordinal - b.ordinal;
+}
+
+// Page tokens are opaque to clients; they hold the position of the oldest message of the previous page
+export function encodePageToken(position: HistoryPosition): string {
+    return `${position.time}.${position.ordinal}`;
+}
+
+export function decodePageToken(token: string): HistoryPosition | undefined {
+    const [time, ordinal] = token.split('.').map((x) => parseInt(x));
+    return isNaN(time) || isNaN(ordinal) ? undefined : {time: time, ordinal: ordinal};
+}
+
+// Exclusive bounds of a paged PollRequest (see message.proto)
+export function pageBounds(call: PollRequest): { after?: HistoryPosition, before?: HistoryPosition } {
+    const start = requestTime(call.startTimestamp, call.startTimestampNs);
+    const last = requestTime(call.lastTimestamp, call.lastTimestampNs);
+    const after = start !== undefined ? {time: start, ordinal: call.startOrdinal ?? 0} : undefined;
+    let before = last !== undefined ? {time: last, ordinal: call.lastOrdinal ?? 0} : undefined;
+    if (call.pageToken) {
+        before = decodePageToken(call.pageToken);
+    }
+    return {after: after, before: before};
+}
+
+export function inBounds(position: HistoryPosition, bounds: { after?: HistoryPosition, before?: HistoryPosition }) {
+    return (!bounds.after || comparePositions(position, bounds.after) > 0) &&
+        (!bounds.before || comparePositions(position, bounds.before) < 0);
+}
@@ -0,0 +1,308 @@
+import {ConnectRouter, HandlerContext} from "@connectrpc/connect";
+import {AuthService} from './protobufs/comm_protobufs/auth_connect'
+import {AuthRequest, AuthResponse, AuthResponse_AuthState} from './protobufs/comm_protobufs/auth_pb'
+import {MessageService} from './protobufs/comm_protobufs/message_connect'
+import {
+    MessageRequest,
+    SendMessageResult,
+    SendMessageResult_SendMessageResultCode,
+    ResponseMessage,
+    PollRequest,
+    FriendsListResponse,
+    Persona,
+    PersonaState,
+    ActiveMessageSessionResponse,
+    ActiveMessageSessionsRequest,
+    AvatarUrl,
+    ChatRoom,
+    ChatRoomMember,
+    ChatRoomsResponse,
+    WatchChatRoomRequest,
+    FriendsListRequest,
+    SearchUsersRequest,
+    SearchUsersResponse,
+} from './protobufs/comm_protobufs/message_pb'
+import {Timestamp} from "@bufbuild/protobuf";
+import {createHash} from "crypto";
+import {createServer} from "http";
+import {startServer} from "./serve";
+import {encodePageToken, inBounds, pageBounds} from "./history_page";
+import {ChatRoomFeed} from "./chat_rooms";
+import {messageFields, personaId, requestTarget, requestTime, toNs} from "./wire";
+
+// Stand-in for server.ts that needs no Steam account: every login succeeds and each friend has a fixed,
+// deterministic history. Used for benchmarks and for running several proxies locally.
+//   MOCK_FRIENDS  number of friends (default 20)
+//   MOCK_HISTORY  messages per friend (default 2000), two per minute (ordinals 0 and 1), ending now
+//   MOCK_AVATARS  port of a local HTTP server for the friends' avatars (default: no avatars); friends share four
+//   MOCK_ROOM_MEMBERS  members of the one chat room (default 5000)
+//   MOCK_ROOM_RATE     messages per second in the chat room (default 500); a member joins or leaves every 10 messages
+const friendCount = parseInt(process.env.MOCK_FRIENDS || "20");
+const historyLength = parseInt(process.env.MOCK_HISTORY || "2000");
+const avatarPort = parseInt(process.env.MOCK_AVATARS || "0");
+const roomMemberCount = parseInt(process.env.MOCK_ROOM_MEMBERS || "5000");
+const roomRate = parseInt(process.env.MOCK_ROOM_RATE || "500");
+const roomMemberOffset = 1000000;  // member ids do not collide with friend ids
+const idPrefix = "7656119";  // SteamID64s do not fit in a double, so they are built as strings
+const myId = idPrefix + "0000000000";
+const startedAt = Date.now();
+const compactSessions = new Set<string>();  // session keys that negotiated compactWire
+
+const words = ["hey", "are", "you", "up", "for", "a", "match", "later", "tonight", "the", "new", "patch", "is",
+    "out", "lol", "gg", "that", "was", "close", "let's", "queue", "again", "after", "dinner", "ok", "sure"];
+
+function friendId(index: number): string {
+    return idPrefix + ("0000000000" + (index + 1)).slice(-10);
+}
+
+function friendIndex(id: string): number {
+    return parseInt(id.slice(-10)) - 1;
+}
+
+// 1x1 PNG; the plugin only cares about the hash in the URL and the bytes it gets back
+const avatarImage = Buffer.from("iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAYAAAAfFcSJAAAADUlEQVR42mNkYPhfDwAChwGA60e6kgAAAABJRU5ErkJggg==",
+    "base64");
+
+function avatarUrl(index: number): AvatarUrl | undefined {
+    if (!avatarPort) {
+        return undefined;
+    }
+    const hash = createHash("sha1").update(`avatar ${index % 4}`).digest("hex");
+    const base = `http://127.0.0.1:${avatarPort}/${hash}`;
+    return new AvatarUrl({icon: `${base}.png`, medium: `${base}_medium.png`, full: `${base}_full.png`});
+}
+
+function messageText(friend: number, index: number): string {
+    let text: string[] = [];
+    let seed = friend * 7919 + index * 104729;
+    for (let i = 0; i < 4 + seed % 16; ++i) {
+        seed = (seed * 1103515245 + 12345) % 2147483648;
+        text.push(words[seed % words.length]);
+    }
+    return text.join(" ");
+}
+
+function messageTime(index: number): number {  // ms; index 0 is the oldest message
+    return startedAt - (historyLength - (index - index % 2)) * 60000;
+}
+
+function messageOrdinal(index: number): number {  // pairs of messages share a timestamp
+    return index % 2;
+}
+
+function responseMessage(compact: boolean, targetId: string, index: number, nextPageToken?: string): ResponseMessage {
+    return new ResponseMessage({
+        ...messageFields(compact, index % 2 == 0 ? targetId : myId, messageTime(index)),
+        message: messageText(friendIndex(targetId), index),
+        ordinal: messageOrdinal(index),
+        nextPageToken: nextPageToken,
+    });
+}
+
+function* pollPage(call: PollRequest) {
+    const bounds = pageBounds(call);
+    const matching: number[] = [];  // newest first
+    for (let i = historyLength - 1; i >= 0 && matching.length <= call.pageSize!; --i) {
+        if (inBounds({time: messageTime(i), ordinal: messageOrdinal(i)}, bounds)) {
+            matching.push(i);
+        }
+    }
+    const page = matching.slice(0, call.pageSize!).reverse();
+    const oldest = page.length > 0 ? {time: messageTime(page[0]), ordinal: messageOrdinal(page[0])} : undefined;
+    for (let i = 0; i < page.length; ++i) {
+        const more = i == page.length - 1 && matching.length > call.pageSize!;
+        yield responseMessage(compactSessions.has(call.sessionKey), requestTarget(call), page[i],
+            more ? encodePageToken(oldest!) : undefined);
+    }
+}
+
+function roomMember(index: number): ChatRoomMember {
+    return new ChatRoomMember({
+        id: friendId(roomMemberOffset + index),
+        name: `member ${index}`,
+        personaState: index % 3 == 0 ? PersonaState.ONLINE : PersonaState.OFFLINE,
+    });
+}
+
+// The chat room starts talking when it is first watched
+let roomFeed: ChatRoomFeed | undefined;
+
+function mockRoom(): ChatRoomFeed {
+    if (roomFeed) {
+        return roomFeed;
+    }
+    const feed = new ChatRoomFeed();
+    feed.reset(Array.from({length: roomMemberCount}, (_, i) => roomMember(i)));
+    const start = Date.now();
+    let sent = 0;
+    let lastTime = 0;
+    let ordinal = 0;
+    setInterval(() => {
+        const due = Math.floor((Date.now() - start) * roomRate / 1000);
+        for (; sent < due; ++sent) {
+            const now = Date.now();
+            ordinal = now == lastTime ? ordinal + 1 : 0;
+            lastTime = now;
+            const sender = sent % roomMemberCount;
+            // the room is shared by every session, so it keeps the old form, which the plugin also reads
+            feed.message(new ResponseMessage({
+                senderId: friendId(roomMemberOffset + sender),
+                message: messageText(sender, sent),
+                timestamp: Timestamp.fromDate(new Date(now)),
+                ordinal: ordinal,
+            }));
+            if (sent % 10 == 0) {
+                const index = (sent / 10 * 7919) % roomMemberCount;
+                const member = roomMember(index);
+                if (feed.members.has(member.id)) {
+                    feed.leave(member.id);
+                } else {
+                    feed.join(member);
+                }
+            }
+        }
+    }, 10);
+    roomFeed = feed;
+    return feed;
+}
+
+function authRoute(router: ConnectRouter) {
+    router.service(AuthService, {
+        async authenticate(call: AuthRequest) {
+            const sessionKey = `mock-${call.username}`;
+            if (call.compactWire) {
+                compactSessions.add(sessionKey);
+            } else {
+                compactSessions.delete(sessionKey);
+            }
+            return new AuthResponse({
+                success: true,
+                reason: AuthResponse_AuthState.SUCCESS,
+                reasonStr: "Success",
+                sessionKey: sessionKey,
+                compactWire: call.compactWire,
+            });
+        },
+    });
+}
+
+function messageRoute(router: ConnectRouter) {
+    router.service(MessageService, {
+        async sendChatMessage(call: MessageRequest) {
+            return new SendMessageResult({
+                success: true,
+                reason: SendMessageResult_SendMessageResultCode.SUCCESS,
+                reasonStr: "Success",
+            });
+        },
+        async* streamFriendMessages() {
+        },
+        async getFriendsList(call: FriendsListRequest) {
+            const compact = compactSessions.has(call.sessionKey);
+            return new FriendsListResponse({
+                user: new Persona({...personaId(compact, myId), name: "mock user", personaState: PersonaState.ONLINE}),
+                friends: Array.from({length: friendCount}, (_, i) => new Persona({
+                    ...personaId(compact, friendId(i)),
+                    name: `friend ${i}`,
+                    personaState: i % 3 == 0 ? PersonaState.ONLINE : PersonaState.OFFLINE,
+                    avatarUrl: avatarUrl(i),
+                })),
+            });
+        },
+        async getActiveFriendMessageSessions(call: ActiveMessageSessionsRequest) {
+            const last = messageTime(historyLength - 1);
+            if (compactSessions.has(call.sessionKey)) {
+                return new ActiveMessageSessionResponse({
+                    sessions: Array.from({length: friendCount}, (_, i) => ({
+                        target: BigInt(friendId(i)),
+                        lastMessageTimestampNs: toNs(last),
+                        lastViewTimestampNs: toNs(last),
+                        unreadCount: 0,
+                    })),
+                    timestampNs: toNs(Date.now()),
+                });
+            }
+            return new ActiveMessageSessionResponse({
+                sessions: Array.from({length: friendCount}, (_, i) => ({
+                    targetId: friendId(i),
+                    lastMessageTimestamp: Timestamp.fromDate(new Date(last)),
+                    lastViewTimestamp: Timestamp.fromDate(new Date(last)),
+                    unreadCount: 0,
+                })),
+                timestamp: Timestamp.now(),
+            });
+        },
+        async ackFriendMessage() {
+        },
+        async ackFriendMessages() {
+        },
+        async sendChatRoomMessage() {
+            return new SendMessageResult({
+                success: true,
+                reason: SendMessageResult_SendMessageResultCode.SUCCESS,
+                reasonStr: "Success",
+            });
+        },
+        async getChatRooms() {
+            return new ChatRoomsResponse({
+                rooms: [new ChatRoom({groupId: "1", chatId: "1", name: "mock group / general", memberCount: roomMemberCount})],
+            });
+        },
+        async searchUsers(call: SearchUsersRequest) {
+            // friends first, then the room members; by SteamID or by a part of the name
+            const query = call.query.trim().toLowerCase();
+            const limit = call.limit || 50;
+            const users: Persona[] = [];
+            for (let i = 0; i < friendCount + roomMemberCount && users.length < limit; ++i) {
+                const isFriend = i < friendCount;
+                const index = isFriend ? i : i - friendCount;
+                const id = friendId(isFriend ? index : roomMemberOffset + index);
+                const name = isFriend ? `friend ${index}` : `member ${index}`;
+                if (id == query || name.includes(query)) {
+                    users.push(new Persona({
+                        ...personaId(compactSessions.has(call.sessionKey), id),
+                        name: name,
+                        personaState: index % 3 == 0 ? PersonaState.ONLINE : PersonaState.OFFLINE,
+                    }));
+                }
+            }
+            return new SearchUsersResponse({users: users});
+        },
+        async* watchChatRoom(call: WatchChatRoomRequest, context: HandlerContext) {
+            yield* mockRoom().watch(call.knownVersion, context.signal);
+        },
+        async* pollChatMessages(call: PollRequest) {
+            if (call.pageSize) {
+                yield* pollPage(call);
+                return;
+            }
+            const after = requestTime(call.startTimestamp, call.startTimestampNs) ?? -Infinity;
+            const until = requestTime(call.lastTimestamp, call.lastTimestampNs) ?? Infinity;
+            const compact = compactSessions.has(call.sessionKey);
+            const targetId = requestTarget(call);
+            for (let i = 0; i < historyLength; ++i) {
+                const time = messageTime(i);
+                if (time <= after || time > until) {
+                    continue;
+                }
+                yield responseMessage(compact, targetId, i);
+            }
+        },
+    });
+}
+
+(async () => {
+    if (avatarPort) {
+        createServer((req, res) => {
+            if (!/^\/[0-9a-f]{40}(_medium|_full)?\.png$/.test(req.url ?? "")) {
+                res.writeHead(404).end();
+                return;
+            }
+            res.writeHead(200, {"Content-Type": "image/png", "Content-Length": avatarImage.length}).end(avatarImage);
+        }).listen(avatarPort, "127.0.0.1");
+    }
+    await startServer((router) => {
+        authRoute(router);
+        messageRoute(router);
+    });
+})();
@@ -0,0 +1,56 @@
+import {ConnectRouter} from "@connectrpc/connect";
+import {compressionGzip} from "@connectrpc/connect-node";
+import {fastify} from "fastify";
+import {fastifyConnectPlugin} from "@connectrpc/connect-fastify";
+import {existsSync, unlinkSync} from "fs";
+
+type ListenOptions = { host: string, port: number } | { path: string };
+
+// PROXY_LISTEN is either "host:port" (default "localhost:8080") or "unix:/path/to/socket",
+// matching the gRPC target syntax used by the plugin's "proxy_address" option
+export function listenOptions(): ListenOptions {
+    const address = process.env.PROXY_LISTEN || "localhost:8080";
+    if (address.startsWith("unix:")) {
+        return {path: address.substring("unix:".length).replace(/^\/\/(?=\/)/, "")};  // unix:///abs -> /abs
+    }
+    const separator = address.lastIndexOf(":");
+    return {host: address.substring(0, separator), port: parseInt(address.substring(separator + 1))};
+}
+
+export async function startServer(routes: (router: ConnectRouter) => void) {
+    const server = fastify({http2: true});
+    const endpoints: string[] = [];
+
+    await server.register(fastifyConnectPlugin, {
+        // responses are only compressed for clients that advertise gzip (the plugin's "bulk" channel profile)
+        acceptCompression: [compressionGzip],
+        compressMinBytes: parseInt(process.env.PROXY_COMPRESS_MIN_BYTES || "1024"),
+        routes(router) {
+            routes(router);
+            // Add each endpoint to the list
+            router.handlers.forEach((route) => {
+                endpoints.push(route.requestPath);
+            });
+            return router;
+        },
+    });
+
+    server.get("/", (_, reply) => {
+        reply.type("text/plain");
+        reply.send("Hello World!");
+    });
+
+    const options = listenOptions();
+    if ("path" in options && existsSync(options.path)) {
+        unlinkSync(options.path);  // stale socket from a previous run
+    }
+    await server.listen(options);
+    console.log("server is listening at", server.addresses());
+
+    // Print the list of endpoints
+    console.log("Available endpoints:");
+    endpoints.forEach((endpoint) => {
+        console.log(endpoint);
+    });
+    return server;
+}
@@ -1,4 +1,4 @@
-import {ConnectRouter} from "@connectrpc/connect";
+import {ConnectRouter, HandlerContext} from "@connectrpc/connect";
 import {AuthService} from './protobufs/comm_protobufs/auth_connect'
 import {AuthResponse, AuthResponse_AuthState} from './protobufs/comm_protobufs/auth_pb'
 import {MessageService} from './protobufs/comm_protobufs/message_connect'
@@ -15,10 +15,21 @@ import {
     StreamChatRequest,
     ActiveMessageSessionsRequest,
     ActiveMessageSessionResponse,
-    AckFriendMessageRequest
+    AckFriendMessageRequest,
+    AckFriendMessagesRequest,
+    ChatRoom,
+    ChatRoomsRequest,
+    ChatRoomsResponse,
+    ChatRoomMember,
+    ChatRoomMessageRequest,
+    WatchChatRoomRequest,
+    SearchUsersRequest,
+    SearchUsersResponse
 } from './protobufs/comm_protobufs/message_pb'
-import {fastify} from "fastify";
-import {fastifyConnectPlugin} from "@connectrpc/connect-fastify";
+import {startServer} from "./serve";
+import {ChatRoomFeed} from "./chat_rooms";
+import {comparePositions, encodePageToken, inBounds, pageBounds} from "./history_page";
+import {messageFields, personaId, requestTarget, requestTime, toNs} from "./wire";
 import {once} from "events";
 
 import SteamUser from 'steam-user';
@@ -80,8 +91,16 @@ class SessionWrapper {
     loggedOnDetails: undefined | any;
 
     friendsLoaded: boolean;
+    compactWire: boolean = false;  // negotiated at authentication, see wire.ts
     users: Record<string, SteamClientUser> = {};  // needed since client.users doesn't contain all fields even after `user`` event
 
+    // outgoing messages: per-target send chain (keeps arrival order) and recent results by idempotency key
+    sendChains: Map<string, Promise<unknown>> = new Map();
+    sentMessages: Map<string, Promise<SendMessageResult>> = new Map();
+
+    // watched chat rooms by "groupId/chatId"; a room's feed lives as long as the session
+    chatRooms: Map<string, Promise<ChatRoomFeed>> = new Map();
+
     constructor(client: SteamUser, expectRefreshToken: boolean) {
         this.client = client;
         this.expectRefreshToken = expectRefreshToken;
@@ -99,6 +118,162 @@ class SessionWrapper {
 
 let activeSessions: Map<string, SessionWrapper> = new Map();
 
+// Sends go out in arrival order per target, and a retry with the same idempotency key reuses the first result.
+// A send with `afterKey` waits for that earlier send and fails without sending if it did not succeed (or never arrived),
+// so a message cannot overtake one that has to be retried.
+function sendOnce(wrapper: SessionWrapper, target: string, idempotencyKey: string | undefined,
+                  afterKey: string | undefined,
+                  send: () => Promise<SendMessageResult>): Promise<SendMessageResult> {
+    if (idempotencyKey && wrapper.sentMessages.has(idempotencyKey)) {
+        console.log("Duplicate send, reusing result for", idempotencyKey);
+        return wrapper.sentMessages.get(idempotencyKey)!;
+    }
+    const previous = afterKey ? wrapper.sentMessages.get(afterKey) : undefined;
+    const result = (wrapper.sendChains.get(target) || Promise.resolve()).then(async () => {
+        if (afterKey && !(previous && (await previous).success)) {
+            return new SendMessageResult({
+                success: false,
+                reason: SendMessageResult_SendMessageResultCode.UNKNOWN_ERROR,
+                reasonStr: "Previous message was not sent",
+            });
+        }
+        return send();
+    });
+    wrapper.sendChains.set(target, result);
+    if (idempotencyKey) {
+        wrapper.sentMessages.set(idempotencyKey, result);
+        if (wrapper.sentMessages.size > 1000) {
+            // Map iterates in insertion order, so this evicts the oldest key
+            wrapper.sentMessages.delete(wrapper.sentMessages.keys().next().value);
+        }
+        // Failed sends must be retryable under the same key
+        result.then((r) => {
+            if (!r.success) {
+                wrapper.sentMessages.delete(idempotencyKey);
+            }
+        });
+    }
+    return result;
+}
+
+function makePersona(wrapper: SessionWrapper, steamId: string): Persona {
+    let friend = wrapper.getUser(steamId);
+    if (!friend) {
+        throw new Error("Invalid steamId");
+    }
+    var personaState = friend.persona_state;
+    if (personaState === undefined || personaState === null) {
+        personaState = SteamUser.EPersonaState.Offline;
+    }
+    return new Persona({
+        ...personaId(wrapper.compactWire, steamId),
+        name: friend.player_name,
+        personaState: (personaState as unknown) as PersonaState,
+        avatarUrl: {
+            icon: friend.avatar_url_icon,
+            medium: friend.avatar_url_medium,
+            full: friend.avatar_url_full,
+        },
+        // lastLogoff: Timestamp.fromDate(friend.last_logoff),
+        // lastLogon: Timestamp.fromDate(friend.last_logon),
+        // lastSeenOnline: Timestamp.fromDate(friend.last_seen_online),
+    });
+}
+
+// Lower case without diacritics, as the plugin folds names for its local search
+function foldForSearch(text: string): string {
+    return text.normalize('NFKD').replace(/\p{M}/gu, '').toLowerCase();
+}
+
+function chatRoomMember(wrapper: SessionWrapper, steamId: SteamID): ChatRoomMember {
+    const user = wrapper.getUser(steamId);
+    return new ChatRoomMember({
+        id: steamId.getSteamID64(),
+        name: user?.player_name ?? steamId.getSteamID64(),
+        personaState: (user?.persona_state ?? SteamUser.EPersonaState.Offline) as unknown as PersonaState,
+    });
+}
+
+// Feed of a chat room, fed by the session's chat events from the first watch on
+async function startChatRoomFeed(wrapper: SessionWrapper, groupId: string, chatId: string): Promise<ChatRoomFeed> {
+    const client = wrapper.client;
+    const {chat_room_groups} = await client.chat.setSessionActiveGroups([groupId]);
+    const members: SteamID[] = (chat_room_groups[groupId]?.members ?? []).map((member) => member.steamid);
+
+    const feed = new ChatRoomFeed();
+    client.chat.on('chatMessage', (message) => {
+        if (message.chat_group_id != groupId || message.chat_id != chatId) {
+            return;
+        }
+        feed.message(new ResponseMessage({
+            ...messageFields(wrapper.compactWire, message.steamid_sender.getSteamID64(), message.server_timestamp),
+            message: message.message,
+            ordinal: message.ordinal ?? 0,
+        }));
+    });
+    client.chat.on('chatRoomGroupMemberStateChange', (details) => {
+        if (details.chat_group_id != groupId) {
+            return;
+        }
+        switch (details.change) {
+            case SteamUser.EChatRoomMemberStateChange.Joined:
+                feed.join(chatRoomMember(wrapper, details.member.steamid));
+                break;
+            case SteamUser.EChatRoomMemberStateChange.Parted:
+            case SteamUser.EChatRoomMemberStateChange.Kicked:
+            case SteamUser.EChatRoomMemberStateChange.Banned:
+                feed.leave(details.member.steamid.getSteamID64());
+                break;
+        }
+    });
+    // members whose persona we do not have yet are listed by id and sent again once it arrives
+    client.on('user', (steamId) => {
+        if (feed.members.has(steamId.getSteamID64())) {
+            feed.join(chatRoomMember(wrapper, steamId));
+        }
+    });
+
+    feed.reset(members.map((steamId) => chatRoomMember(wrapper, steamId)));
+    const unknown = members.filter((steamId) => !wrapper.getUser(steamId));
+    if (unknown.length > 0) {
+        client.getPersonas(unknown).catch((ex) => console.error(ex));
+    }
+    return feed;
+}
+
+// One page of a paged PollChatMessages call (see PollRequest in message.proto)
+async function* pollPage(client: SteamUser, steamId: SteamID, call: PollRequest, compact: boolean) {
+    const bounds = pageBounds(call);
+    const pageSize = call.pageSize!;
+    // one extra message: Steam's own bounds may or may not include the boundary message, the filter below decides
+    let {messages, more_available} = await client.chat.getFriendMessageHistory(steamId, {
+        maxCount: pageSize + 1,
+        startTime: bounds.after ? new Date(bounds.after.time) : undefined,
+        startOrdinal: bounds.after?.ordinal,
+        lastTime: bounds.before ? new Date(bounds.before.time) : undefined,
+        lastOrdinal: bounds.before?.ordinal,
+    });
+    const matching = messages
+        .map((message) => ({
+            message: message,
+            position: {time: message.server_timestamp.getTime(), ordinal: (message as any).ordinal ?? 0},
+        }))
+        .filter((x) => inBounds(x.position, bounds))
+        .sort((a, b) => comparePositions(b.position, a.position));  // newest first
+    const page = matching.slice(0, pageSize).reverse();
+    const more = more_available || matching.length > pageSize;
+    for (let i = 0; i < page.length; ++i) {
+        const {message, position} = page[i];
+        yield new ResponseMessage({
+            ...messageFields(compact, message.sender.getSteamID64(), message.server_timestamp),
+            message: message.message,
+            ordinal: position.ordinal,
+            nextPageToken: i == page.length - 1 && more ? encodePageToken(page[0].position) : undefined,
+        });
+    }
+    console.log(`Done polling page of ${page.length} messages, more: ${more}`)
+}
+
 function authRoute(router: ConnectRouter) {
     router.service(AuthService, {
         async authenticate(call) {
@@ -114,6 +289,7 @@ function authRoute(router: ConnectRouter) {
                     reasonStr: AuthResponse_AuthState.STEAM_GUARD_CODE_REQUEST.toString(),
                     reason: AuthResponse_AuthState.STEAM_GUARD_CODE_REQUEST,
                     sessionKey: sessionKey,
+                    compactWire: wrapper.compactWire,
                 }));
             }
 
@@ -134,6 +310,7 @@ function authRoute(router: ConnectRouter) {
                     reason: AuthResponse_AuthState.SUCCESS,
                     sessionKey: sessionKey,
                     refreshToken: refreshToken,
+                    compactWire: wrapper.compactWire,
                 }));
             }
 
@@ -247,6 +424,7 @@ function authRoute(router: ConnectRouter) {
                 }
             }
 
+            wrapper.compactWire = call.compactWire;  // a client that does not ask keeps the old fields
             console.log("Session key", sessionKey);
             return new Promise<AuthResponse>(async (resolve) => {
                 wrapper.resolve = resolve;
@@ -287,27 +465,138 @@ function messageRoute(router: ConnectRouter) {
                 });
             }
             let client = wrapper.client;
-            let steamId = new SteamID(call.targetId!);
+            let target = requestTarget(call);
+            let steamId = new SteamID(target);
             let message = call.message!;
 
-            try {
-                await client.chat.sendFriendMessage(steamId, message);
-            } catch (ex: any) {
-                console.log("Error while sending message", steamId, message);
-                console.error(ex);
+            async function send(): Promise<SendMessageResult> {
+                try {
+                    await client.chat.sendFriendMessage(steamId, message);
+                } catch (ex: any) {
+                    console.log("Error while sending message", steamId, message);
+                    console.error(ex);
+                    return new SendMessageResult({
+                        success: false,
+                        reason: SendMessageResult_SendMessageResultCode.UNKNOWN_ERROR,
+                        reasonStr: ex.message,
+                    });
+                }
+
+                return new SendMessageResult({
+                    success: true,
+                    reason: SendMessageResult_SendMessageResultCode.SUCCESS,
+                    reasonStr: "Success",
+                });
+            }
+
+            return sendOnce(wrapper, target, call.idempotencyKey, call.afterKey, send);
+        },
+        async sendChatRoomMessage(call: ChatRoomMessageRequest): Promise<SendMessageResult> {
+            console.log("Received", call.getType().typeName, call.toJson());
+            let wrapper = activeSessions.get(call.sessionKey!);
+            if (!wrapper) {
                 return new SendMessageResult({
                     success: false,
-                    reason: SendMessageResult_SendMessageResultCode.UNKNOWN_ERROR,
-                    reasonStr: ex.message,
+                    reason: SendMessageResult_SendMessageResultCode.INVALID_SESSION_KEY,
+                    reasonStr: "Invalid session key",
                 });
             }
+            let client = wrapper.client;
 
-            return new SendMessageResult({
-                success: true,
-                reason: SendMessageResult_SendMessageResultCode.SUCCESS,
-                reasonStr: "Success",
+            async function send(): Promise<SendMessageResult> {
+                try {
+                    await client.chat.sendChatMessage(call.groupId, call.chatId, call.message);
+                } catch (ex: any) {
+                    console.log("Error while sending chat room message", call.groupId, call.chatId);
+                    console.error(ex);
+                    return new SendMessageResult({
+                        success: false,
+                        reason: SendMessageResult_SendMessageResultCode.UNKNOWN_ERROR,
+                        reasonStr: ex.message,
+                    });
+                }
+                return new SendMessageResult({
+                    success: true,
+                    reason: SendMessageResult_SendMessageResultCode.SUCCESS,
+                    reasonStr: "Success",
+                });
+            }
+
+            return sendOnce(wrapper, `${call.groupId}/${call.chatId}`, call.idempotencyKey, undefined, send);
+        },
+        async getChatRooms(call: ChatRoomsRequest): Promise<ChatRoomsResponse> {
+            console.log("Received", call.getType().typeName, call.toJson());
+            let wrapper = activeSessions.get(call.sessionKey!);
+            if (!wrapper) {
+                throw new Error("Invalid session key");
+            }
+            const {chat_room_groups} = await wrapper.client.chat.getGroups();
+            return new ChatRoomsResponse({
+                rooms: Object.entries(chat_room_groups).flatMap(([groupId, group]: [string, any]) => {
+                    const summary = group.group_summary;
+                    return (summary.chat_rooms ?? []).map((room) => new ChatRoom({
+                        groupId: groupId,
+                        chatId: room.chat_id,
+                        name: `${summary.chat_group_name} / ${room.chat_name}`,
+                        memberCount: summary.active_member_count ?? 0,
+                    }));
+                }),
             });
         },
+        async searchUsers(call: SearchUsersRequest): Promise<SearchUsersResponse> {
+            console.log("Received", call.getType().typeName, call.toJson());
+            let wrapper = activeSessions.get(call.sessionKey!);
+            if (!wrapper) {
+                throw new Error("Invalid session key");
+            }
+            const limit = call.limit || 50;
+            // Steam has no name search for clients: a SteamID is looked up, names match every persona this session
+            // has seen (friends, chat room members, ...)
+            let steamId: SteamID | undefined;
+            try {
+                steamId = new SteamID(call.query.trim());
+            } catch (ex) {
+                steamId = undefined;
+            }
+            if (steamId?.isValidIndividual()) {
+                if (!wrapper.getUser(steamId)) {
+                    await wrapper.client.getPersonas([steamId]);
+                }
+                return new SearchUsersResponse({
+                    users: wrapper.getUser(steamId) ? [makePersona(wrapper, steamId.getSteamID64())] : [],
+                });
+            }
+            const terms = foldForSearch(call.query).split(/\s+/).filter((term) => term.length > 0);
+            if (terms.length == 0) {
+                return new SearchUsersResponse();
+            }
+            const users: Persona[] = [];
+            for (const [id, user] of Object.entries(wrapper.users)) {
+                const name = foldForSearch(user.player_name ?? "");
+                if (terms.every((term) => name.includes(term))) {
+                    users.push(makePersona(wrapper, id));
+                    if (users.length >= limit) {
+                        break;
+                    }
+                }
+            }
+            return new SearchUsersResponse({users: users});
+        },
+        async* watchChatRoom(call: WatchChatRoomRequest, context: HandlerContext) {
+            console.log("Received", call.getType().typeName, call.toJson());
+            let wrapper = activeSessions.get(call.sessionKey!);
+            if (!wrapper) {
+                throw new Error("Invalid session key");
+            }
+            const key = `${call.groupId}/${call.chatId}`;
+            if (!wrapper.chatRooms.has(key)) {
+                const feed = startChatRoomFeed(wrapper, call.groupId, call.chatId);
+                feed.catch(() => wrapper!.chatRooms.delete(key));  // the next watch tries again
+                wrapper.chatRooms.set(key, feed);
+            }
+            const feed = await wrapper.chatRooms.get(key)!;
+            yield* feed.watch(call.knownVersion, context.signal);
+        },
         async* streamFriendMessages(call: StreamChatRequest) {
             // TODO: bidirectional streaming is error-prone, prefer polling for active sessions instead
             // StreamFriendMessagesRequest: only contains sessionKey
@@ -324,9 +613,9 @@ function messageRoute(router: ConnectRouter) {
             let listener = function (message) {
                 console.log("Received friendMessage", message);
                 let responseMessage = new ResponseMessage({
-                    senderId: message.steamid_friend.getSteamID64(),
+                    ...messageFields(wrapper!.compactWire, message.steamid_friend.getSteamID64(),
+                        message.server_timestamp),
                     message: message.message,
-                    timestamp: Timestamp.fromDate(message.server_timestamp),
                 });
                 console.log("Sending", responseMessage.toJson());
                 messages.push(responseMessage);
@@ -352,18 +641,29 @@ function messageRoute(router: ConnectRouter) {
             let client = wrapper.client;
 
             console.debug("Start polling active sessions");
+            const since = requestTime(call.since, call.sinceNs);
             let {sessions, timestamp} = await client.chat.getActiveFriendMessageSessions(
-                call.since ? {conversationsSince: call.since.toDate()} : undefined);
+                since !== undefined ? {conversationsSince: new Date(since)} : undefined);
+            const compact = wrapper.compactWire;
             var sessionsResult = sessions.map((session) => {
-                return {
-                    targetId: session.steamid_friend.getSteamID64(),
+                const targetId = session.steamid_friend.getSteamID64();
+                return compact ? {
+                    target: BigInt(targetId),
+                    lastMessageTimestampNs: toNs(session.time_last_message),
+                    lastViewTimestampNs: toNs(session.time_last_view),
+                    unreadCount: session.unread_message_count,
+                } : {
+                    targetId: targetId,
                     lastMessageTimestamp: Timestamp.fromDate(session.time_last_message),
                     lastViewTimestamp: Timestamp.fromDate(session.time_last_view),
-                    unreadMessageCount: session.unread_message_count,
+                    unreadCount: session.unread_message_count,
                 };
             });
             console.debug("Active sessions:", sessionsResult);
-            return new ActiveMessageSessionResponse({
+            return new ActiveMessageSessionResponse(compact ? {
+                sessions: sessionsResult,
+                timestampNs: toNs(timestamp),
+            } : {
                 sessions: sessionsResult,
                 timestamp: Timestamp.fromDate(timestamp),
             });
@@ -376,8 +676,21 @@ function messageRoute(router: ConnectRouter) {
                 throw new Error("Invalid session key");
             }
             let client = wrapper.client;
-            let steamId = new SteamID(call.targetId!);
-            client.chat.ackFriendMessage(steamId, call.lastTimestamp!.toDate());
+            let steamId = new SteamID(requestTarget(call));
+            client.chat.ackFriendMessage(steamId, new Date(requestTime(call.lastTimestamp, call.lastTimestampNs)!));
+        },
+        async ackFriendMessages(call: AckFriendMessagesRequest) {
+            console.log("Received", call.getType().typeName, call.toJson());
+            let sessionKey = call.sessionKey!;
+            let wrapper = activeSessions.get(sessionKey);
+            if (!wrapper) {
+                throw new Error("Invalid session key");
+            }
+            let client = wrapper.client;
+            for (let ack of call.acks) {
+                client.chat.ackFriendMessage(new SteamID(requestTarget(ack)),
+                    new Date(requestTime(ack.lastTimestamp, ack.lastTimestampNs)!));
+            }
         },
         async* pollChatMessages(call: PollRequest) {
             console.log("Received", call.getType().typeName, call.toJson());
@@ -388,9 +701,14 @@ function messageRoute(router: ConnectRouter) {
                 return;
             }
             let client = wrapper.client;
-            let steamId = new SteamID(call.targetId!);
+            let steamId = new SteamID(requestTarget(call));
+            const compact = wrapper.compactWire;
 
             console.log("Polling messages for", steamId)
+            if (call.pageSize) {
+                yield* pollPage(client, steamId, call, compact);
+                return;
+            }
             // https://stackoverflow.com/questions/46754984/typescript-how-to-use-not-exported-type-definitions/46763911#46763911
             // https://stackoverflow.com/questions/48011353/how-to-unwrap-the-type-of-a-promise
             type FriendMessageArray = ReturnType<SteamChatRoomClient['getFriendMessageHistory']> extends Promise<{
@@ -398,14 +716,16 @@ function messageRoute(router: ConnectRouter) {
                 more_available: boolean
             }> ? U : never;
             const allMessages: FriendMessageArray = [];
-            var startTime = call.startTimestamp?.toDate();
-            var lastTime = call.lastTimestamp?.toDate();
+            const start = requestTime(call.startTimestamp, call.startTimestampNs);
+            const last = requestTime(call.lastTimestamp, call.lastTimestampNs);
+            var startTime = start !== undefined ? new Date(start) : undefined;
+            var lastTime = last !== undefined ? new Date(last) : undefined;
             for (var i = 0; i < 10; ++i) {
                 let {messages, more_available} = await client.chat.getFriendMessageHistory(steamId, {
                     startTime: startTime,
                     lastTime: lastTime,
                 });
-                allMessages.push(...messages.filter((message) => message.server_timestamp.getTime() > (call.startTimestamp?.toDate().getTime() || 0)));
+                allMessages.push(...messages.filter((message) => message.server_timestamp.getTime() > (start || 0)));
                 if (!more_available) {
                     break;
                 }
@@ -418,9 +738,8 @@ function messageRoute(router: ConnectRouter) {
 
             for await (let message of allMessages) {
                 yield new ResponseMessage({
-                    senderId: message.sender.getSteamID64(),
+                    ...messageFields(compact, message.sender.getSteamID64(), message.server_timestamp),
                     message: message.message,
-                    timestamp: Timestamp.fromDate(message.server_timestamp),
                 });
             }
             console.log(`Done polling ${allMessages.length} messages`)
@@ -445,76 +764,28 @@ function messageRoute(router: ConnectRouter) {
             await checkFriendsLoaded(Date.now(), 5000);
 
             let client = wrapper.client;
-
-            function makePersona(steamId: string, relationship: SteamUser.EFriendRelationship) {
-                let friend = wrapper!.getUser(steamId);
-                if (!friend) {
-                    throw new Error("Invalid steamId");
-                }
-                var personaState = friend.persona_state;
-                if (personaState === undefined || personaState === null) {
-                    personaState = SteamUser.EPersonaState.Offline;
-                }
-                let isOnline = personaState !== SteamUser.EPersonaState.Offline;
-                return new Persona({
-                    id: steamId,
-                    name: friend.player_name,
-                    personaState: (personaState as unknown) as PersonaState,
-                    avatarUrl: {
-                        icon: friend.avatar_url_icon,
-                        medium: friend.avatar_url_medium,
-                        full: friend.avatar_url_full,
-                    },
-                    // lastLogoff: Timestamp.fromDate(friend.last_logoff),
-                    // lastLogon: Timestamp.fromDate(friend.last_logon),
-                    // lastSeenOnline: Timestamp.fromDate(friend.last_seen_online),
-                });
-            }
+            const me = client.steamID!.getSteamID64();
 
             return new FriendsListResponse({
-                user: makePersona(client.steamID!.getSteamID64(), SteamUser.EFriendRelationship.RequestInitiator),
-                friends: Object.entries(client.myFriends).map(([steamId, relationship]) => {
+                user: makePersona(wrapper, me),
+                friends: Object.keys(client.myFriends).filter((steamId) => steamId != me).map((steamId) => {
                     try {
-                        return makePersona(steamId, relationship);
+                        return makePersona(wrapper!, steamId);
                     } catch (ex) {
                         console.log("Error while getting friend", typeof ex);
                         console.error(ex);
                         return undefined;
                     }
-                }).filter((persona) => persona !== undefined && persona.id != client.steamID?.getSteamID64()) as Persona[],
+                }).filter((persona) => persona !== undefined) as Persona[],
             });
         }
     });
 }
 
 async function main() {
-    const server = fastify({http2: true});
-    const endpoints: string[] = [];
-
-    await server.register(fastifyConnectPlugin, {
-        routes(router) {
-            authRoute(router);
-            messageRoute(router);
-            // Add each endpoint to the list
-            router.handlers.forEach((route) => {
-                endpoints.push(route.requestPath);
-            });
-            return router;
-        },
-    });
-
-    server.get("/", (_, reply) => {
-        reply.type("text/plain");
-        reply.send("Hello World!");
-    });
-
-    await server.listen({host: "localhost", port: 8080});
-    console.log("server is listening at", server.addresses());
-
-    // Print the list of endpoints
-    console.log("Available endpoints:");
-    endpoints.forEach((endpoint) => {
-        console.log(endpoint);
+    await startServer((router) => {
+        authRoute(router);
+        messageRoute(router);
     });
 
     // Cleanup function to terminate all SteamUser clients
@@ -0,0 +1,33 @@
+import {PartialMessage, Timestamp} from "@bufbuild/protobuf";
+import {Persona, ResponseMessage} from './protobufs/comm_protobufs/message_pb'
+
+// Compact wire form, for sessions that negotiated compactWire (see auth.proto): SteamIDs as fixed64 and timestamps as
+// sfixed64 nanoseconds, both bigint in protobuf-es. Other sessions keep decimal strings and google.protobuf.Timestamp.
+
+export function toNs(time: Date | number): bigint {
+    return BigInt(time instanceof Date ? time.getTime() : time) * 1000000n;
+}
+
+// the target of a request, in whichever form the client sent it
+export function requestTarget(call: { targetId: string, target: bigint }): string {
+    return call.target ? call.target.toString() : call.targetId;
+}
+
+// ms since the epoch of a request's Timestamp or compact nanoseconds field
+export function requestTime(timestamp: Timestamp | undefined, ns: bigint | undefined): number | undefined {
+    if (timestamp) {
+        return timestamp.toDate().getTime();
+    }
+    return ns !== undefined ? Number(ns / 1000000n) : undefined;
+}
+
+export function messageFields(compact: boolean, senderId: string,
+                              time: Date | number): PartialMessage<ResponseMessage> {
+    return compact
+        ? {sender: BigInt(senderId), timestampNs: toNs(time)}
+        : {senderId: senderId, timestamp: Timestamp.fromDate(time instanceof Date ? time : new Date(time))};
+}
+
+export function personaId(compact: boolean, steamId: string): PartialMessage<Persona> {
+    return compact ? {steamId: BigInt(steamId)} : {id: steamId};
+}
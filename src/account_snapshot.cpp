@@ -0,0 +1,179 @@
+#include "account_snapshot.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SteamClient {
+    namespace {
+        constexpr char snapshot_magic[8] = {'P', 'S', 'T', 'S', 'N', 'A', 'P', '\0'};
+        constexpr uint32_t snapshot_version = 1;
+
+        struct SnapshotHeader {
+            char magic[8];
+            uint32_t version;
+            uint64_t payloadSize;
+            uint64_t checksum;  // FNV-1a of the payload
+            int64_t savedAtNs;
+        };
+
+        uint64_t fnv1a(std::string_view data) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (unsigned char c: data) {
+                hash = (hash ^ c) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        template<typename T>
+        void put(std::string &out, T value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        void put_string(std::string &out, std::string_view value) {
+            put<uint32_t>(out, (uint32_t) value.size());
+            out.append(value);
+        }
+
+        void put_buddy(std::string &out, const Buddy &buddy) {
+            put<int32_t>(out, buddy.personaState);
+            put<uint8_t>(out, buddy.gameid.has_value());
+            put<int32_t>(out, buddy.gameid.value_or(0));
+            put_string(out, buddy.id.str());
+            put_string(out, buddy.nickname);
+            put_string(out, buddy.gameExtraInfo);
+            put_string(out, buddy.avatarUrl.icon);
+            put_string(out, buddy.avatarUrl.medium);
+            put_string(out, buddy.avatarUrl.full);
+        }
+
+        // bounds-checked reads from the mapping; any overrun marks the whole snapshot as bad
+        struct Cursor {
+            std::string_view data;
+            bool ok = true;
+
+            template<typename T>
+            T get() {
+                T value{};
+                if (data.size() < sizeof(T)) {
+                    ok = false;
+                    return value;
+                }
+                std::memcpy(&value, data.data(), sizeof(T));
+                data.remove_prefix(sizeof(T));
+                return value;
+            }
+
+            std::string get_string() {
+                auto size = get<uint32_t>();
+                if (!ok || data.size() < size) {
+                    ok = false;
+                    return {};
+                }
+                std::string value(data.substr(0, size));
+                data.remove_prefix(size);
+                return value;
+            }
+
+            Buddy get_buddy() {
+                Buddy buddy;
+                buddy.personaState = (PersonaState) get<int32_t>();
+                bool hasGame = get<uint8_t>() != 0;
+                auto gameid = get<int32_t>();
+                if (hasGame) {
+                    buddy.gameid = gameid;
+                }
+                buddy.id = SteamId::parse(get_string());
+                buddy.nickname = get_string();
+                buddy.gameExtraInfo = get_string();
+                buddy.avatarUrl.icon = get_string();
+                buddy.avatarUrl.medium = get_string();
+                buddy.avatarUrl.full = get_string();
+                return buddy;
+            }
+        };
+    }
+
+    std::string encode_snapshot(const FriendsList &friends) {
+        std::string payload;
+        put<uint8_t>(payload, friends.me.has_value());
+        if (friends.me.has_value()) {
+            put_buddy(payload, friends.me.value());
+        }
+        put<uint32_t>(payload, (uint32_t) friends.buddies.size());
+        for (auto &buddy: friends.buddies) {
+            put_buddy(payload, buddy);
+        }
+        return payload;
+    }
+
+    bool write_snapshot(const std::string &path, const std::string &payload) {
+        SnapshotHeader header{};
+        std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.version = snapshot_version;
+        header.payloadSize = payload.size();
+        header.checksum = fnv1a(payload);
+        header.savedAtNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+
+        auto tmpPath = path + ".tmp";
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = write(fd, &header, sizeof(header)) == (ssize_t) sizeof(header) &&
+                  write(fd, payload.data(), payload.size()) == (ssize_t) payload.size();
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    std::optional<AccountSnapshot> read_snapshot(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SnapshotHeader)) {
+            close(fd);
+            return std::nullopt;
+        }
+        auto size = (size_t) st.st_size;
+        void *base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            return std::nullopt;
+        }
+
+        std::optional<AccountSnapshot> snapshot;
+        SnapshotHeader header{};
+        std::memcpy(&header, base, sizeof(header));
+        std::string_view payload(static_cast<const char *>(base) + sizeof(header), size - sizeof(header));
+        if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) == 0 &&
+            header.version == snapshot_version && header.payloadSize == payload.size() &&
+            header.checksum == fnv1a(payload)) {
+            AccountSnapshot result;
+            result.savedAtNs = header.savedAtNs;
+            Cursor cursor{payload};
+            if (cursor.get<uint8_t>()) {
+                result.friends.me = cursor.get_buddy();
+            }
+            auto buddyCount = cursor.get<uint32_t>();
+            for (uint32_t i = 0; i < buddyCount && cursor.ok; ++i) {
+                result.friends.buddies.push_back(cursor.get_buddy());
+            }
+            if (cursor.ok && cursor.data.empty()) {
+                snapshot = std::move(result);
+            }
+        }
+        munmap(base, size);
+        return snapshot;
+    }
+} // SteamClient
@@ -0,0 +1,29 @@
+#ifndef PIDGIN_STEAM_ACCOUNT_SNAPSHOT_H
+#define PIDGIN_STEAM_ACCOUNT_SNAPSHOT_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include "grpc_client_wrapper.h"
+
+namespace SteamClient {
+    /*
+     * Last known friends list of an account, persisted so that the buddy list can be shown at login before the first
+     * RPC completes. The file is a fixed header followed by length-prefixed records; it is read through a read-only
+     * mapping and rejected as a whole if the magic, version, length or checksum do not match. Writes go to a
+     * temporary file that is renamed over the old one, so readers never see a partial snapshot.
+     */
+    struct AccountSnapshot {
+        FriendsList friends;
+        int64_t savedAtNs = 0;
+    };
+
+    // payload only; compare two encodings to find out whether anything changed
+    std::string encode_snapshot(const FriendsList &friends);
+
+    bool write_snapshot(const std::string &path, const std::string &payload);
+
+    std::optional<AccountSnapshot> read_snapshot(const std::string &path);
+} // SteamClient
+
+#endif //PIDGIN_STEAM_ACCOUNT_SNAPSHOT_H
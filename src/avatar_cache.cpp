@@ -0,0 +1,120 @@
+#include "avatar_cache.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace SteamClient {
+    namespace {
+        constexpr std::string_view avatar_suffix = ".img";
+
+        bool is_hex(std::string_view text) {
+            return std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isxdigit(c) != 0; });
+        }
+    }
+
+    AvatarCache::AvatarCache(std::string dir, uint64_t maxBytes) : _dir(std::move(dir)), _maxBytes(maxBytes) {}
+
+    std::string AvatarCache::path_for(const std::string &hash) const {
+        return _dir + "/" + hash + std::string(avatar_suffix);
+    }
+
+    std::optional<std::string> AvatarCache::get(const std::string &hash) {
+        auto path = path_for(hash);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+        struct stat st{};
+        std::optional<std::string> data;
+        if (fstat(fd, &st) == 0) {
+            std::string buffer((size_t) st.st_size, '\0');
+            if (read(fd, buffer.data(), buffer.size()) == (ssize_t) buffer.size()) {
+                data = std::move(buffer);
+                futimens(fd, nullptr);  // most recently used
+            }
+        }
+        close(fd);
+        return data;
+    }
+
+    bool AvatarCache::put(const std::string &hash, std::string_view data) {
+        auto path = path_for(hash);
+        auto tmpPath = path + ".tmp";
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = write(fd, data.data(), data.size()) == (ssize_t) data.size();
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        evict();
+        return true;
+    }
+
+    void AvatarCache::evict() {
+        struct Entry {
+            std::string path;
+            int64_t usedNs;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        DIR *dir = opendir(_dir.c_str());
+        if (dir == nullptr) {
+            return;
+        }
+        while (dirent *entry = readdir(dir)) {
+            std::string_view name(entry->d_name);
+            if (!name.ends_with(avatar_suffix)) {
+                continue;
+            }
+            auto path = _dir + "/" + std::string(name);
+            struct stat st{};
+            if (stat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            entries.push_back({path, (int64_t) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec,
+                               (uint64_t) st.st_size});
+            total += st.st_size;
+        }
+        closedir(dir);
+        if (total <= _maxBytes) {
+            return;
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.usedNs < b.usedNs;
+        });
+        for (auto &entry: entries) {
+            if (total <= _maxBytes) {
+                break;
+            }
+            if (unlink(entry.path.c_str()) == 0) {
+                total -= entry.size;
+            }
+        }
+    }
+
+    std::string avatar_hash(std::string_view url) {
+        // e.g. https://avatars.steamstatic.com/fef49e7fa7e1997310d705b2a6158ff8dc1cdfeb_medium.jpg
+        auto name = url.substr(url.rfind('/') + 1);
+        auto hash = name.substr(0, name.find_first_of("_."));
+        if (hash.size() == 40 && is_hex(hash)) {
+            return std::string(hash);
+        }
+        uint64_t fnv = 14695981039346656037ULL;
+        for (unsigned char c: url) {
+            fnv = (fnv ^ c) * 1099511628211ULL;
+        }
+        char buffer[17];
+        std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) fnv);
+        return buffer;
+    }
+} // SteamClient
@@ -0,0 +1,36 @@
+#ifndef PIDGIN_STEAM_AVATAR_CACHE_H
+#define PIDGIN_STEAM_AVATAR_CACHE_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace SteamClient {
+    /*
+     * Content-addressed on-disk cache of avatar images, one file per avatar hash. Entries never go stale (a changed
+     * avatar has a new hash), so there is nothing to revalidate; reads refresh an entry's mtime, and writes evict the
+     * least recently used entries once the directory grows past `maxBytes`.
+     */
+    class AvatarCache {
+    public:
+        AvatarCache(std::string dir, uint64_t maxBytes);
+
+        std::optional<std::string> get(const std::string &hash);
+
+        bool put(const std::string &hash, std::string_view data);
+
+    private:
+        [[nodiscard]] std::string path_for(const std::string &hash) const;
+
+        void evict();
+
+        std::string _dir;
+        uint64_t _maxBytes;
+    };
+
+    // key of the avatar behind `url`: the hash Steam puts in avatar file names, or else a hash of the URL itself
+    std::string avatar_hash(std::string_view url);
+} // SteamClient
+
+#endif //PIDGIN_STEAM_AVATAR_CACHE_H
@@ -2,45 +2,260 @@
 #define PIDGIN_STEAM_CORO_UTILS_H
 
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
 #include <optional>
-#include "cppcoro/task.hpp"
-#include "cppcoro/async_auto_reset_event.hpp"
+#include <vector>
+#include "cppcoro/async_manual_reset_event.hpp"
+#include "cppcoro/async_scope.hpp"
+#include "cppcoro/when_all.hpp"
+#include "pooled_task.h"
+
+/*
+ * Single-producer/single-consumer multi-shot channel with an inline ring buffer.
+ *
+ * The producer calls `post()` from plain code (e.g. the completion queue loop); it never suspends and never waits
+ * for the consumer to reach its next `co_await`. If the consumer is parked in `receive()`, it is resumed directly
+ * from `post()`; otherwise the item is buffered and the next `receive()` completes without suspending.
+ * No coroutine frame is created per item.
+ */
+template<typename T, size_t Capacity = 4>
+class AsyncChannel {
+    static_assert(Capacity > 0);
 
-template<typename T>
-class TaskCompletionSource {
 public:
-    TaskCompletionSource() {
-        m_result = std::nullopt;
+    AsyncChannel() = default;
+
+    AsyncChannel(const AsyncChannel &) = delete;
+
+    AsyncChannel &operator=(const AsyncChannel &) = delete;
+
+    // Returns false if the buffer is full; the item is dropped in that case.
+    bool post(T value) {
+        auto tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        _buffer[tail % Capacity].emplace(std::move(value));
+        _tail.store(tail + 1, std::memory_order_seq_cst);
+        if (void *waiter = _waiter.exchange(nullptr, std::memory_order_seq_cst)) {
+            std::coroutine_handle<>::from_address(waiter).resume();
+        }
+        return true;
     }
 
-    TaskCompletionSource(TaskCompletionSource &) = delete;
+    [[nodiscard]] bool empty() const {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] bool full() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire) == Capacity;
+    }
+
+    auto receive() {
+        struct awaiter {
+            AsyncChannel &channel;
+
+            bool await_ready() const noexcept {
+                return !channel.empty();
+            }
 
-    TaskCompletionSource(TaskCompletionSource &&) noexcept = default;
+            bool await_suspend(std::coroutine_handle<> consumer) noexcept {
+                channel._waiter.store(consumer.address(), std::memory_order_seq_cst);
+                if (channel._tail.load(std::memory_order_seq_cst) == channel._head.load(std::memory_order_relaxed)) {
+                    return true;
+                }
+                // An item raced in after the check in await_ready; reclaim the waiter slot unless the producer
+                // has already taken it (in which case it will resume us).
+                void *expected = consumer.address();
+                return !channel._waiter.compare_exchange_strong(expected, nullptr, std::memory_order_seq_cst);
+            }
 
-    TaskCompletionSource &operator=(TaskCompletionSource &) = delete;
+            T await_resume() {
+                auto head = channel._head.load(std::memory_order_relaxed);
+                auto &slot = channel._buffer[head % Capacity];
+                T value = std::move(*slot);
+                slot.reset();
+                channel._head.store(head + 1, std::memory_order_release);
+                return value;
+            }
+        };
+        return awaiter{*this};
+    }
 
-    TaskCompletionSource &operator=(TaskCompletionSource &&) noexcept = default;
+private:
+    std::array<std::optional<T>, Capacity> _buffer;
+    std::atomic<size_t> _head{0}, _tail{0};
+    std::atomic<void *> _waiter{nullptr};
+};
 
-    cppcoro::task<T> get_task() {
-        m_reset_event.set();
-        co_await m_event;
-        co_return std::move(*m_result);
+namespace detail {
+    template<typename T, typename Factory>
+    PooledTask<void> bounded_worker(size_t &next, size_t count, Factory &factory,
+                                    std::vector<std::optional<T>> &results) {
+        while (next < count) {
+            auto index = next++;
+            results[index].emplace(co_await factory(index));
+        }
     }
+}
 
-    void set_result(T result) {
-        m_result = std::move(result);
-        m_event.set();
+/*
+ * Runs `factory(0) .. factory(count - 1)` with at most `width` of the resulting awaitables in flight at once, and
+ * returns their results in index order. Work is started in index order, so callers control priority by sorting
+ * their inputs. Must be driven from a single thread (the shared cursor is not atomic).
+ */
+template<typename T, typename Factory>
+PooledTask<std::vector<T>> when_all_bounded(size_t count, size_t width, Factory factory) {
+    std::vector<std::optional<T>> results(count);
+    size_t next = 0;
+    std::vector<PooledTask<void>> workers;
+    for (size_t i = 0; i < std::min(std::max<size_t>(width, 1), count); ++i) {
+        workers.push_back(detail::bounded_worker<T>(next, count, factory, results));
     }
+    co_await cppcoro::when_all(std::move(workers));
 
-    cppcoro::task<void> sequenced_set_result(T result) {
-        co_await m_reset_event;
-        set_result(std::move(result));
-        co_return;
+    std::vector<T> values;
+    values.reserve(count);
+    for (auto &x: results) {
+        values.push_back(std::move(*x));
+    }
+    co_return values;
+}
+
+/*
+ * Request coalescing ("singleflight"): concurrent `run()` calls with the same key share one invocation of the
+ * factory, and every caller gets a copy of the one result (or its exception). With a non-zero `ttl`, a completed
+ * result that passes `cacheable` keeps being served to later callers until it expires. Exceptions are never cached.
+ * Must be driven from a single thread.
+ */
+template<typename Key, typename R>
+class SingleFlight {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit SingleFlight(clock::duration ttl = clock::duration::zero(),
+                          std::function<bool(const R &)> cacheable = {})
+            : _ttl(ttl), _cacheable(std::move(cacheable)) {}
+
+    SingleFlight(const SingleFlight &) = delete;
+
+    SingleFlight &operator=(const SingleFlight &) = delete;
+
+    template<typename Factory>
+    PooledTask<R> run(Key key, Factory factory) {
+        if (auto it = _calls.find(key); it != _calls.end()) {
+            auto call = it->second;  // keeps the result alive even if the entry is dropped meanwhile
+            if (!call->done) {
+                ++_coalesced;
+                co_await call->event;
+                co_return call->get();
+            }
+            if (clock::now() < call->expiresAt) {
+                ++_coalesced;
+                co_return call->get();
+            }
+            _calls.erase(it);
+        }
+
+        auto call = std::make_shared<Call>();
+        _calls.emplace(key, call);
+        try {
+            call->result.emplace(co_await factory());
+        } catch (...) {
+            call->error = std::current_exception();
+        }
+        call->done = true;
+        call->expiresAt = clock::now() + _ttl;
+        bool keep = !call->error && _ttl > clock::duration::zero() && (!_cacheable || _cacheable(*call->result));
+        if (auto it = _calls.find(key); !keep && it != _calls.end() && it->second == call) {
+            _calls.erase(it);
+        }
+        call->event.set();  // resumes the waiters inline, each taking its copy
+        co_return call->get();
+    }
+
+    // drops a cached result; calls in flight are unaffected
+    void invalidate(const Key &key) {
+        if (auto it = _calls.find(key); it != _calls.end() && it->second->done) {
+            _calls.erase(it);
+        }
+    }
+
+    // number of run() calls answered without invoking the factory
+    [[nodiscard]] uint64_t coalesced() const {
+        return _coalesced;
     }
 
 private:
-    cppcoro::async_auto_reset_event m_event, m_reset_event;
-    std::optional<T> m_result;
+    struct Call {
+        cppcoro::async_manual_reset_event event;
+        bool done = false;
+        clock::time_point expiresAt;
+        std::optional<R> result;
+        std::exception_ptr error;
+
+        R get() const {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            return *result;
+        }
+    };
+
+    clock::duration _ttl;
+    std::function<bool(const R &)> _cacheable;
+    std::map<Key, std::shared_ptr<Call>> _calls;
+    uint64_t _coalesced = 0;
+};
+
+/*
+ * Starts a task right away (PooledTask is lazy) so that it runs while the caller does something else, e.g. fetching
+ * the next page while the current one is rendered. The result is picked up with `get()`. The task runs in `scope`:
+ * dropping a Prefetched before it finishes leaves it running to completion (its result is discarded), and whatever
+ * it uses must stay alive until `scope` is joined, not just until the Prefetched is gone.
+ */
+template<typename T>
+class Prefetched {
+public:
+    Prefetched(cppcoro::async_scope &scope, PooledTask<T> task) : _state(std::make_shared<State>()) {
+        scope.spawn(run(_state, std::move(task)));
+    }
+
+    // at most once
+    PooledTask<T> get() {
+        auto state = _state;
+        co_await state->ready;
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+        co_return std::move(*state->value);
+    }
+
+private:
+    struct State {
+        std::optional<T> value;
+        std::exception_ptr error;
+        cppcoro::async_manual_reset_event ready;
+    };
+
+    static PooledTask<void> run(std::shared_ptr<State> state, PooledTask<T> task) {
+        try {
+            state->value.emplace(co_await std::move(task));
+        } catch (...) {
+            state->error = std::current_exception();
+        }
+        state->ready.set();
+    }
+
+    std::shared_ptr<State> _state;
 };
 
 #endif //PIDGIN_STEAM_CORO_UTILS_H
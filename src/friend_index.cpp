@@ -0,0 +1,221 @@
+#include "friend_index.h"
+#include <algorithm>
+#include <cstddef>
+#include <glib.h>
+
+namespace SteamClient {
+    namespace {
+        // distinct byte trigrams within the words of `text`
+        std::vector<uint32_t> trigrams_of(std::string_view text) {
+            std::vector<uint32_t> trigrams;
+            for_each_word(text, [&](std::string_view word) {
+                for (size_t i = 0; i + 3 <= word.size(); ++i) {
+                    trigrams.push_back((uint32_t) (uint8_t) word[i] << 16 | (uint32_t) (uint8_t) word[i + 1] << 8 |
+                                       (uint8_t) word[i + 2]);
+                }
+            });
+            std::sort(trigrams.begin(), trigrams.end());
+            trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+            return trigrams;
+        }
+
+        enum TermMatch {
+            WORD_PREFIX,
+            SUBSTRING,
+            NO_MATCH,
+        };
+
+        TermMatch match_term(std::string_view text, std::string_view term) {
+            auto result = NO_MATCH;
+            for (auto pos = text.find(term); pos != std::string_view::npos; pos = text.find(term, pos + 1)) {
+                if (pos == 0 || !is_word_byte(text[pos - 1])) {
+                    return WORD_PREFIX;
+                }
+                result = SUBSTRING;
+            }
+            return result;
+        }
+    }
+
+    std::string fold_for_search(std::string_view text) {
+        bool ascii = std::all_of(text.begin(), text.end(), [](unsigned char c) { return c < 0x80; });
+        if (!ascii) {
+            // compatibility decomposition splits off the diacritics (and maps e.g. fullwidth letters to ASCII)
+            if (gchar *decomposed = g_utf8_normalize(text.data(), (gssize) text.size(), G_NORMALIZE_NFKD)) {
+                std::string stripped;
+                for (const gchar *p = decomposed; *p != '\0'; p = g_utf8_next_char(p)) {
+                    gunichar c = g_utf8_get_char(p);
+                    if (!g_unichar_ismark(c)) {
+                        gchar buffer[6];
+                        stripped.append(buffer, g_unichar_to_utf8(c, buffer));
+                    }
+                }
+                g_free(decomposed);
+                gchar *folded = g_utf8_casefold(stripped.data(), (gssize) stripped.size());
+                std::string result(folded);
+                g_free(folded);
+                return result;
+            }
+            // not UTF-8: only the ASCII letters are folded
+        }
+        std::string result(text);
+        for (auto &c: result) {
+            if (c >= 'A' && c <= 'Z') {
+                c = (char) (c - 'A' + 'a');
+            }
+        }
+        return result;
+    }
+
+    void FriendIndex::upsert(const std::string &id, const std::vector<std::string> &names, bool isFriend) {
+        uint32_t slot;
+        if (auto it = _slots.find(id); it != _slots.end()) {
+            slot = it->second;
+            auto &entry = _entries[slot];
+            if (entry.isFriend && !isFriend) {
+                return;
+            }
+            entry.isFriend = isFriend;
+            if (entry.names == names) {
+                return;  // the common case: called for every friend on every friends list update
+            }
+            unindex(slot);
+        } else if (!_freeSlots.empty()) {
+            slot = _freeSlots.back();
+            _freeSlots.pop_back();
+        } else {
+            slot = (uint32_t) _entries.size();
+            _entries.emplace_back();
+        }
+
+        auto &entry = _entries[slot];
+        entry.id = id;
+        entry.names = names;
+        entry.isFriend = isFriend;
+        entry.folded.clear();
+        for (auto &name: names) {
+            if (!name.empty()) {
+                entry.folded += fold_for_search(name);
+                entry.folded += '\n';
+            }
+        }
+        entry.folded += id;
+        _slots[id] = slot;
+        index(slot);
+    }
+
+    void FriendIndex::remove(const std::string &id) {
+        auto it = _slots.find(id);
+        if (it == _slots.end()) {
+            return;
+        }
+        unindex(it->second);
+        _entries[it->second] = {};
+        _freeSlots.push_back(it->second);
+        _slots.erase(it);
+    }
+
+    void FriendIndex::index(uint32_t slot) {
+        const auto &folded = _entries[slot].folded;
+        for_each_word(folded, [&](std::string_view word) {
+            std::pair<std::string, uint32_t> key(word, slot);
+            _words.insert(std::lower_bound(_words.begin(), _words.end(), key), std::move(key));
+        });
+        for (auto trigram: trigrams_of(folded)) {
+            auto &slots = _trigrams[trigram];
+            slots.insert(std::lower_bound(slots.begin(), slots.end(), slot), slot);
+        }
+    }
+
+    void FriendIndex::unindex(uint32_t slot) {
+        const auto &folded = _entries[slot].folded;
+        for_each_word(folded, [&](std::string_view word) {
+            auto range = std::equal_range(_words.begin(), _words.end(), std::make_pair(std::string(word), slot));
+            _words.erase(range.first, range.second);
+        });
+        for (auto trigram: trigrams_of(folded)) {
+            auto it = _trigrams.find(trigram);
+            if (it == _trigrams.end()) {
+                continue;
+            }
+            auto &slots = it->second;
+            auto range = std::equal_range(slots.begin(), slots.end(), slot);
+            slots.erase(range.first, range.second);
+            if (slots.empty()) {
+                _trigrams.erase(it);
+            }
+        }
+    }
+
+    std::vector<uint32_t> FriendIndex::substring_candidates(std::string_view term) const {
+        std::vector<const std::vector<uint32_t> *> lists;
+        for (auto trigram: trigrams_of(term)) {
+            auto it = _trigrams.find(trigram);
+            if (it == _trigrams.end()) {
+                return {};
+            }
+            lists.push_back(&it->second);
+        }
+        // intersect starting from the shortest list, so that the intermediate results stay small
+        std::sort(lists.begin(), lists.end(), [](auto *a, auto *b) { return a->size() < b->size(); });
+        std::vector<uint32_t> candidates(lists.front()->begin(), lists.front()->end());
+        std::vector<uint32_t> narrowed;
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+            narrowed.clear();
+            std::set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(),
+                                  std::back_inserter(narrowed));
+            candidates.swap(narrowed);
+        }
+        return candidates;
+    }
+
+    std::vector<uint32_t> FriendIndex::prefix_candidates(std::string_view term) const {
+        std::vector<uint32_t> candidates;
+        auto it = std::lower_bound(_words.begin(), _words.end(), std::make_pair(std::string(term), (uint32_t) 0));
+        for (; it != _words.end() && it->first.starts_with(term); ++it) {
+            candidates.push_back(it->second);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        return candidates;
+    }
+
+    std::vector<FriendIndex::Match> FriendIndex::search(std::string_view query, size_t limit) const {
+        auto folded = fold_for_search(query);
+        std::vector<std::string_view> terms;
+        for_each_word(folded, [&](std::string_view term) { terms.push_back(term); });
+        if (terms.empty() || limit == 0) {
+            return {};
+        }
+        // the longest term narrows the candidates down the most; the others are checked on each candidate
+        auto longest = *std::max_element(terms.begin(), terms.end(), [](auto a, auto b) {
+            return a.size() < b.size();
+        });
+        auto candidates = longest.size() >= 3 ? substring_candidates(longest) : prefix_candidates(longest);
+
+        std::vector<std::pair<int, uint32_t>> ranked;  // (rank, slot), lower ranks first
+        for (auto slot: candidates) {
+            auto &entry = _entries[slot];
+            bool allPrefixes = true, allMatch = true;
+            for (auto term: terms) {
+                auto match = match_term(entry.folded, term);
+                allPrefixes = allPrefixes && match == WORD_PREFIX;
+                allMatch = allMatch && match != NO_MATCH;
+            }
+            if (allMatch) {
+                ranked.emplace_back((allPrefixes ? 0 : 2) + (entry.isFriend ? 0 : 1), slot);
+            }
+        }
+        auto end = ranked.begin() + (std::ptrdiff_t) std::min(limit, ranked.size());
+        std::partial_sort(ranked.begin(), end, ranked.end(), [this](const auto &a, const auto &b) {
+            return a.first != b.first ? a.first < b.first : _entries[a.second].folded < _entries[b.second].folded;
+        });
+
+        std::vector<Match> matches;
+        for (auto it = ranked.begin(); it != end; ++it) {
+            auto &entry = _entries[it->second];
+            matches.push_back({entry.id, entry.names.empty() ? entry.id : entry.names.front(), entry.isFriend});
+        }
+        return matches;
+    }
+} // SteamClient
@@ -0,0 +1,90 @@
+#ifndef PIDGIN_STEAM_FRIEND_INDEX_H
+#define PIDGIN_STEAM_FRIEND_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace SteamClient {
+    // lower case without diacritics ("Zoë" -> "zoe"), the form FriendIndex compares names in
+    std::string fold_for_search(std::string_view text);
+
+    // anything but ASCII punctuation and whitespace; bytes of multibyte characters count as word bytes
+    inline bool is_word_byte(unsigned char c) {
+        return c >= 0x80 || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    // calls f with each run of word bytes in `text`
+    template<typename F>
+    void for_each_word(std::string_view text, F &&f) {
+        size_t i = 0;
+        while (i < text.size()) {
+            while (i < text.size() && !is_word_byte(text[i])) {
+                ++i;
+            }
+            auto start = i;
+            while (i < text.size() && is_word_byte(text[i])) {
+                ++i;
+            }
+            if (i > start) {
+                f(text.substr(start, i - start));
+            }
+        }
+    }
+
+    /*
+     * Name search over friends and other known personas (e.g. chat room members), kept up to date entry by entry.
+     * Names are folded with fold_for_search and indexed twice: a sorted word list answers word prefixes ("jo" finds
+     * "John Smith" and "Mary-Jo"), and trigram posting lists narrow down substrings of three or more characters
+     * ("ohn"), so a search only ever looks at entries that can match. Every word of a query has to match; entries
+     * where all of them are word prefixes rank first, then friends before other personas.
+     */
+    class FriendIndex {
+    public:
+        struct Match {
+            std::string id;
+            std::string name;  // first of the names it was indexed under
+            bool isFriend;
+        };
+
+        // (re)indexes `id` under `names` and its SteamID; a known persona does not replace a friend's entry
+        void upsert(const std::string &id, const std::vector<std::string> &names, bool isFriend);
+
+        void remove(const std::string &id);
+
+        [[nodiscard]] std::vector<Match> search(std::string_view query, size_t limit) const;
+
+        [[nodiscard]] size_t size() const {
+            return _slots.size();
+        }
+
+    private:
+        struct Entry {
+            std::string id;
+            std::vector<std::string> names;
+            std::string folded;  // folded names and SteamID, separated by '\n'
+            bool isFriend = false;
+        };
+
+        void index(uint32_t slot);
+
+        void unindex(uint32_t slot);
+
+        // slots whose text contains `term` (at least three bytes long)
+        [[nodiscard]] std::vector<uint32_t> substring_candidates(std::string_view term) const;
+
+        // slots with a word starting with `term`
+        [[nodiscard]] std::vector<uint32_t> prefix_candidates(std::string_view term) const;
+
+        std::vector<Entry> _entries;  // by slot; a removed entry has an empty id until the slot is reused
+        std::vector<uint32_t> _freeSlots;
+        std::unordered_map<std::string, uint32_t> _slots;  // SteamID -> slot
+        std::vector<std::pair<std::string, uint32_t>> _words;  // sorted
+        std::unordered_map<uint32_t, std::vector<uint32_t>> _trigrams;  // packed trigram -> sorted slots
+    };
+} // SteamClient
+
+#endif //PIDGIN_STEAM_FRIEND_INDEX_H
@@ -86,12 +86,15 @@ namespace SteamClient {
         }
 
         FriendsList getFriendsList() {
-            auto convert = [](const steam::Persona &user) -> Buddy {
-                const auto& avatarUrl = user.avatarurl();
+            // strings are moved out of the response, which is discarded afterwards
+            auto convert = [](steam::Persona &user) -> Buddy {
+                auto &avatarUrl = *user.mutable_avatarurl();
                 return {
-                    user.name(), user.id(), (PersonaState) (int) user.personastate(),
+                    std::move(*user.mutable_name()), SteamId::parse(user.id()),
+                    (PersonaState) (int) user.personastate(),
                     {}, "",  // TODO: get rich presence
-                    {avatarUrl.icon(), avatarUrl.medium(), avatarUrl.full()}
+                    {std::move(*avatarUrl.mutable_icon()), std::move(*avatarUrl.mutable_medium()),
+                     std::move(*avatarUrl.mutable_full())}
                 };
             };
 
@@ -109,10 +112,11 @@ namespace SteamClient {
             std::cout << "GetFriends successful" << std::endl;
             std::cout << "Friends: " << response.friends_size() << std::endl;
             std::vector<Buddy> friends;
-            for (auto &x: response.friends()) {
-                friends.emplace_back(convert(x));
+            friends.reserve(response.friends_size());
+            for (auto &x: *response.mutable_friends()) {
+                friends.push_back(convert(x));
             }
-            return {std::optional<Buddy>(convert(response.user())), friends};
+            return {convert(*response.mutable_user()), std::move(friends)};
         }
 
         static google::protobuf::Timestamp *
@@ -149,10 +153,10 @@ namespace SteamClient {
             steam::ResponseMessage response;
             while (clientReader->Read(&response)) {
                 Message message;
-                message.senderId = response.senderid();  // TODO: send persona info for mapping
-                message.message = response.message();
+                message.senderId = SteamId::parse(response.senderid());  // TODO: send persona info for mapping
+                message.message = std::move(*response.mutable_message());
                 message.timestamp_ns = to_timestamp_ns(response.timestamp());
-                messages.push_back(message);
+                messages.push_back(std::move(message));
             }
             return messages;
         }
@@ -168,7 +172,7 @@ namespace SteamClient {
             if (!status.ok()) {
                 std::cout << "SendMessage failed (gRPC failure)" << std::endl;
                 std::cout << status.error_code() << ": " << status.error_message() << std::endl;
-                return SEND_UNKNOWN_FAILURE;
+                return SEND_RPC_FAILURE;
             }
             switch (response.reason()) {
                 case steam::SendMessageResult_SendMessageResultCode_SUCCESS:
@@ -208,7 +212,7 @@ namespace SteamClient {
             std::vector<ActiveMessageSessions::Session> sessions;
             for (auto &x: response.sessions()) {
                 ActiveMessageSessions::Session session;
-                session.id = x.targetid();
+                session.id = SteamId::parse(x.targetid());
                 session.lastMessageTimestampNs = to_timestamp_ns(x.lastmessagetimestamp());
                 session.lastViewedTimestampNs = to_timestamp_ns(x.lastviewtimestamp());
                 session.unreadMessageCount = x.unreadcount();
@@ -3,7 +3,12 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <compare>
+#include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <optional>
 #include <vector>
 #include <memory>
@@ -20,6 +25,57 @@ namespace SteamClient {
         INVISIBLE = 7,
     };
 
+    /*
+     * A SteamID64. It travels as a fixed64 (see "compactWire" in auth.proto) and is only spelled out in decimal where
+     * libpurple needs a name, so comparisons and lookups never parse.
+     */
+    class SteamId {
+    public:
+        constexpr SteamId() = default;
+
+        constexpr explicit SteamId(uint64_t value) : _value(value) {}
+
+        // the invalid SteamId if `text` is not a decimal SteamID64
+        static SteamId parse(std::string_view text) {
+            uint64_t value = 0;
+            auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            return error == std::errc() && end == text.data() + text.size() ? SteamId(value) : SteamId();
+        }
+
+        [[nodiscard]] std::string str() const {
+            char buffer[20];
+            auto end = std::to_chars(buffer, buffer + sizeof buffer, _value).ptr;
+            return {buffer, end};
+        }
+
+        [[nodiscard]] constexpr uint64_t value() const {
+            return _value;
+        }
+
+        constexpr explicit operator bool() const {
+            return _value != 0;
+        }
+
+        // EAccountType, bits 52-55
+        [[nodiscard]] constexpr unsigned accountType() const {
+            return (unsigned) (_value >> 52) & 0xF;
+        }
+
+        // a Steam group (clan) rather than a user
+        [[nodiscard]] constexpr bool isGroup() const {
+            return accountType() == 7;
+        }
+
+        constexpr auto operator<=>(const SteamId &) const = default;
+
+    private:
+        uint64_t _value = 0;
+    };
+
+    inline std::ostream &operator<<(std::ostream &out, SteamId id) {
+        return out << id.value();
+    }
+
     struct AvatarUrl {
         std::string icon;
         std::string medium;
@@ -28,7 +84,7 @@ namespace SteamClient {
 
     struct Buddy {
         std::string nickname;
-        std::string id;
+        SteamId id;
         PersonaState personaState;
 
         // rich presence
@@ -38,10 +94,38 @@ namespace SteamClient {
         AvatarUrl avatarUrl;
     };
 
+    // position of a message in a conversation; ordinals order messages that share a timestamp
+    struct HistoryPosition {
+        int64_t timestampNs = 0;
+        uint32_t ordinal = 0;
+
+        auto operator<=>(const HistoryPosition &) const = default;
+    };
+
     struct Message {
-        std::string senderId;
+        SteamId senderId;
         std::string message;
         int64_t timestamp_ns{};
+        uint32_t ordinal{};
+
+        [[nodiscard]] HistoryPosition position() const {
+            return {timestamp_ns, ordinal};
+        }
+    };
+
+    // one page of a paged PollChatMessages call, in chronological order
+    struct MessagePage {
+        bool ok = false;  // false on RPC failure; the other fields are empty then
+        std::vector<Message> messages;
+        std::optional<std::string> nextPageToken;  // set while older messages remain
+    };
+
+    // bounds are exclusive; `pageToken` (from the previous page) replaces `before`
+    struct MessagePageQuery {
+        std::optional<HistoryPosition> after;
+        std::optional<HistoryPosition> before;
+        std::optional<std::string> pageToken;
+        uint32_t pageSize = 100;
     };
 
     enum AuthResponseState {
@@ -56,7 +140,8 @@ namespace SteamClient {
         SEND_UNKNOWN_FAILURE,
         SEND_INVALID_SESSION_KEY,
         SEND_INVALID_TARGET_ID,
-        SEND_INVALID_MESSAGE
+        SEND_INVALID_MESSAGE,
+        SEND_RPC_FAILURE  // transport-level failure, safe to retry with the same idempotency key
     };
 
     struct FriendsList {
@@ -64,9 +149,32 @@ namespace SteamClient {
         std::vector<Buddy> buddies;
     };
 
+    // one channel of a Steam group chat
+    struct ChatRoom {
+        std::string groupId;
+        std::string chatId;
+        std::string name;
+        uint32_t memberCount = 0;
+    };
+
+    struct ChatRoomMember {
+        std::string id;
+        std::string name;
+        PersonaState personaState = OFFLINE;
+    };
+
+    // see ChatRoomEvent in message.proto: a reset carries the whole member list, any other event a delta
+    struct ChatRoomEvent {
+        uint64_t version = 0;
+        bool reset = false;
+        std::vector<ChatRoomMember> joined;
+        std::vector<std::string> left;
+        std::vector<Message> messages;
+    };
+
     struct ActiveMessageSessions {
         struct Session {
-            std::string id;
+            SteamId id;
             int64_t lastMessageTimestampNs;
             int64_t lastViewedTimestampNs;
             int unreadMessageCount;
@@ -104,4 +212,11 @@ namespace SteamClient {
     };
 }
 
+template<>
+struct std::hash<SteamClient::SteamId> {
+    size_t operator()(SteamClient::SteamId id) const noexcept {
+        return std::hash<uint64_t>()(id.value());
+    }
+};
+
 #endif //PIDGIN_STEAM_GRPC_EXP_H
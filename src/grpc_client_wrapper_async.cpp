@@ -1,8 +1,13 @@
 #include "grpc_client_wrapper.h"
 #include "grpc_client_wrapper_async.h"
 #include "coro_utils.h"
+#include "shm_transport.h"
+#include "proto_view.h"
 #include <grpcpp/grpcpp.h>
+#include <grpcpp/generic/generic_stub.h>
+#include <algorithm>
 #include <atomic>
+#include <random>
 #include <thread>
 #include "../protobufs/comm_protobufs/message.pb.h"
 #include "../protobufs/comm_protobufs/message.grpc.pb.h"
@@ -10,29 +15,284 @@
 #include "../protobufs/comm_protobufs/auth.grpc.pb.h"
 #include "cppcoro/sync_wait.hpp"
 #include "cppcoro/io_service.hpp"
+#include "cppcoro/async_manual_reset_event.hpp"
+#include "cppcoro/cancellation_registration.hpp"
+#include "cppcoro/cancellation_source.hpp"
+#include "cppcoro/operation_cancelled.hpp"
+#include "cppcoro/when_all_ready.hpp"
 
 namespace SteamClient {
     struct AsyncClientWrapper::impl {
-        std::shared_ptr<grpc::Channel> channel;
-        std::unique_ptr<steam::AuthService::Stub> authStub;
-        std::unique_ptr<steam::MessageService::Stub> messageStub;
+        struct MethodState {
+            RetryPolicy policy;
+            double tokens;
+            std::array<int64_t, 64> latenciesNs{};  // ring buffer of successful attempt latencies
+            size_t samples = 0;
+
+            explicit MethodState(const RetryPolicy &policy) : policy(policy), tokens(policy.maxTokens) {}
+
+            void on_success(std::chrono::nanoseconds latency) {
+                tokens = std::min(policy.maxTokens, tokens + policy.tokenRatio);
+                latenciesNs[samples++ % latenciesNs.size()] = latency.count();
+            }
+
+            void on_failure() {
+                tokens = std::max(0.0, tokens - 1);
+            }
+
+            [[nodiscard]] bool can_retry() const {
+                return tokens > policy.maxTokens / 2;
+            }
+
+            // p95 of recent latencies, or nothing until there are enough samples to trust it
+            [[nodiscard]] std::optional<std::chrono::nanoseconds> hedge_delay() const {
+                if (samples < 16) {
+                    return std::nullopt;
+                }
+                auto count = std::min(samples, latenciesNs.size());
+                auto sorted = latenciesNs;
+                auto p95 = sorted.begin() + (count * 95 - 1) / 100;
+                std::nth_element(sorted.begin(), p95, sorted.begin() + (long) count);
+                return std::max<std::chrono::nanoseconds>(std::chrono::nanoseconds(*p95), policy.minHedgeDelay);
+            }
+        };
+
+        template<typename R>
+        struct HedgeRace {
+            std::array<grpc::ClientContext, 2> contexts;
+            std::optional<std::pair<grpc::Status, R>> result;
+            bool succeeded = false;
+            bool primaryDone = false;
+            cppcoro::cancellation_source hedgeTimer;
+        };
+
+        struct Endpoint {
+            std::string address;
+            std::shared_ptr<grpc::Channel> channel;
+            std::unique_ptr<steam::AuthService::Stub> authStub;
+            std::unique_ptr<steam::MessageService::Stub> messageStub;
+            std::unique_ptr<grpc::GenericStub> genericStub;  // responses as raw ByteBuffers, see call_raw
+            std::atomic<grpc_connectivity_state> state{GRPC_CHANNEL_IDLE};
+            uint64_t calls = 0;
+            uint64_t failures = 0;
+            uint64_t inFlight = 0;
+            int64_t totalLatencyNs = 0;
+        };
+
+        struct Credentials {
+            std::string username;
+            std::string password;
+            std::optional<std::string> steamGuardCode;
+        };
+
+        // completion queue tags for NotifyOnStateChange are counted down from here, one per endpoint;
+        // tagCounter never gets this far
+        static constexpr size_t connectivity_tag_base = SIZE_MAX;
+        // the watch is re-armed at least this often so that a completion queue shutdown is never blocked on it
+        static constexpr auto connectivity_watch_interval = std::chrono::seconds(5);
+        static constexpr size_t virtual_nodes_per_endpoint = 64;
+
+        std::vector<std::unique_ptr<Endpoint>> endpoints;
+        std::vector<std::pair<uint64_t, size_t>> hashRing;  // (point, endpoint index), sorted by point
+        size_t active = 0;  // endpoint holding this account's proxy session
+        bool assigned = false;  // `active` is only meaningful once the first authenticate() picked it
 
         grpc::CompletionQueue completionQueue;
         std::atomic<size_t> tagCounter{0};
         std::atomic<bool> _shutdown{false};
-        std::map<size_t, TaskCompletionSource<bool>> callbacks;
+        cppcoro::cancellation_source retryCancel;  // see cancelRetries
+        std::map<size_t, AsyncChannel<bool>> callbacks;
 
         SteamClient::AuthResponseState lastAuthResponseState = AUTH_UNKNOWN_FAILURE;
         bool lastSuccessState = false;
         std::optional<std::string> sessionKey;
+        std::optional<std::string> refreshToken;  // sent instead of the password while set
+        bool compactWire = false;  // the proxy agreed to fixed64 SteamIDs and nanosecond timestamps for this session
+
+        // kept so that the session can be re-created on another endpoint after a failover
+        std::optional<Credentials> credentials;
+        bool needsReauthentication = false;
+        bool reauthenticating = false;
+        std::optional<AuthResponseState> sessionLost;  // see AsyncClientWrapper::sessionLost
+        std::vector<cppcoro::async_manual_reset_event *> reauthWaiters;
+
+        std::map<std::string, MethodState> methods;
+
+        static constexpr auto friends_list_ttl = std::chrono::seconds(2);
+        SingleFlight<std::string, FriendsListView> friendsListFlight{friends_list_ttl, [](const FriendsListView &list) {
+            return list.ok();  // failures come back as an empty list
+        }};
+        SingleFlight<std::pair<std::string, std::optional<int64_t>>, ActiveMessageSessions> activeSessionsFlight;
+        cppcoro::io_service *ioService = nullptr;  // set by run_cq; needed for backoff and hedge timers
+
+        std::unique_ptr<ShmEndpoint> shm;  // optional shared-memory path for PollChatMessages
+        uint64_t shmCallCounter = 0;
+        struct ShmCall {
+            AsyncChannel<std::string, 16> frames;
+            std::optional<grpc::Status> aborted;  // deadline, cancellation or a corrupt ring: ends the call
+        };
+        std::map<uint64_t, ShmCall> shmCalls;
+        std::map<grpc::ClientContext *, uint64_t> shmContexts;  // the ClientContext of each shared-memory call
+        std::optional<std::string> shmStalledFrame;  // arrived while its call's channel was full
+
+        std::vector<cppcoro::async_manual_reset_event *> readyWaiters;
+
+        impl(const std::vector<std::string> &addresses, const ChannelOptions &options) {
+            if (addresses.empty()) {
+                throw std::invalid_argument("no proxy endpoints");
+            }
+            auto args = make_channel_arguments(options);
+            for (auto &address: addresses) {
+                auto endpoint = std::make_unique<Endpoint>();
+                endpoint->address = address;
+                endpoint->channel = grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args);
+                endpoint->authStub = steam::AuthService::NewStub(endpoint->channel);
+                endpoint->messageStub = steam::MessageService::NewStub(endpoint->channel);
+                endpoint->genericStub = std::make_unique<grpc::GenericStub>(endpoint->channel);
+                for (size_t i = 0; i < virtual_nodes_per_endpoint; ++i) {
+                    hashRing.emplace_back(fnv1a(address + "#" + std::to_string(i)), endpoints.size());
+                }
+                endpoints.push_back(std::move(endpoint));
+            }
+            std::sort(hashRing.begin(), hashRing.end());
 
-        explicit impl(const std::string &address) {
-            channel = grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
-            authStub = steam::AuthService::NewStub(channel);
-            messageStub = steam::MessageService::NewStub(channel);
+            RetryPolicy reads;
+            reads.maxAttempts = 3;
+            reads.hedge = true;
+            for (auto method: {"GetFriendsList", "GetActiveFriendMessageSessions", "PollChatMessages"}) {
+                methods.emplace(method, reads);
+            }
+            RetryPolicy acks;  // idempotent, but nothing waits on them, so there is no point hedging
+            acks.maxAttempts = 3;
+            for (auto method: {"AckFriendMessage", "AckFriendMessages"}) {
+                methods.emplace(method, acks);
+            }
+            // SendChatMessage keeps the single-attempt default; the plugin's send queue owns retries
+        }
+
+        static grpc::ChannelArguments make_channel_arguments(const ChannelOptions &options) {
+            grpc::ChannelArguments args;
+            if (options.keepaliveTimeMs > 0) {
+                args.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, options.keepaliveTimeMs);
+                args.SetInt(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, options.keepaliveTimeoutMs);
+                args.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+                args.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+            }
+            args.SetMaxReceiveMessageSize(options.maxReceiveMessageSize);
+            if (options.compress) {
+                args.SetCompressionAlgorithm(GRPC_COMPRESS_GZIP);
+            } else {
+                // only advertise identity, so the proxy does not compress responses either
+                args.SetInt(GRPC_COMPRESSION_CHANNEL_ENABLED_ALGORITHMS_BITSET, 1 << GRPC_COMPRESS_NONE);
+            }
+            if (options.http2LookaheadBytes > 0) {
+                args.SetInt(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, options.http2LookaheadBytes);
+                args.SetInt(GRPC_ARG_HTTP2_BDP_PROBE, 0);
+            }
+            return args;
+        }
+
+        static uint64_t fnv1a(std::string_view key) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (unsigned char c: key) {
+                hash = (hash ^ c) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        Endpoint &current() {
+            return *endpoints[active];
+        }
+
+        // endpoints in consistent-hash order for `key`: adding or removing an endpoint only moves the accounts
+        // whose first choice it was
+        [[nodiscard]] std::vector<size_t> preference_order(const std::string &key) const {
+            std::vector<size_t> order;
+            auto start = std::lower_bound(hashRing.begin(), hashRing.end(), std::make_pair(fnv1a(key), size_t{0}));
+            auto offset = (size_t) (start - hashRing.begin());
+            for (size_t i = 0; i < hashRing.size() && order.size() < endpoints.size(); ++i) {
+                auto index = hashRing[(offset + i) % hashRing.size()].second;
+                if (std::find(order.begin(), order.end(), index) == order.end()) {
+                    order.push_back(index);
+                }
+            }
+            return order;
+        }
+
+        static bool is_dead(grpc_connectivity_state state) {
+            return state == GRPC_CHANNEL_TRANSIENT_FAILURE || state == GRPC_CHANNEL_SHUTDOWN;
+        }
+
+        // sticky: the first healthy endpoint in preference order, kept until it fails
+        void assign_endpoint(const std::string &username) {
+            auto order = preference_order(username);
+            active = order.front();
+            for (auto index: order) {
+                if (endpoints[index]->state == GRPC_CHANNEL_READY) {
+                    active = index;
+                    break;
+                }
+            }
+            assigned = true;
+            std::cout << "account " << username << " assigned to proxy " << current().address << std::endl;
+        }
+
+        void try_failover() {
+            if (!assigned || !credentials.has_value() || !is_dead(current().state)) {
+                return;
+            }
+            for (auto index: preference_order(credentials->username)) {
+                if (index != active && endpoints[index]->state == GRPC_CHANNEL_READY) {
+                    std::cout << "proxy " << current().address << " is down, failing over to "
+                              << endpoints[index]->address << std::endl;
+                    active = index;
+                    needsReauthentication = true;
+                    return;
+                }
+            }
+        }
+
+        // re-creates the proxy session after a failover; concurrent callers wait for the first one
+        PooledTask<void> ensure_session() {
+            if (!needsReauthentication || !credentials.has_value()) {
+                co_return;
+            }
+            if (reauthenticating) {
+                cppcoro::async_manual_reset_event done;
+                reauthWaiters.push_back(&done);
+                co_await done;
+                co_return;
+            }
+            reauthenticating = true;
+            std::cout << "re-authenticating " << credentials->username << " on " << current().address << std::endl;
+            // the stale key means nothing to the new endpoint, but it stays set until the new one arrives: callers
+            // check isSessionKeySet() before calling in, and every call waits here for the new key anyway
+            auto staleSessionKey = sessionKey;
+            auto credentialsCopy = credentials.value();
+            auto state = co_await authenticate(credentialsCopy.username, credentialsCopy.password,
+                                               credentialsCopy.steamGuardCode);
+            needsReauthentication = state == AUTH_UNKNOWN_FAILURE;  // transient; try again on the next call
+            if (state != AUTH_SUCCESS && state != AUTH_UNKNOWN_FAILURE) {
+                std::cout << "re-authentication failed for good (" << state << ")" << std::endl;
+                sessionLost = state;
+            }
+            if (!sessionKey.has_value()) {
+                sessionKey = staleSessionKey;  // calls fail at the proxy rather than throwing in _check_session_key
+            }
+            reauthenticating = false;
+            auto waiters = std::move(reauthWaiters);
+            reauthWaiters.clear();
+            for (auto *waiter: waiters) {
+                waiter->set();
+            }
+        }
+
+        void cancelRetries() {
+            retryCancel.request_cancellation();
         }
 
         void shutdown() {
+            retryCancel.request_cancellation();
             _shutdown = true;
             completionQueue.Shutdown();  // TODO: how to ensure no additional gRPC events are enqueued?
         }
@@ -41,37 +301,356 @@ namespace SteamClient {
 
         cppcoro::task<void> run_cq(cppcoro::io_service &ioService) {
             std::cout << "starting completion queue" << std::endl;
+            this->ioService = &ioService;
+            for (size_t i = 0; i < endpoints.size(); ++i) {
+                watch_connectivity(i);
+            }
             void *tag;
             bool ok;
             while (true) {
+                bool pumped = shm && pump_shm();
                 auto status = completionQueue.AsyncNext(&tag, &ok, gpr_time_0(GPR_CLOCK_REALTIME));
                 if (status == grpc::CompletionQueue::SHUTDOWN) {
                     break;
                 }
                 if (status == grpc::CompletionQueue::TIMEOUT) {
+                    if (pumped) {
+                        continue;
+                    }
+                    if (shm && !shmCalls.empty()) {
+                        // a shared-memory call is waiting: look at the ring again sooner than the 50 ms timer, but
+                        // never block the io_service thread (Pidgin's main loop in the plugin) waiting for it
+                        co_await ioService.schedule_after(std::chrono::milliseconds(1));
+                        continue;
+                    }
                     co_await ioService.schedule_after(std::chrono::milliseconds(50));
                     continue;
                 }
                 // std::cout << "got completion queue event #" << tag << " => " << (ok ? "ok" : "not ok") << std::endl;
+                if (auto tagValue = reinterpret_cast<size_t>(tag);
+                        tagValue > connectivity_tag_base - endpoints.size()) {
+                    if (!_shutdown) {
+                        watch_connectivity(connectivity_tag_base - tagValue);  // changed (ok) or timed out (!ok)
+                    }
+                    continue;
+                }
                 auto &token = callbacks.at(reinterpret_cast<size_t>(tag));
-                co_await token.sequenced_set_result(ok);
+                if (!token.post(ok)) {
+                    std::cout << "dropped completion queue event #" << tag << ": channel full" << std::endl;
+                }
             }
             std::cout << "stopping completion queue" << std::endl;
+            this->ioService = nullptr;
             co_return;
         }
 
+        // dispatches frames from the shared-memory ring to their calls; true if any were delivered
+        bool pump_shm() {
+            bool delivered = false;
+            std::string frame;
+            while (true) {
+                if (shmStalledFrame.has_value()) {
+                    frame = std::move(shmStalledFrame.value());
+                    shmStalledFrame.reset();
+                } else if (!shm->try_receive(frame)) {
+                    break;
+                }
+                ShmFrameHeader header{};
+                std::string_view payload;
+                if (!decode_shm_frame(frame, header, payload)) {
+                    std::cout << "dropped malformed shared-memory frame" << std::endl;
+                    continue;
+                }
+                auto it = shmCalls.find(header.callId);
+                if (it == shmCalls.end()) {
+                    continue;  // call already abandoned
+                }
+                if (it->second.frames.full()) {
+                    shmStalledFrame = std::move(frame);
+                    break;
+                }
+                it->second.frames.post(std::move(frame));  // may resume the caller inline
+                delivered = true;
+            }
+            if (shm->broken()) {
+                // the peer wrote something it cannot have meant: fail what is in flight (retryable, so the retries
+                // go over gRPC) and stop using the ring
+                std::cout << "shared-memory ring corrupt, falling back to gRPC" << std::endl;
+                shm.reset();
+                shmStalledFrame.reset();
+                std::vector<uint64_t> callIds;
+                for (auto &[callId, call]: shmCalls) {
+                    callIds.push_back(callId);
+                }
+                for (auto callId: callIds) {
+                    abort_shm_call(callId, grpc::Status(grpc::StatusCode::UNAVAILABLE, "shared-memory ring corrupt"));
+                }
+            }
+            return delivered;
+        }
+
+        // doubles as the endpoint health check: every endpoint is kept connected and watched, so a failover
+        // target is known to be up before it is used
+        void watch_connectivity(size_t index) {
+            auto &endpoint = *endpoints[index];
+            auto state = endpoint.channel->GetState(true);  // also kicks an IDLE channel into reconnecting
+            update_connectivity(index, state);
+            endpoint.channel->NotifyOnStateChange(state,
+                                                  std::chrono::system_clock::now() + connectivity_watch_interval,
+                                                  &completionQueue,
+                                                  reinterpret_cast<void *>(connectivity_tag_base - index));
+        }
+
+        void update_connectivity(size_t index, grpc_connectivity_state state) {
+            auto &endpoint = *endpoints[index];
+            auto previous = endpoint.state.exchange(state);
+            if (previous == state) {
+                return;
+            }
+            std::cout << "channel " << endpoint.address << " state " << previous << " -> " << state << std::endl;
+            try_failover();
+            if (is_connected()) {
+                auto waiters = std::move(readyWaiters);
+                readyWaiters.clear();
+                for (auto *waiter: waiters) {
+                    waiter->set();
+                }
+            }
+        }
+
+        [[nodiscard]] bool is_connected() const {
+            if (assigned) {
+                return endpoints[active]->state == GRPC_CHANNEL_READY;
+            }
+            return std::any_of(endpoints.begin(), endpoints.end(), [](const auto &endpoint) {
+                return endpoint->state == GRPC_CHANNEL_READY;
+            });
+        }
+
+        // Must be awaited on the thread that drives the completion queue (waiters are not locked).
+        PooledTask<bool> waitForConnected(cppcoro::cancellation_token token) {
+            if (is_connected()) {
+                co_return true;
+            }
+            cppcoro::async_manual_reset_event wake;
+            readyWaiters.push_back(&wake);
+            {
+                cppcoro::cancellation_registration registration(std::move(token), [&wake] { wake.set(); });
+                co_await wake;
+            }
+            std::erase(readyWaiters, &wake);
+            co_return is_connected();
+        }
+
         template<typename Rpc, typename Response>
-        cppcoro::task<bool> run_call(Rpc &rpc, Response &response, grpc::Status &status) {
+        PooledTask<bool> run_call(Rpc &rpc, Response &response, grpc::Status &status) {
             auto tag = tagCounter++;
             auto &token = callbacks.emplace(std::piecewise_construct, std::forward_as_tuple(tag),
                                             std::forward_as_tuple()).first->second;
             rpc->Finish(&response, &status, reinterpret_cast<void *>(tag));
-            bool ok = co_await token.get_task();
+            bool ok = co_await token.receive();
             callbacks.erase(tag);
             co_return ok;
         }
 
-        cppcoro::task<std::tuple<AuthResponseState, std::string>>
+        MethodState &method_state(const std::string &method) {
+            auto it = methods.find(method);
+            if (it == methods.end()) {
+                it = methods.emplace(method, RetryPolicy{}).first;
+            }
+            return it->second;
+        }
+
+        static bool is_retryable(grpc::StatusCode code) {
+            switch (code) {
+                case grpc::StatusCode::UNAVAILABLE:
+                case grpc::StatusCode::DEADLINE_EXCEEDED:
+                case grpc::StatusCode::RESOURCE_EXHAUSTED:
+                case grpc::StatusCode::ABORTED:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        static std::chrono::nanoseconds jittered(std::chrono::duration<double, std::milli> backoff, double jitter) {
+            thread_local std::mt19937 rng{std::random_device{}()};
+            std::uniform_real_distribution<double> factor(1 - jitter, 1 + jitter);
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(backoff * factor(rng));
+        }
+
+        static void set_attempt_deadline(grpc::ClientContext &context, const RetryPolicy &policy) {
+            context.set_deadline(std::chrono::system_clock::now() + policy.attemptTimeout);
+        }
+
+        // TryCancel, which gRPC only applies to its own calls, extended to shared-memory calls
+        void cancel_attempt(grpc::ClientContext &context) {
+            context.TryCancel();
+            if (auto it = shmContexts.find(&context); it != shmContexts.end()) {
+                abort_shm_call(it->second, grpc::Status(grpc::StatusCode::CANCELLED, "shared-memory call cancelled"));
+            }
+        }
+
+        void abort_shm_call(uint64_t callId, grpc::Status status) {
+            auto it = shmCalls.find(callId);
+            if (it == shmCalls.end() || it->second.aborted.has_value()) {
+                return;
+            }
+            it->second.aborted = std::move(status);
+            // wakes the caller (inline); when the channel is full it is not waiting and sees `aborted` next
+            it->second.frames.post({});
+        }
+
+        template<typename R, typename Attempt>
+        PooledTask<void> hedge_leg(HedgeRace<R> &race, size_t index, const RetryPolicy &policy, Attempt &attempt) {
+            set_attempt_deadline(race.contexts[index], policy);
+            auto result = co_await attempt(race.contexts[index]);
+            if (index == 0) {
+                race.primaryDone = true;
+                race.hedgeTimer.request_cancellation();
+            }
+            if (race.succeeded) {
+                co_return;  // lost the race
+            }
+            if (result.first.ok()) {
+                race.succeeded = true;
+                cancel_attempt(race.contexts[1 - index]);
+                race.result = std::move(result);
+            } else if (!race.result.has_value()) {
+                race.result = std::move(result);
+            }
+        }
+
+        template<typename R, typename Attempt>
+        PooledTask<void> hedge_timer(HedgeRace<R> &race, std::chrono::nanoseconds delay, const RetryPolicy &policy,
+                                     Attempt &attempt) {
+            try {
+                co_await ioService->schedule_after(delay, race.hedgeTimer.token());
+            } catch (const cppcoro::operation_cancelled &) {
+                co_return;
+            }
+            if (race.primaryDone) {
+                co_return;
+            }
+            co_await hedge_leg(race, 1, policy, attempt);
+        }
+
+        template<typename R, typename Attempt>
+        PooledTask<std::pair<grpc::Status, R>> single_attempt(const RetryPolicy &policy, Attempt &attempt) {
+            grpc::ClientContext context;
+            set_attempt_deadline(context, policy);
+            co_return co_await attempt(context);
+        }
+
+        template<typename R, typename Attempt>
+        PooledTask<std::pair<grpc::Status, R>> hedged_attempt(const MethodState &state, Attempt &attempt) {
+            auto delay = state.hedge_delay();
+            if (!delay.has_value() || ioService == nullptr) {
+                co_return co_await single_attempt<R>(state.policy, attempt);
+            }
+            HedgeRace<R> race;
+            co_await cppcoro::when_all_ready(hedge_leg(race, 0, state.policy, attempt),
+                                             hedge_timer(race, delay.value(), state.policy, attempt));
+            co_return std::move(race.result.value());
+        }
+
+        /*
+         * Runs `attempt(context)` under the retry policy registered for `method`. Each attempt gets a fresh
+         * ClientContext with its own deadline; the attempt returns the final status together with its result.
+         */
+        template<typename R, typename Attempt>
+        PooledTask<std::pair<grpc::Status, R>> call_with_policy(const std::string &method, Attempt attempt) {
+            auto &state = method_state(method);
+            std::chrono::duration<double, std::milli> backoff = state.policy.initialBackoff;
+            for (int attemptNo = 1;; ++attemptNo) {
+                auto &endpoint = current();
+                ++endpoint.inFlight;
+                auto start = std::chrono::steady_clock::now();
+                auto result = state.policy.hedge ? co_await hedged_attempt<R>(state, attempt)
+                                                 : co_await single_attempt<R>(state.policy, attempt);
+                --endpoint.inFlight;
+                ++endpoint.calls;
+                endpoint.totalLatencyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                if (!result.first.ok()) {
+                    ++endpoint.failures;
+                }
+                if (result.first.ok()) {
+                    state.on_success(std::chrono::steady_clock::now() - start);
+                    co_return std::move(result);
+                }
+                state.on_failure();
+                // while the channel is down, fail fast and leave it to callers to wait for reconnection
+                if (attemptNo >= state.policy.maxAttempts || !is_retryable(result.first.error_code()) ||
+                    !state.can_retry() || !is_connected() || _shutdown || ioService == nullptr ||
+                    retryCancel.is_cancellation_requested()) {
+                    co_return std::move(result);
+                }
+                auto delay = jittered(backoff, state.policy.jitter);
+                std::cout << method << " attempt " << attemptNo << " failed (" << result.first.error_code()
+                          << "), retrying in " << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count()
+                          << " ms" << std::endl;
+                bool cancelled = false;
+                try {
+                    co_await ioService->schedule_after(delay, retryCancel.token());
+                } catch (const cppcoro::operation_cancelled &) {
+                    cancelled = true;
+                }
+                if (cancelled) {
+                    co_return std::move(result);
+                }
+                backoff = std::min<std::chrono::duration<double, std::milli>>(backoff * state.policy.backoffMultiplier,
+                                                                              state.policy.maxBackoff);
+            }
+        }
+
+        template<typename Response, typename Start>
+        PooledTask<std::pair<grpc::Status, Response>> unary_attempt(grpc::ClientContext &context, Start start) {
+            Response response;
+            grpc::Status status;
+            auto rpc = start(&context);
+            if (!co_await run_call(rpc, response, status) && status.ok()) {
+                status = grpc::Status(grpc::StatusCode::UNAVAILABLE, "completion queue failure");
+            }
+            co_return std::make_pair(std::move(status), std::move(response));
+        }
+
+        // `start(context)` issues the async call; it is invoked once per attempt
+        template<typename Response, typename Start>
+        PooledTask<std::pair<grpc::Status, Response>> call_unary(const std::string &method, Start start) {
+            return call_with_policy<Response>(method, [this, start](grpc::ClientContext &context) {
+                return unary_attempt<Response>(context, start);
+            });
+        }
+
+        /*
+         * A MessageService unary call through the generic stub: the response is left encoded, in the slices gRPC
+         * received it in, for lazy decoding (see proto_view.h). Retries and hedging are as for call_unary.
+         */
+        template<typename Request>
+        PooledTask<std::pair<grpc::Status, grpc::ByteBuffer>> call_raw(const std::string &method,
+                                                                        const Request &request) {
+            grpc::Slice slice(request.SerializeAsString());
+            grpc::ByteBuffer requestBuffer(&slice, 1);
+            auto path = "/steam.MessageService/" + method;
+            return call_unary<grpc::ByteBuffer>(method, [this, path, requestBuffer](grpc::ClientContext *context) {
+                auto rpc = current().genericStub->PrepareUnaryCall(context, path, requestBuffer, &completionQueue);
+                rpc->StartCall();
+                return rpc;
+            });
+        }
+
+        // the response as one contiguous buffer, owned by the returned pointer; copied only if it arrived in pieces
+        static std::pair<std::shared_ptr<const void>, std::string_view> flatten(grpc::ByteBuffer &buffer) {
+            auto slice = std::make_shared<grpc::Slice>();
+            if (!buffer.TrySingleSlice(slice.get()).ok() && !buffer.DumpToSingleSlice(slice.get()).ok()) {
+                return {nullptr, {}};
+            }
+            std::string_view data(reinterpret_cast<const char *>(slice->begin()), slice->size());
+            return {std::move(slice), data};
+        }
+
+        PooledTask<std::tuple<AuthResponseState, std::string>>
         _authenticate(const std::string &username, const std::string &password,
                       const std::optional<std::string> &steamGuardCode) {
             steam::AuthRequest request;
@@ -83,16 +662,24 @@ namespace SteamClient {
             if (sessionKey.has_value()) {
                 request.set_sessionkey(sessionKey.value());
             }
+            if (refreshToken.has_value()) {
+                request.set_refreshtoken(refreshToken.value());
+            }
+            request.set_compactwire(true);
 
             grpc::ClientContext context;
             steam::AuthResponse response;
-            auto rpc = authStub->AsyncAuthenticate(&context, request, &completionQueue);
+            auto rpc = current().authStub->AsyncAuthenticate(&context, request, &completionQueue);
             if (grpc::Status status; !co_await run_call(rpc, response, status) || !status.ok()) {
                 std::cout << "Auth failed (gRPC failure)" << std::endl;
                 std::cout << status.error_code() << ": " << status.error_message() << std::endl;
                 co_return std::make_tuple(AUTH_UNKNOWN_FAILURE, "");
             }
 
+            if (response.has_refreshtoken() && !response.refreshtoken().empty()) {
+                refreshToken = response.refreshtoken();
+            }
+            compactWire = response.compactwire();  // false from proxies that predate it
             switch (response.reason()) {
                 case steam::AuthResponse_AuthState_SUCCESS:
                     std::cout << "Auth successful" << std::endl;
@@ -100,6 +687,9 @@ namespace SteamClient {
                     co_return std::make_tuple(AUTH_SUCCESS, response.sessionkey());
                 case steam::AuthResponse_AuthState_INVALID_CREDENTIALS:
                     std::cout << "Auth failed (invalid credentials)" << std::endl;
+                    if (request.has_refreshtoken()) {
+                        refreshToken = std::nullopt;  // expired or revoked; the next attempt uses the password
+                    }
                     co_return std::make_tuple(AUTH_INVALID_CREDENTIALS, response.sessionkey());
                 case steam::AuthResponse_AuthState_STEAM_GUARD_CODE_REQUEST:
                     std::cout << "Auth failed (pending Steam Guard code)" << std::endl;
@@ -110,9 +700,14 @@ namespace SteamClient {
             }
         }
 
-        cppcoro::task<AuthResponseState>
+        PooledTask<AuthResponseState>
         authenticate(const std::string &username, const std::string &password,
                      const std::optional<std::string> &steamGuardCode) {
+            if (!assigned) {
+                assign_endpoint(username);
+            }
+            credentials = Credentials{username, password, steamGuardCode};
+            sessionLost = std::nullopt;
             auto [state, newSessionKey] = co_await _authenticate(username, password, steamGuardCode);
             this->lastAuthResponseState = state;
             switch (state) {
@@ -136,27 +731,74 @@ namespace SteamClient {
             co_return state;
         }
 
-        cppcoro::task<FriendsList> getFriendsList() {
+        // concurrent callers with the same session share one RPC; a successful list is reused for a moment
+        PooledTask<FriendsListView> getFriendsListView() {
+            co_await ensure_session();
+            co_return co_await friendsListFlight.run(sessionKey.value_or(""), [this]() {
+                return fetch_friends_list();
+            });
+        }
+
+        PooledTask<FriendsList> getFriendsList() {
+            co_return (co_await getFriendsListView()).to_friends_list();
+        }
+
+        PooledTask<FriendsListView> fetch_friends_list() {
             steam::FriendsListRequest request;
-            request.set_sessionkey(sessionKey.value());
+            request.set_sessionkey(sessionKey.value_or(""));
 
-            steam::FriendsListResponse response;
-            grpc::ClientContext context;
-            auto rpc = messageStub->AsyncGetFriendsList(&context, request, &completionQueue);
-            if (grpc::Status status; !co_await run_call(rpc, response, status) || !status.ok()) {
+            auto [status, response] = co_await call_raw("GetFriendsList", request);
+            if (!status.ok()) {
                 std::cout << "GetFriendsList failed (gRPC failure)" << std::endl;
                 std::cout << status.error_code() << ": " << status.error_message() << std::endl;
-                co_return FriendsList{std::nullopt, {}};
+                co_return FriendsListView();
+            }
+            auto [owner, data] = flatten(response);
+            FriendsListView list(std::move(owner), data);
+            if (!list.ok()) {
+                std::cout << "GetFriendsList failed (malformed response)" << std::endl;
+                co_return FriendsListView();
             }
             std::cout << "GetFriends successful" << std::endl;
-            std::cout << "Friends: " << response.friends_size() << std::endl;
-            std::vector<Buddy> friends;
-            for (auto &x: response.friends()) {
-                friends.emplace_back(x.name(), x.id(), (PersonaState) (int) x.personastate());
+            std::cout << "Friends: " << list.friends().size() << std::endl;
+            co_return list;
+        }
+
+        // moves the strings out of `persona`
+        static Buddy to_buddy(steam::Persona &persona) {
+            auto &avatarUrl = *persona.mutable_avatarurl();
+            return {
+                    std::move(*persona.mutable_name()),
+                    persona.steamid() != 0 ? SteamId(persona.steamid()) : SteamId::parse(persona.id()),
+                    (PersonaState) (int) persona.personastate(),
+                    persona.has_gameid() ? std::optional<int>(persona.gameid()) : std::nullopt,
+                    std::move(*persona.mutable_gameextrainfo()),
+                    {std::move(*avatarUrl.mutable_icon()), std::move(*avatarUrl.mutable_medium()),
+                     std::move(*avatarUrl.mutable_full())}
+            };
+        }
+
+        PooledTask<std::optional<std::vector<Buddy>>> searchUsers(const std::string &query, uint32_t limit) {
+            co_await ensure_session();
+            steam::SearchUsersRequest request;
+            request.set_sessionkey(sessionKey.value_or(""));
+            request.set_query(query);
+            request.set_limit(limit);
+            auto [status, response] = co_await call_unary<steam::SearchUsersResponse>(
+                    "SearchUsers", [&](grpc::ClientContext *context) {
+                        return current().messageStub->AsyncSearchUsers(context, request, &completionQueue);
+                    });
+            if (!status.ok()) {
+                std::cout << "SearchUsers failed (gRPC failure)" << std::endl;
+                std::cout << status.error_code() << ": " << status.error_message() << std::endl;
+                co_return std::nullopt;
+            }
+            std::vector<Buddy> users;
+            users.reserve(response.users_size());
+            for (auto &user: *response.mutable_users()) {
+                users.push_back(to_buddy(user));
             }
-            auto me = response.user();
-            co_return FriendsList{std::optional<Buddy>({me.name(), me.id(), (PersonaState) (int) me.personastate()}),
-                                  friends};
+            co_return users;
         }
 
         static google::protobuf::Timestamp *
@@ -176,121 +818,410 @@ namespace SteamClient {
             return timestamp.seconds() * 1000000000LL + timestamp.nanos();
         }
 
-        // TODO: handle streaming responses in completion queue thread
-        cppcoro::task<std::vector<Message>>
-        getMessages(const std::string &id, std::optional<int64_t> startTimestampNs = std::nullopt,
-                    std::optional<int64_t> lastTimestampNs = std::nullopt) {
-            steam::PollRequest request;
-            request.set_sessionkey(sessionKey.value());
-            request.set_targetid(id);
-            if (startTimestampNs.has_value()) {
-                request.set_allocated_starttimestamp(make_timestamp_protobuf(startTimestampNs.value()));
-            }
-            if (lastTimestampNs.has_value()) {
-                request.set_allocated_lasttimestamp(make_timestamp_protobuf(lastTimestampNs.value()));
+        // targets a request at a SteamID in the form negotiated for this session
+        template<typename Request>
+        void set_target(Request &request, const std::string &id) const {
+            if (compactWire) {
+                request.set_target(SteamId::parse(id).value());
+            } else {
+                request.set_targetid(id);
             }
-            grpc::ClientContext context;
+        }
+
+        // responses are decoded from whichever form they carry: a compact SteamID is never 0, and compact messages
+        // leave the Timestamps unset. The body is moved out of `response`: the one copy of it is protobuf's, out of
+        // the received buffer, and from here it is only moved on to the render queues.
+        static Message to_message(steam::ResponseMessage &response) {
+            return {response.sender() != 0 ? SteamId(response.sender()) : SteamId::parse(response.senderid()),
+                    std::move(*response.mutable_message()),
+                    response.has_timestamp() ? to_timestamp_ns(response.timestamp()) : response.timestampns(),
+                    response.ordinal()};
+        }
+
+        PooledTask<std::pair<grpc::Status, MessagePage>>
+        poll_attempt(const steam::PollRequest &request, grpc::ClientContext &context) {
             grpc::Status status;
             auto tag = tagCounter++;
-            auto stream = messageStub->AsyncPollChatMessages(&context, request, &completionQueue,
-                                                             reinterpret_cast<void *>(tag));
             auto &token = callbacks.emplace(std::piecewise_construct, std::forward_as_tuple(tag),
                                             std::forward_as_tuple()).first->second;
-            std::vector<Message> messages;
-            if (co_await token.get_task()) {  // StartCall response
+            auto stream = current().messageStub->AsyncPollChatMessages(&context, request, &completionQueue,
+                                                             reinterpret_cast<void *>(tag));
+            MessagePage page;
+            if (co_await token.receive()) {  // StartCall response
                 while (true) {
                     steam::ResponseMessage response;
                     stream->Read(&response, reinterpret_cast<void *>(tag));
-                    if (!co_await token.get_task()) {
+                    if (!co_await token.receive()) {
                         break;
                     }
 
-                    Message message;
-                    message.senderId = response.senderid();  // TODO: send persona info for mapping
-                    message.message = response.message();
-                    message.timestamp_ns = to_timestamp_ns(response.timestamp());
+                    auto message = to_message(response);  // TODO: send persona info for mapping
                     std::cout << "message: " << message.senderId << " " << message.message << " "
                               << message.timestamp_ns << std::endl;
-                    messages.push_back(message);
+                    page.messages.push_back(std::move(message));
+                    if (response.has_nextpagetoken()) {
+                        page.nextPageToken = std::move(*response.mutable_nextpagetoken());
+                    }
                 }
-            } else {
-                stream->Finish(&status, reinterpret_cast<void *>(tag));
             }
-            // TODO: check exception handling
+            // the status decides whether a partial stream is kept or retried
+            stream->Finish(&status, reinterpret_cast<void *>(tag));
+            co_await token.receive();
             callbacks.erase(tag);
-            co_return messages;
+            page.ok = status.ok();
+            co_return std::make_pair(std::move(status), std::move(page));
+        }
+
+        /*
+         * PollChatMessages over the shared-memory ring. The peer gets no say in how long this takes: the call ends
+         * with DEADLINE_EXCEEDED at the context's deadline and with CANCELLED on cancel_attempt, like a gRPC call.
+         */
+        PooledTask<std::pair<grpc::Status, MessagePage>>
+        shm_poll_attempt(const steam::PollRequest &request, grpc::ClientContext &context) {
+            auto callId = ++shmCallCounter;
+            auto &call = shmCalls.emplace(std::piecewise_construct, std::forward_as_tuple(callId),
+                                          std::forward_as_tuple()).first->second;
+            if (!shm->try_send(encode_shm_frame(
+                    {callId, (uint16_t) ShmMethod::POLL_CHAT_MESSAGES, 0, 0}, &request))) {
+                shmCalls.erase(callId);
+                co_return std::make_pair(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "shared-memory ring full"),
+                                         MessagePage{});
+            }
+            shmContexts[&context] = callId;
+            std::pair<grpc::Status, MessagePage> result;
+            cppcoro::cancellation_source deadlineCancel;
+            co_await cppcoro::when_all_ready(shm_read_page(call, result, deadlineCancel),
+                                             shm_deadline(callId, context.deadline(), deadlineCancel.token()));
+            shmContexts.erase(&context);
+            shmCalls.erase(callId);
+            result.second.ok = result.first.ok();
+            co_return std::move(result);
+        }
+
+        PooledTask<void> shm_read_page(ShmCall &call, std::pair<grpc::Status, MessagePage> &result,
+                                       cppcoro::cancellation_source &deadlineCancel) {
+            auto &[status, page] = result;
+            while (true) {
+                auto frame = co_await call.frames.receive();
+                if (call.aborted.has_value()) {
+                    status = call.aborted.value();
+                    page = {};
+                    break;
+                }
+                ShmFrameHeader header{};
+                std::string_view payload;
+                decode_shm_frame(frame, header, payload);
+                if (header.flags & SHM_ERROR) {
+                    status = grpc::Status(grpc::StatusCode::INTERNAL, std::string(payload));
+                    break;
+                }
+                if (header.flags & SHM_END_OF_STREAM) {
+                    break;
+                }
+                steam::ResponseMessage response;
+                if (!response.ParseFromArray(payload.data(), (int) payload.size())) {
+                    status = grpc::Status(grpc::StatusCode::INTERNAL, "malformed shared-memory response");
+                    break;
+                }
+                page.messages.push_back(to_message(response));
+                if (response.has_nextpagetoken()) {
+                    page.nextPageToken = std::move(*response.mutable_nextpagetoken());
+                }
+            }
+            deadlineCancel.request_cancellation();
+        }
+
+        PooledTask<void> shm_deadline(uint64_t callId, std::chrono::system_clock::time_point deadline,
+                                      cppcoro::cancellation_token token) {
+            if (ioService == nullptr || deadline == std::chrono::system_clock::time_point::max()) {
+                co_return;  // no deadline, or no timers: only cancellation ends the call early
+            }
+            try {
+                co_await ioService->schedule_after(deadline - std::chrono::system_clock::now(), std::move(token));
+            } catch (const cppcoro::operation_cancelled &) {
+                co_return;
+            }
+            abort_shm_call(callId, grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, "shared-memory call timed out"));
+        }
+
+        PooledTask<std::vector<Message>>
+        getMessages(const std::string &id, std::optional<int64_t> startTimestampNs = std::nullopt,
+                    std::optional<int64_t> lastTimestampNs = std::nullopt) {
+            co_await ensure_session();
+            steam::PollRequest request;
+            request.set_sessionkey(sessionKey.value_or(""));
+            set_target(request, id);
+            if (startTimestampNs.has_value()) {
+                set_start_timestamp(request, startTimestampNs.value());
+            }
+            if (lastTimestampNs.has_value()) {
+                set_last_timestamp(request, lastTimestampNs.value());
+            }
+            auto page = co_await poll(request);
+            co_return std::move(page.messages);
+        }
+
+        PooledTask<MessagePage> getMessagePage(const std::string &id, const MessagePageQuery &query) {
+            co_await ensure_session();
+            steam::PollRequest request;
+            request.set_sessionkey(sessionKey.value_or(""));
+            set_target(request, id);
+            request.set_pagesize(query.pageSize);
+            if (query.after.has_value()) {
+                set_start_timestamp(request, query.after->timestampNs);
+                request.set_startordinal(query.after->ordinal);
+            }
+            if (query.pageToken.has_value()) {
+                request.set_pagetoken(query.pageToken.value());
+            } else if (query.before.has_value()) {
+                set_last_timestamp(request, query.before->timestampNs);
+                request.set_lastordinal(query.before->ordinal);
+            }
+            co_return co_await poll(request);
+        }
+
+        void set_start_timestamp(steam::PollRequest &request, int64_t timestampNs) const {
+            if (compactWire) {
+                request.set_starttimestampns(timestampNs);
+            } else {
+                request.set_allocated_starttimestamp(make_timestamp_protobuf(timestampNs));
+            }
+        }
+
+        void set_last_timestamp(steam::PollRequest &request, int64_t timestampNs) const {
+            if (compactWire) {
+                request.set_lasttimestampns(timestampNs);
+            } else {
+                request.set_allocated_lasttimestamp(make_timestamp_protobuf(timestampNs));
+            }
+        }
+
+        PooledTask<MessagePage> poll(const steam::PollRequest &request) {
+            auto [status, page] = co_await call_with_policy<MessagePage>(
+                    "PollChatMessages", [&](grpc::ClientContext &context) {
+                        return shm ? shm_poll_attempt(request, context) : poll_attempt(request, context);
+                    });
+            if (!status.ok()) {
+                std::cout << "PollChatMessages failed (gRPC failure)" << std::endl;
+                std::cout << status.error_code() << ": " << status.error_message() << std::endl;
+                co_return MessagePage{};
+            }
+            co_return std::move(page);
         }
 
-        cppcoro::task<SendMessageCode> sendMessage(const std::string &id, const std::string &message) {
+        PooledTask<SendMessageCode> sendMessage(const std::string &id, const std::string &message,
+                                                const std::optional<std::string> &idempotencyKey,
+                                                const std::optional<std::string> &afterKey) {
+            co_await ensure_session();
             steam::MessageRequest request;
-            request.set_sessionkey(sessionKey.value());
-            request.set_targetid(id);
+            request.set_sessionkey(sessionKey.value_or(""));
+            set_target(request, id);
             request.set_message(message);
-            grpc::ClientContext context;
-            steam::SendMessageResult response;
-            auto rpc = messageStub->AsyncSendChatMessage(&context, request, &completionQueue);
-            if (grpc::Status status; !co_await run_call(rpc, response, status) || !status.ok()) {
-                std::cout << "SendMessage failed (gRPC failure)" << std::endl;
+            if (idempotencyKey.has_value()) {
+                request.set_idempotencykey(idempotencyKey.value());
+            }
+            if (afterKey.has_value()) {
+                request.set_afterkey(afterKey.value());
+            }
+            auto [status, response] = co_await call_unary<steam::SendMessageResult>(
+                    "SendChatMessage", [&](grpc::ClientContext *context) {
+                        return current().messageStub->AsyncSendChatMessage(context, request, &completionQueue);
+                    });
+            co_return send_result_code("SendMessage", status, response);
+        }
+
+        static SendMessageCode
+        send_result_code(const char *method, const grpc::Status &status, const steam::SendMessageResult &response) {
+            if (!status.ok()) {
+                std::cout << method << " failed (gRPC failure)" << std::endl;
                 std::cout << status.error_code() << ": " << status.error_message() << std::endl;
-                co_return SEND_UNKNOWN_FAILURE;
+                return SEND_RPC_FAILURE;
             }
             switch (response.reason()) {
                 case steam::SendMessageResult_SendMessageResultCode_SUCCESS:
-                    std::cout << "SendMessage successful" << std::endl;
-                    co_return SEND_SUCCESS;
+                    std::cout << method << " successful" << std::endl;
+                    return SEND_SUCCESS;
                 case steam::SendMessageResult_SendMessageResultCode_INVALID_SESSION_KEY:
-                    std::cout << "SendMessage failed (invalid session key)" << std::endl;
-                    co_return SEND_INVALID_SESSION_KEY;
+                    std::cout << method << " failed (invalid session key)" << std::endl;
+                    return SEND_INVALID_SESSION_KEY;
                 case steam::SendMessageResult_SendMessageResultCode_INVALID_TARGET_ID:
-                    std::cout << "SendMessage failed (invalid target ID)" << std::endl;
-                    co_return SEND_INVALID_TARGET_ID;
+                    std::cout << method << " failed (invalid target ID)" << std::endl;
+                    return SEND_INVALID_TARGET_ID;
                 case steam::SendMessageResult_SendMessageResultCode_INVALID_MESSAGE:
-                    std::cout << "SendMessage failed (invalid message)" << std::endl;
-                    co_return SEND_INVALID_MESSAGE;
+                    std::cout << method << " failed (invalid message)" << std::endl;
+                    return SEND_INVALID_MESSAGE;
                 default:
-                    std::cout << "SendMessage failed (unknown failure)" << std::endl;
-                    co_return SEND_UNKNOWN_FAILURE;
+                    std::cout << method << " failed (unknown failure)" << std::endl;
+                    return SEND_UNKNOWN_FAILURE;
+            }
+        }
+
+        PooledTask<SendMessageCode> sendChatRoomMessage(const std::string &groupId, const std::string &chatId,
+                                                        const std::string &message,
+                                                        const std::optional<std::string> &idempotencyKey) {
+            co_await ensure_session();
+            steam::ChatRoomMessageRequest request;
+            request.set_sessionkey(sessionKey.value_or(""));
+            request.set_groupid(groupId);
+            request.set_chatid(chatId);
+            request.set_message(message);
+            if (idempotencyKey.has_value()) {
+                request.set_idempotencykey(idempotencyKey.value());
+            }
+            auto [status, response] = co_await call_unary<steam::SendMessageResult>(
+                    "SendChatRoomMessage", [&](grpc::ClientContext *context) {
+                        return current().messageStub->AsyncSendChatRoomMessage(context, request, &completionQueue);
+                    });
+            co_return send_result_code("SendChatRoomMessage", status, response);
+        }
+
+        PooledTask<std::optional<std::vector<ChatRoom>>> getChatRooms() {
+            co_await ensure_session();
+            steam::ChatRoomsRequest request;
+            request.set_sessionkey(sessionKey.value_or(""));
+            auto [status, response] = co_await call_unary<steam::ChatRoomsResponse>(
+                    "GetChatRooms", [&](grpc::ClientContext *context) {
+                        return current().messageStub->AsyncGetChatRooms(context, request, &completionQueue);
+                    });
+            if (!status.ok()) {
+                std::cout << "GetChatRooms failed (gRPC failure)" << std::endl;
+                std::cout << status.error_code() << ": " << status.error_message() << std::endl;
+                co_return std::nullopt;
+            }
+            std::vector<ChatRoom> rooms;
+            rooms.reserve(response.rooms_size());
+            for (auto &room: response.rooms()) {
+                rooms.push_back({room.groupid(), room.chatid(), room.name(), room.membercount()});
+            }
+            co_return rooms;
+        }
+
+        static ChatRoomEvent to_chat_room_event(steam::ChatRoomEvent &response) {
+            ChatRoomEvent event;
+            event.version = response.version();
+            event.reset = response.reset();
+            event.joined.reserve(response.joined_size());
+            for (auto &member: *response.mutable_joined()) {
+                event.joined.push_back({std::move(*member.mutable_id()), std::move(*member.mutable_name()),
+                                        (PersonaState) (int) member.personastate()});
+            }
+            event.left.reserve(response.left_size());
+            for (auto &id: *response.mutable_left()) {
+                event.left.push_back(std::move(id));
+            }
+            event.messages.reserve(response.messages_size());
+            for (auto &message: *response.mutable_messages()) {
+                event.messages.push_back(to_message(message));
             }
+            return event;
         }
 
-        cppcoro::task<ActiveMessageSessions> getActiveMessageSessions(std::optional<int64_t> sinceTimestampMs) {
+        // long-lived, so it bypasses the retry policy: the caller re-watches with the last version it applied
+        PooledTask<bool> watchChatRoom(const std::string &groupId, const std::string &chatId,
+                                       std::optional<uint64_t> knownVersion,
+                                       std::function<void(ChatRoomEvent &&)> onEvent,
+                                       cppcoro::cancellation_token cancellation) {
+            co_await ensure_session();
+            steam::WatchChatRoomRequest request;
+            request.set_sessionkey(sessionKey.value_or(""));
+            request.set_groupid(groupId);
+            request.set_chatid(chatId);
+            if (knownVersion.has_value()) {
+                request.set_knownversion(knownVersion.value());
+            }
+            grpc::ClientContext context;
+            grpc::Status status;
+            cppcoro::cancellation_registration registration(std::move(cancellation), [&context] {
+                context.TryCancel();
+            });
+            auto tag = tagCounter++;
+            auto &token = callbacks.emplace(std::piecewise_construct, std::forward_as_tuple(tag),
+                                            std::forward_as_tuple()).first->second;
+            auto stream = current().messageStub->AsyncWatchChatRoom(&context, request, &completionQueue,
+                                                                    reinterpret_cast<void *>(tag));
+            if (co_await token.receive()) {  // StartCall response
+                while (true) {
+                    steam::ChatRoomEvent response;
+                    stream->Read(&response, reinterpret_cast<void *>(tag));
+                    if (!co_await token.receive()) {
+                        break;
+                    }
+                    onEvent(to_chat_room_event(response));
+                }
+            }
+            stream->Finish(&status, reinterpret_cast<void *>(tag));
+            co_await token.receive();
+            callbacks.erase(tag);
+            if (!status.ok() && status.error_code() != grpc::StatusCode::CANCELLED) {
+                std::cout << "WatchChatRoom failed (gRPC failure)" << std::endl;
+                std::cout << status.error_code() << ": " << status.error_message() << std::endl;
+                co_return false;
+            }
+            co_return true;
+        }
+
+        // coalesced only: a cached session list would delay new messages
+        PooledTask<ActiveMessageSessions> getActiveMessageSessions(std::optional<int64_t> sinceTimestampMs) {
+            co_await ensure_session();
+            co_return co_await activeSessionsFlight.run(
+                    std::make_pair(sessionKey.value_or(""), sinceTimestampMs), [this, sinceTimestampMs]() {
+                        return fetch_active_message_sessions(sinceTimestampMs);
+                    });
+        }
+
+        PooledTask<ActiveMessageSessions> fetch_active_message_sessions(std::optional<int64_t> sinceTimestampMs) {
             steam::ActiveMessageSessionsRequest request;
-            request.set_sessionkey(sessionKey.value());
-            if (sinceTimestampMs.has_value()) {
+            request.set_sessionkey(sessionKey.value_or(""));
+            if (sinceTimestampMs.has_value() && compactWire) {
+                request.set_sincens(sinceTimestampMs.value());
+            } else if (sinceTimestampMs.has_value()) {
                 request.set_allocated_since(make_timestamp_protobuf(sinceTimestampMs.value()));
             }
 
-            grpc::ClientContext context;
-            steam::ActiveMessageSessionResponse response;
-            auto rpc = messageStub->AsyncGetActiveFriendMessageSessions(&context, request, &completionQueue);
-            if (grpc::Status status; !co_await run_call(rpc, response, status) || !status.ok()) {
+            auto [status, response] = co_await call_unary<steam::ActiveMessageSessionResponse>(
+                    "GetActiveFriendMessageSessions", [&](grpc::ClientContext *context) {
+                        return current().messageStub->AsyncGetActiveFriendMessageSessions(context, request, &completionQueue);
+                    });
+            if (!status.ok()) {
                 std::cout << "GetActiveMessageSessions failed (gRPC failure)" << std::endl;
                 std::cout << status.error_code() << ": " << status.error_message() << std::endl;
                 co_return ActiveMessageSessions{{}, std::nullopt};
             }
 
             std::vector<ActiveMessageSessions::Session> sessions;
+            sessions.reserve(response.sessions_size());
             for (auto &x: response.sessions()) {
                 ActiveMessageSessions::Session session;
-                session.id = x.targetid();
-                session.lastMessageTimestampNs = to_timestamp_ns(x.lastmessagetimestamp());
-                session.lastViewedTimestampNs = to_timestamp_ns(x.lastviewtimestamp());
+                session.id = x.target() != 0 ? SteamId(x.target()) : SteamId::parse(x.targetid());
+                session.lastMessageTimestampNs = x.has_lastmessagetimestamp()
+                                                 ? to_timestamp_ns(x.lastmessagetimestamp())
+                                                 : x.lastmessagetimestampns();
+                session.lastViewedTimestampNs = x.has_lastviewtimestamp()
+                                                ? to_timestamp_ns(x.lastviewtimestamp())
+                                                : x.lastviewtimestampns();
                 session.unreadMessageCount = x.unreadcount();
                 sessions.push_back(session);
             }
 
-            co_return ActiveMessageSessions{sessions, {to_timestamp_ns(response.timestamp())}};
+            auto timestampNs = response.has_timestamp() ? to_timestamp_ns(response.timestamp()) : response.timestampns();
+            co_return ActiveMessageSessions{std::move(sessions), {timestampNs}};
         }
 
-        cppcoro::task<bool> ackFriendMessage(const std::string &id, int64_t timestampNs) {
+        PooledTask<bool> ackFriendMessage(const std::string &id, int64_t timestampNs) {
+            co_await ensure_session();
             steam::AckFriendMessageRequest request;
-            request.set_sessionkey(sessionKey.value());
-            request.set_targetid(id);
-            request.set_allocated_lasttimestamp(make_timestamp_protobuf(timestampNs));
-            grpc::ClientContext context;
-            google::protobuf::Empty response;
-            auto rpc = messageStub->AsyncAckFriendMessage(&context, request, &completionQueue);
-            if (grpc::Status status; !co_await run_call(rpc, response, status) || !status.ok()) {
+            request.set_sessionkey(sessionKey.value_or(""));
+            set_target(request, id);
+            if (compactWire) {
+                request.set_lasttimestampns(timestampNs);
+            } else {
+                request.set_allocated_lasttimestamp(make_timestamp_protobuf(timestampNs));
+            }
+            auto [status, response] = co_await call_unary<google::protobuf::Empty>(
+                    "AckFriendMessage", [&](grpc::ClientContext *context) {
+                        return current().messageStub->AsyncAckFriendMessage(context, request, &completionQueue);
+                    });
+            if (!status.ok()) {
                 std::cout << "AckFriendMessage failed (gRPC failure)" << std::endl;
                 std::cout << status.error_code() << ": " << status.error_message() << std::endl;
                 co_return false;
@@ -298,6 +1229,32 @@ namespace SteamClient {
             std::cout << "AckFriendMessage successful" << std::endl;
             co_return true;
         }
+
+        PooledTask<bool> ackFriendMessages(const std::map<std::string, int64_t> &timestampsNs) {
+            co_await ensure_session();
+            steam::AckFriendMessagesRequest request;
+            request.set_sessionkey(sessionKey.value_or(""));
+            for (auto &[id, timestampNs]: timestampsNs) {
+                auto *ack = request.add_acks();
+                set_target(*ack, id);
+                if (compactWire) {
+                    ack->set_lasttimestampns(timestampNs);
+                } else {
+                    set_timestamp_protobuf(ack->mutable_lasttimestamp(), timestampNs);
+                }
+            }
+            auto [status, response] = co_await call_unary<google::protobuf::Empty>(
+                    "AckFriendMessages", [&](grpc::ClientContext *context) {
+                        return current().messageStub->AsyncAckFriendMessages(context, request, &completionQueue);
+                    });
+            if (!status.ok()) {
+                std::cout << "AckFriendMessages failed (gRPC failure)" << std::endl;
+                std::cout << status.error_code() << ": " << status.error_message() << std::endl;
+                co_return false;
+            }
+            std::cout << "AckFriendMessages successful (" << timestampsNs.size() << " conversations)" << std::endl;
+            co_return true;
+        }
     };
 
     AsyncClientWrapper::~AsyncClientWrapper() = default;
@@ -310,45 +1267,126 @@ namespace SteamClient {
         return pImpl->shutdown();
     };
 
-    cppcoro::task<AuthResponseState>
+    void AsyncClientWrapper::cancelRetries() {
+        pImpl->cancelRetries();
+    }
+
+    PooledTask<AuthResponseState>
     AsyncClientWrapper::authenticate(const std::string &username, const std::string &password,
                                      const std::optional<std::string> &steamGuardCode) {
         return pImpl->authenticate(username, password, steamGuardCode);
     }
 
-    cppcoro::task<FriendsList> AsyncClientWrapper::getFriendsList() {
+    PooledTask<FriendsListView> AsyncClientWrapper::getFriendsListView() {
+        _check_session_key();
+        return pImpl->getFriendsListView();
+    }
+
+    PooledTask<FriendsList> AsyncClientWrapper::getFriendsList() {
         _check_session_key();
         return pImpl->getFriendsList();
     }
 
-    cppcoro::task<std::vector<Message>>
+    PooledTask<std::vector<Message>>
     AsyncClientWrapper::getMessages(const std::string &id, std::optional<int64_t> startTimestampNs,
                                     std::optional<int64_t> lastTimestampNs) {
         _check_session_key();
         return pImpl->getMessages(id, startTimestampNs, lastTimestampNs);
     }
 
-    cppcoro::task<SendMessageCode>
-    AsyncClientWrapper::sendMessage(const std::string &id, const std::string &message) {
+    PooledTask<MessagePage> AsyncClientWrapper::getMessagePage(const std::string &id, const MessagePageQuery &query) {
+        _check_session_key();
+        return pImpl->getMessagePage(id, query);
+    }
+
+    PooledTask<SendMessageCode>
+    AsyncClientWrapper::sendMessage(const std::string &id, const std::string &message,
+                                    const std::optional<std::string> &idempotencyKey,
+                                    const std::optional<std::string> &afterKey) {
+        _check_session_key();
+        return pImpl->sendMessage(id, message, idempotencyKey, afterKey);
+    }
+
+    PooledTask<std::optional<std::vector<ChatRoom>>> AsyncClientWrapper::getChatRooms() {
+        _check_session_key();
+        return pImpl->getChatRooms();
+    }
+
+    PooledTask<std::optional<std::vector<Buddy>>>
+    AsyncClientWrapper::searchUsers(const std::string &query, uint32_t limit) {
+        _check_session_key();
+        return pImpl->searchUsers(query, limit);
+    }
+
+    PooledTask<bool>
+    AsyncClientWrapper::watchChatRoom(const std::string &groupId, const std::string &chatId,
+                                      std::optional<uint64_t> knownVersion,
+                                      std::function<void(ChatRoomEvent &&)> onEvent,
+                                      cppcoro::cancellation_token token) {
         _check_session_key();
-        return pImpl->sendMessage(id, message);
+        return pImpl->watchChatRoom(groupId, chatId, knownVersion, std::move(onEvent), std::move(token));
     }
 
-    cppcoro::task<ActiveMessageSessions>
+    PooledTask<SendMessageCode>
+    AsyncClientWrapper::sendChatRoomMessage(const std::string &groupId, const std::string &chatId,
+                                            const std::string &message,
+                                            const std::optional<std::string> &idempotencyKey) {
+        _check_session_key();
+        return pImpl->sendChatRoomMessage(groupId, chatId, message, idempotencyKey);
+    }
+
+    PooledTask<ActiveMessageSessions>
     AsyncClientWrapper::getActiveMessageSessions(std::optional<int64_t> sinceTimestampMs) {
         return pImpl->getActiveMessageSessions(sinceTimestampMs);
     }
 
-    cppcoro::task<bool> AsyncClientWrapper::ackFriendMessage(const std::string &id, int64_t timestampNs) {
+    PooledTask<bool> AsyncClientWrapper::ackFriendMessage(const std::string &id, int64_t timestampNs) {
         return pImpl->ackFriendMessage(id, timestampNs);
     }
 
+    PooledTask<bool> AsyncClientWrapper::ackFriendMessages(const std::map<std::string, int64_t> &timestampsNs) {
+        _check_session_key();
+        return pImpl->ackFriendMessages(timestampsNs);
+    }
+
     void AsyncClientWrapper::_check_session_key() {
         if (!isSessionKeySet()) {
             throw std::runtime_error("session key not set");
         }
     }
 
+    void AsyncClientWrapper::attachSharedMemory(std::shared_ptr<ShmRegion> region) {
+        pImpl->shm = std::make_unique<ShmEndpoint>(std::move(region), ShmRegion::CLIENT);
+    }
+
+    bool AsyncClientWrapper::isConnected() {
+        return pImpl->is_connected();
+    }
+
+    PooledTask<bool> AsyncClientWrapper::waitForConnected(cppcoro::cancellation_token token) {
+        return pImpl->waitForConnected(std::move(token));
+    }
+
+    void AsyncClientWrapper::setRetryPolicy(const std::string &method, const RetryPolicy &policy) {
+        auto &state = pImpl->method_state(method);
+        state.policy = policy;
+        state.tokens = std::min(state.tokens, policy.maxTokens);
+    }
+
+    void AsyncClientWrapper::setRefreshToken(const std::optional<std::string> &token) {
+        pImpl->refreshToken = token;
+    }
+
+    std::optional<std::string> AsyncClientWrapper::refreshToken() {
+        return pImpl->refreshToken;
+    }
+
+    void AsyncClientWrapper::preconnect() {
+        for (auto &endpoint: pImpl->endpoints) {
+            endpoint->channel->GetState(true);
+        }
+    }
+
     void AsyncClientWrapper::resetSessionKey() {
         pImpl->sessionKey = std::nullopt;
     }
@@ -361,7 +1399,46 @@ namespace SteamClient {
         return pImpl->sessionKey.has_value();
     }
 
-    AsyncClientWrapper::AsyncClientWrapper::AsyncClientWrapper(const std::string &address) {
-        pImpl = std::make_unique<impl>(address);
+    std::optional<AuthResponseState> AsyncClientWrapper::sessionLost() {
+        return pImpl->sessionLost;
+    }
+
+    std::optional<ChannelOptions> channelProfile(const std::string &name) {
+        ChannelOptions options;
+        if (name == "default") {
+            options.keepaliveTimeMs = 30000;
+        } else if (name == "local") {
+            options.keepaliveTimeMs = 60000;
+            options.maxReceiveMessageSize = 64 * 1024 * 1024;
+            options.http2LookaheadBytes = 8 * 1024 * 1024;
+        } else if (name == "bulk") {
+            options.keepaliveTimeMs = 30000;
+            options.maxReceiveMessageSize = 64 * 1024 * 1024;
+            options.compress = true;
+        } else {
+            return std::nullopt;
+        }
+        return options;
+    }
+
+    std::vector<EndpointStats> AsyncClientWrapper::endpointStats() {
+        std::vector<EndpointStats> stats;
+        for (size_t i = 0; i < pImpl->endpoints.size(); ++i) {
+            auto &endpoint = *pImpl->endpoints[i];
+            stats.push_back({endpoint.address, endpoint.state == GRPC_CHANNEL_READY,
+                             pImpl->assigned && pImpl->active == i, endpoint.calls, endpoint.failures,
+                             endpoint.inFlight,
+                             endpoint.calls == 0 ? 0.0 : (double) endpoint.totalLatencyNs / endpoint.calls / 1e6});
+        }
+        return stats;
+    }
+
+    AsyncClientWrapper::AsyncClientWrapper::AsyncClientWrapper(const std::string &address,
+                                                               const ChannelOptions &options)
+            : AsyncClientWrapper(std::vector<std::string>{address}, options) {}
+
+    AsyncClientWrapper::AsyncClientWrapper(const std::vector<std::string> &addresses,
+                                           const ChannelOptions &options) {
+        pImpl = std::make_unique<impl>(addresses, options);
     }
 } // SteamClient
\ No newline at end of file
@@ -1,14 +1,72 @@
 #ifndef PIDGIN_STEAM_GRPC_CLIENT_WRAPPER_ASYNC_H
 #define PIDGIN_STEAM_GRPC_CLIENT_WRAPPER_ASYNC_H
 
+#include <chrono>
+#include <functional>
 #include <string>
+#include <map>
 #include <optional>
 #include <vector>
 #include <memory>
 #include "cppcoro/task.hpp"
+#include "pooled_task.h"
+#include "proto_view.h"
 #include "cppcoro/io_service.hpp"
+#include "cppcoro/cancellation_token.hpp"
 
 namespace SteamClient {
+    class ShmRegion;
+
+    /*
+     * Transport tuning for the proxy link. Named presets are available through `channelProfile()`:
+     *  - "default": gRPC defaults plus keepalive pings, so that a dead proxy is noticed while idle
+     *  - "local":   proxy on the same host (typically a unix: socket); wide flow-control windows and a large message
+     *               limit, no compression
+     *  - "bulk":    slow links and large history pulls; gzip in both directions
+     */
+    struct ChannelOptions {
+        int keepaliveTimeMs = 0;  // 0 disables keepalive pings
+        int keepaliveTimeoutMs = 20000;
+        int maxReceiveMessageSize = 4 * 1024 * 1024;
+        bool compress = false;  // gzip requests and advertise gzip so that the proxy may compress responses
+        int http2LookaheadBytes = 0;  // per-stream flow-control window; 0 keeps gRPC's adaptive (BDP) sizing
+    };
+
+    std::optional<ChannelOptions> channelProfile(const std::string &name);
+
+    /*
+     * Per-method retry settings. Failed attempts with a transient status (UNAVAILABLE, DEADLINE_EXCEEDED,
+     * RESOURCE_EXHAUSTED, ABORTED) are retried with jittered exponential backoff while the method's retry budget
+     * lasts: every failure costs one token, every success refunds `tokenRatio`, and retries stop while the bucket is
+     * at or below half of `maxTokens` (the throttling scheme of gRPC's service config).
+     *
+     * Only idempotent methods may set `hedge`: once enough latency samples exist, a second attempt is issued if the
+     * first has not answered within the method's p95 latency, and whichever succeeds first wins.
+     */
+    struct RetryPolicy {
+        int maxAttempts = 1;
+        std::chrono::milliseconds initialBackoff{200};
+        std::chrono::milliseconds maxBackoff{5000};
+        double backoffMultiplier = 2.0;
+        double jitter = 0.2;  // backoff is scaled by a random factor in [1 - jitter, 1 + jitter]
+        std::chrono::milliseconds attemptTimeout{30000};
+        double maxTokens = 10;
+        double tokenRatio = 0.1;
+        bool hedge = false;
+        std::chrono::milliseconds minHedgeDelay{20};
+    };
+
+    // load report for one proxy endpoint, see AsyncClientWrapper::endpointStats()
+    struct EndpointStats {
+        std::string address;
+        bool ready;  // channel is READY
+        bool active;  // holds this account's session
+        uint64_t calls;
+        uint64_t failures;
+        uint64_t inFlight;
+        double meanLatencyMs;
+    };
+
     class AsyncClientWrapper {
         struct impl;
         std::unique_ptr<impl> pImpl;
@@ -16,7 +74,16 @@ namespace SteamClient {
         void _check_session_key();
 
     public:
-        explicit AsyncClientWrapper(const std::string &address);
+        // `address` is a gRPC target such as "localhost:8080" or "unix:/run/user/1000/pidgin-steam.sock"
+        explicit AsyncClientWrapper(const std::string &address, const ChannelOptions &options = {});
+
+        /*
+         * Several interchangeable proxies. The account sticks to one of them, picked by consistent hashing on the
+         * username (first READY endpoint in hash order) at the first authenticate(). All channels are kept connected
+         * and watched; when the active one fails the wrapper moves to the next READY endpoint in the same order and
+         * transparently re-authenticates there before the next RPC.
+         */
+        explicit AsyncClientWrapper(const std::vector<std::string> &addresses, const ChannelOptions &options = {});
 
         ~AsyncClientWrapper();
 
@@ -24,26 +91,97 @@ namespace SteamClient {
 
         void shutdown();
 
-        cppcoro::task <AuthResponseState> authenticate(const std::string &username, const std::string &password,
-                                                       const std::optional<std::string> &steamGuardCode);
+        // ends every pending retry backoff with the failure it was retrying, and stops further retries; call it before
+        // waiting for the calls in flight to finish, e.g. on close
+        void cancelRetries();
+
+        PooledTask<AuthResponseState> authenticate(const std::string &username, const std::string &password,
+                                                   const std::optional<std::string> &steamGuardCode);
+
+        PooledTask<FriendsList> getFriendsList();
 
-        cppcoro::task <FriendsList> getFriendsList();
+        // the same list left encoded and decoded on access; cheaper when only some fields of some friends are read
+        PooledTask<FriendsListView> getFriendsListView();
 
-        cppcoro::task <std::vector<Message>>
+        PooledTask<std::vector<Message>>
         getMessages(const std::string &id, std::optional<int64_t> startTimestampNs = std::nullopt,
                     std::optional<int64_t> lastTimestampNs = std::nullopt);
 
-        cppcoro::task <SendMessageCode> sendMessage(const std::string &id, const std::string &message);
+        // one page of history, newest first across pages; see PollRequest in message.proto for the bounds
+        PooledTask<MessagePage> getMessagePage(const std::string &id, const MessagePageQuery &query);
+
+        // `afterKey`: the idempotency key of a send to `id` still in flight that must reach Steam first
+        PooledTask<SendMessageCode> sendMessage(const std::string &id, const std::string &message,
+                                                const std::optional<std::string> &idempotencyKey = std::nullopt,
+                                                const std::optional<std::string> &afterKey = std::nullopt);
+
+        PooledTask<ActiveMessageSessions> getActiveMessageSessions(std::optional<int64_t> sinceTimestampMs = std::nullopt);
+
+        PooledTask<bool> ackFriendMessage(const std::string &id, int64_t timestampNs);
 
-        cppcoro::task <ActiveMessageSessions> getActiveMessageSessions(std::optional<int64_t> sinceTimestampMs = std::nullopt);
+        // acknowledges several conversations in one RPC; maps SteamID to last read timestamp
+        PooledTask<bool> ackFriendMessages(const std::map<std::string, int64_t> &timestampsNs);
 
-        cppcoro::task<bool> ackFriendMessage(const std::string &id, int64_t timestampNs);
+        // users the proxy can find by name or SteamID (see SearchUsersRequest); nullopt on failure
+        PooledTask<std::optional<std::vector<Buddy>>> searchUsers(const std::string &query, uint32_t limit);
+
+        // every channel of every group chat the account is in; nullopt on failure
+        PooledTask<std::optional<std::vector<ChatRoom>>> getChatRooms();
+
+        /*
+         * Follows a chat room until the token is cancelled or the stream breaks, handing each event to `onEvent` as
+         * it arrives. With the version of the last applied event as `knownVersion`, a re-watch starts with a delta
+         * instead of the full member list. Returns false if the stream failed (rather than being cancelled).
+         */
+        PooledTask<bool> watchChatRoom(const std::string &groupId, const std::string &chatId,
+                                       std::optional<uint64_t> knownVersion,
+                                       std::function<void(ChatRoomEvent &&)> onEvent,
+                                       cppcoro::cancellation_token token = {});
+
+        PooledTask<SendMessageCode> sendChatRoomMessage(const std::string &groupId, const std::string &chatId,
+                                                        const std::string &message,
+                                                        const std::optional<std::string> &idempotencyKey = std::nullopt);
+
+        // true while the channel to the active proxy (any proxy before the first authenticate) is READY; tracked
+        // from run_cq
+        bool isConnected();
+
+        // Completes once the channel is READY (true) or the token is cancelled (false).
+        PooledTask<bool> waitForConnected(cppcoro::cancellation_token token = {});
+
+        /*
+         * Routes PollChatMessages (the bulk path) through a shared-memory ring pair instead of gRPC, e.g. to a
+         * co-located peer that was handed `region->fds()`. The other RPCs keep using the channel. Frames are picked
+         * up by run_cq.
+         */
+        void attachSharedMemory(std::shared_ptr<ShmRegion> region);
+
+        // method names match the RPC names in message.proto, e.g. "GetFriendsList"
+        void setRetryPolicy(const std::string &method, const RetryPolicy &policy);
+
+        /*
+         * Log in with a refresh token from an earlier session instead of the password. A token returned by the proxy
+         * replaces it; a rejected one is dropped, so the next authenticate() falls back to the password.
+         */
+        void setRefreshToken(const std::optional<std::string> &token);
+
+        std::optional<std::string> refreshToken();
+
+        // starts connecting every channel without waiting for run_cq or the first RPC
+        void preconnect();
+
+        // one entry per endpoint, in constructor order
+        std::vector<EndpointStats> endpointStats();
 
         void resetSessionKey();
 
         bool shouldReset();
 
         bool isSessionKeySet();
+
+        // set when re-creating the session after a failover failed for good (the credentials were rejected, or
+        // Steam wants a Steam Guard code); the stale key stays set, so only this tells that the session is gone
+        std::optional<AuthResponseState> sessionLost();
     };
 } // SteamClient
 
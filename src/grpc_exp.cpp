@@ -5,26 +5,95 @@
 #include <iostream>
 #include <string>
 #include <optional>
+#include <chrono>
 #include <fstream>
+#include <map>
+#include <sstream>
+#include <vector>
 #include <thread>
 #include "json/json.h"
 #include "cppcoro/cancellation_source.hpp"
 #include "cppcoro/async_scope.hpp"
 #include "cppcoro/when_all_ready.hpp"
+#include "pooled_task.h"
+#include "shm_transport.h"
+#include "message_index.h"
+#include "markup.h"
+#include "proto_view.h"
+#include "../protobufs/comm_protobufs/message.pb.h"
+#include <filesystem>
+#include <random>
+#include <algorithm>
+
+// gRPC target of the proxy, e.g. "localhost:8080" or "unix:/tmp/pidgin-steam.sock"; may be a comma-separated list
+std::string proxy_address() {
+    return EnvVars::get("GRPC_EXP_ADDRESS")().value_or("localhost:8080");
+}
+
+std::vector<std::string> proxy_addresses() {
+    std::vector<std::string> addresses;
+    std::stringstream list(proxy_address());
+    for (std::string address; std::getline(list, address, ',');) {
+        if (!address.empty()) {
+            addresses.push_back(address);
+        }
+    }
+    return addresses;
+}
 
 void sync() {
-    SteamClient::ClientWrapper client("localhost:8080");
+    SteamClient::ClientWrapper client(proxy_address());
     client.authenticate(EnvVars::get("STEAM_USERNAME").value(), EnvVars::get("STEAM_PASSWORD").value(), std::nullopt);
     auto friends = client.getFriendsList();
     for (auto &x: friends.buddies) {
         std::cout << x.nickname << " " << x.id << std::endl;
-        auto messages = client.getMessages(x.id);
+        auto messages = client.getMessages(x.id.str());
         for (auto &y: messages) {
             std::cout << y.senderId << " " << y.message << " " << y.timestamp_ns << std::endl;
         }
     }
 }
 
+void print_frame_pool_stats(const std::string &label, const FramePoolStats &stats) {
+    std::cout << label << ": frames " << stats.allocations << " (" << stats.poolHits << " pooled, "
+              << stats.heapAllocations << " malloc), frees " << stats.deallocations << " (" << stats.heapFrees
+              << " free), in use " << stats.bytesInUse << " B, cached " << stats.bytesCached << " B" << std::endl;
+}
+
+cppcoro::task<void> bench_history(SteamClient::AsyncClientWrapper &client, const std::vector<SteamClient::Buddy> &buddies,
+                                  int rounds, const std::string &label) {
+    size_t messageCount = 0, bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        for (auto &x: buddies) {
+            for (auto &y: co_await client.getMessages(x.id.str())) {
+                ++messageCount;
+                bytes += y.message.size();
+            }
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "bench " << label << ": " << rounds << " rounds, " << messageCount << " messages (" << bytes
+              << " B text) in " << elapsed * 1000 << " ms, " << (double) messageCount / elapsed << " msg/s"
+              << std::endl;
+}
+
+// round trip of an empty poll (start timestamp in the future)
+cppcoro::task<void> bench_latency(SteamClient::AsyncClientWrapper &client, const std::vector<SteamClient::Buddy> &buddies,
+                                  int iterations, const std::string &label) {
+    if (buddies.empty()) {
+        co_return;
+    }
+    auto future = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            (std::chrono::system_clock::now() + std::chrono::hours(1)).time_since_epoch()).count();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        co_await client.getMessages(buddies[i % buddies.size()].id.str(), future);
+    }
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "bench " << label << ": empty poll round trip " << elapsed / iterations << " us" << std::endl;
+}
+
 struct Driver {
     cppcoro::io_service ioService;
     // cppcoro::async_scope scope;
@@ -32,6 +101,62 @@ struct Driver {
     cppcoro::cancellation_token cancelToken = cancelTokenSource.token();
 };
 
+// Follows the first chat room for a while and reports how its feed arrives. Against the mock's 5000-member room the
+// member list should come once, then only small deltas, in a steady few events per second however fast the room
+// talks; "handler" is the time spent applying events to a member map, roughly what the plugin pays per event.
+cppcoro::task<void> bench_chat_room(Driver &driver, SteamClient::AsyncClientWrapper &client, int seconds) {
+    auto rooms = co_await client.getChatRooms();
+    if (!rooms.has_value() || rooms->empty()) {
+        std::cerr << "bench chat room: no rooms" << std::endl;
+        co_return;
+    }
+    auto room = rooms->front();
+    size_t events = 0, resets = 0, firstMembers = 0, joined = 0, left = 0, messages = 0;
+    int64_t lagNs = 0;
+    std::chrono::nanoseconds handlerTime{0};
+    std::map<std::string, SteamClient::ChatRoomMember> members;
+    cppcoro::cancellation_source stop;
+    auto start = std::chrono::steady_clock::now();
+    co_await cppcoro::when_all_ready(
+            client.watchChatRoom(room.groupId, room.chatId, std::nullopt, [&](SteamClient::ChatRoomEvent &&event) {
+                auto handlerStart = std::chrono::steady_clock::now();
+                auto nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+                if (event.reset) {
+                    firstMembers = resets++ == 0 ? event.joined.size() : firstMembers;
+                    members.clear();
+                } else {
+                    joined += event.joined.size();
+                    left += event.left.size();
+                }
+                for (auto &member: event.joined) {
+                    auto id = member.id;
+                    members.insert_or_assign(std::move(id), std::move(member));
+                }
+                for (auto &id: event.left) {
+                    members.erase(id);
+                }
+                for (auto &message: event.messages) {
+                    lagNs += nowNs - message.timestamp_ns;
+                }
+                messages += event.messages.size();
+                ++events;
+                handlerTime += std::chrono::steady_clock::now() - handlerStart;
+            }, stop.token()),
+            [&]() -> cppcoro::task<void> {
+                co_await driver.ioService.schedule_after(std::chrono::seconds(seconds));
+                stop.request_cancellation();
+            }());
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "bench chat room " << room.name << " (" << room.memberCount << " members): " << events
+              << " events in " << elapsed << " s (" << (double) events / elapsed << "/s), " << resets
+              << " resets (first with " << firstMembers << " members), " << joined << " joined, " << left
+              << " left, " << members.size() << " members at the end, " << messages << " messages ("
+              << (double) messages / elapsed << "/s), mean delivery lag "
+              << (messages > 0 ? (double) lagNs / (double) messages / 1e6 : 0) << " ms, handler "
+              << (events > 0 ? (double) handlerTime.count() / (double) events / 1e3 : 0) << " us/event" << std::endl;
+}
+
 
 cppcoro::task<void>
 async_task(Driver &driver, SteamClient::AsyncClientWrapper &client, std::string username, std::string password) {
@@ -45,7 +170,7 @@ async_task(Driver &driver, SteamClient::AsyncClientWrapper &client, std::string
     std::cout << "Get all messages" << std::endl;
     for (auto &x: friends.buddies) {
         std::cout << x.nickname << " " << x.id << std::endl;
-        std::vector<SteamClient::Message> messages = co_await client.getMessages(x.id);
+        std::vector<SteamClient::Message> messages = co_await client.getMessages(x.id.str());
         for (auto &y: messages) {
             std::cout << y.senderId << " " << y.message << " " << y.timestamp_ns << std::endl;
         }
@@ -58,6 +183,50 @@ async_task(Driver &driver, SteamClient::AsyncClientWrapper &client, std::string
                   << x.unreadMessageCount << std::endl;
     }
 
+    // Steady-state poll loop: the same RPC pattern as the plugin's 500 ms tick, to measure frame allocations.
+    // Only the first iteration should need to malloc frames; later ones are served from the frame pool.
+    auto iterations = std::stoi(EnvVars::get("GRPC_EXP_POLL_ITERATIONS")().value_or("0"));
+    for (int i = 0; i < iterations; ++i) {
+        FramePool::local().reset_stats();
+        auto polled = co_await client.getActiveMessageSessions();
+        for (auto &x: polled.session) {
+            co_await client.getMessages(x.id.str(), x.lastMessageTimestampNs);
+        }
+        print_frame_pool_stats("poll iteration " + std::to_string(i), FramePool::local().stats());
+    }
+
+    // Bulk history benchmark: pull every friend's full history repeatedly. Compare transports and channel profiles
+    // by re-running with a different GRPC_EXP_ADDRESS / GRPC_EXP_CHANNEL_PROFILE. The summary goes to stderr so
+    // that stdout (which logs every message) can be discarded.
+    auto rounds = std::stoi(EnvVars::get("GRPC_EXP_BENCH_ROUNDS")().value_or("0"));
+    auto label = proxy_address() + " profile " + EnvVars::get("GRPC_EXP_CHANNEL_PROFILE")().value_or("default");
+    if (rounds > 0) {
+        co_await bench_history(client, friends.buddies, rounds, label);
+        co_await bench_latency(client, friends.buddies, rounds * 100, label);
+    }
+
+    // Same benchmark with PollChatMessages routed over shared memory to an in-process stand-in peer
+    auto shmHistory = std::stoi(EnvVars::get("GRPC_EXP_SHM_HISTORY")().value_or("0"));
+    if (rounds > 0 && shmHistory > 0) {
+        auto region = SteamClient::ShmRegion::create();
+        SteamClient::ShmStandInPeer peer(region, shmHistory);
+        client.attachSharedMemory(region);
+        co_await bench_history(client, friends.buddies, rounds, "shared memory");
+        co_await bench_latency(client, friends.buddies, rounds * 100, "shared memory");
+    }
+
+    // Group chat feed: GRPC_EXP_ROOM_SECONDS=10 against the mock (see MOCK_ROOM_MEMBERS / MOCK_ROOM_RATE)
+    auto roomSeconds = std::stoi(EnvVars::get("GRPC_EXP_ROOM_SECONDS")().value_or("0"));
+    if (roomSeconds > 0) {
+        co_await bench_chat_room(driver, client, roomSeconds);
+    }
+
+    for (auto &endpoint: client.endpointStats()) {
+        std::cerr << endpoint.address << (endpoint.active ? " (active)" : "") << ": " << endpoint.calls
+                  << " calls, " << endpoint.failures << " failed, " << endpoint.meanLatencyMs << " ms mean"
+                  << std::endl;
+    }
+
     std::cout << "async_task shutdown" << std::endl;
     client.shutdown();
     driver.cancelTokenSource.request_cancellation();
@@ -70,12 +239,18 @@ cppcoro::task<void> async_driver() {
     std::ifstream file("/tmp/credentials.json", std::ifstream::binary);
     Json::Value root;
     Json::Reader reader;
-    if (!reader.parse(file, root)) {
+    if (!reader.parse(file, root) && !EnvVars::get("STEAM_USERNAME").has_value()) {  // env is enough for the mock
         std::cout << "Failed to parse configuration\n" << reader.getFormattedErrorMessages();
         co_return;
     }
 
-    SteamClient::AsyncClientWrapper client("localhost:8080");
+    auto profile = EnvVars::get("GRPC_EXP_CHANNEL_PROFILE")().value_or("default");
+    auto channelOptions = SteamClient::channelProfile(profile);
+    if (!channelOptions.has_value()) {
+        std::cout << "Unknown channel profile " << profile << std::endl;
+        co_return;
+    }
+    SteamClient::AsyncClientWrapper client(proxy_addresses(), channelOptions.value());
     auto username = EnvVars::get("STEAM_USERNAME")().value_or(root["username"].asString());
     auto password = EnvVars::get("STEAM_PASSWORD")().value_or(root["password"].asString());
     std::cout << "username: " << username << std::endl;
@@ -123,7 +298,250 @@ void async() {
     cppcoro::sync_wait(async_driver());
 }
 
+// Message search: GRPC_EXP_SEARCH_MESSAGES=1000000 indexes that many synthetic messages in a scratch directory and
+// times a few queries over them (no proxy needed)
+void bench_message_index(uint32_t count) {
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    };
+    auto dir = (std::filesystem::temp_directory_path() / "grpc_exp_message_index").string();
+    std::filesystem::remove_all(dir);
+
+    // a Zipf-ish vocabulary of made-up words, so that posting lists range from a handful of documents to most of them
+    std::mt19937 random(1);
+    const char *syllables[] = {"ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "ze", "pa", "qu", "xi", "do", "fe",
+                               "gu", "ha"};
+    std::vector<std::string> vocabulary(30000);
+    for (auto &word: vocabulary) {
+        for (auto n = 1 + random() % 4; n > 0; --n) {
+            word += syllables[random() % 16];
+        }
+    }
+    std::uniform_real_distribution<> uniform(0, 1);
+
+    auto start = Clock::now();
+    {
+        SteamClient::MessageIndex index(dir);
+        double slowestAdd = 0;  // what the UI thread waits for at worst
+        std::vector<SteamClient::Message> page;
+        for (uint32_t i = 0; i < count; ++i) {
+            auto conversation = "7656119800000" + std::to_string(1000 + i % 200);
+            std::string text;
+            for (auto n = 3 + random() % 10; n > 0; --n) {
+                auto u = uniform(random);
+                text += vocabulary[(size_t) (u * u * u * (double) vocabulary.size())];
+                text += ' ';
+            }
+            page.push_back({SteamClient::SteamId::parse(conversation), text, (int64_t) i * 1000000000LL, 0});
+            if (page.size() == 50 || i + 1 == count) {
+                auto addStart = Clock::now();
+                index.add_page(conversation, page);
+                slowestAdd = std::max(slowestAdd, ms(addStart));
+                page.clear();
+            }
+        }
+        index.flush();
+        std::cerr << "bench message index: " << index.size() << " messages indexed in " << ms(start) << " ms, "
+                  << index.segmentCount() << " segments, slowest add_page " << slowestAdd << " ms" << std::endl;
+        for (auto query: {"ka", "kalo", "mine ru", "vozequ", "sa ti vo", "nothing"}) {
+            constexpr int runs = 20;
+            size_t hits = 0;
+            auto queryStart = Clock::now();
+            for (int run = 0; run < runs; ++run) {
+                hits = index.search(query, 50).size();
+            }
+            std::cerr << "  \"" << query << "\": " << hits << " hits, " << ms(queryStart) / runs << " ms" << std::endl;
+        }
+    }
+    start = Clock::now();
+    SteamClient::MessageIndex reopened(dir);
+    std::cerr << "  reopened in " << ms(start) << " ms" << std::endl;
+    uintmax_t bytes = 0;
+    for (auto &entry: std::filesystem::directory_iterator(dir)) {
+        bytes += entry.file_size();
+    }
+    std::cerr << "  " << bytes / (1024 * 1024) << " MiB on disk" << std::endl;
+    std::filesystem::remove_all(dir);
+}
+
+// Friends list decoding: GRPC_EXP_FRIENDS_PARSE=5000 times a full protobuf parse of a synthetic GetFriendsList
+// response with that many friends against FriendsListView reading only IDs and persona states (no proxy needed)
+void bench_friends_view(int count) {
+    using Clock = std::chrono::steady_clock;
+    auto us = [](Clock::time_point since, int runs) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - since).count() / runs;
+    };
+    steam::FriendsListResponse response;
+    for (int i = 0; i <= count; ++i) {
+        auto *persona = i == 0 ? response.mutable_user() : response.add_friends();
+        persona->set_steamid(76561197960265728ULL + i);
+        persona->set_name("friend " + std::to_string(i));
+        persona->set_personastate((steam::PersonaState) (i % 7));
+        auto *avatarUrl = persona->mutable_avatarurl();
+        std::string hash = "https://avatars.steamstatic.com/" + std::string(40, (char) ('a' + i % 6));
+        avatarUrl->set_icon(hash + ".jpg");
+        avatarUrl->set_medium(hash + "_medium.jpg");
+        avatarUrl->set_full(hash + "_full.jpg");
+    }
+    auto encoded = response.SerializeAsString();
+
+    constexpr int runs = 50;
+    size_t sink = 0;
+    auto start = Clock::now();
+    for (int run = 0; run < runs; ++run) {
+        steam::FriendsListResponse parsed;
+        parsed.ParseFromString(encoded);
+        sink += parsed.friends_size();
+    }
+    auto full = us(start, runs);
+    start = Clock::now();
+    for (int run = 0; run < runs; ++run) {
+        SteamClient::FriendsListView view(nullptr, encoded);
+        for (auto &persona: view.friends()) {
+            sink += persona.id().value() + persona.personaState();
+        }
+    }
+    auto lazy = us(start, runs);
+    start = Clock::now();
+    for (int run = 0; run < runs; ++run) {
+        sink += SteamClient::FriendsListView(nullptr, encoded).to_friends_list().buddies.size();
+    }
+    auto materialized = us(start, runs);
+    std::cerr << "bench friends view: " << count << " friends, " << encoded.size() / 1024 << " KiB: full parse "
+              << full << " us, view IDs and states " << lazy << " us, view to_friends_list " << materialized
+              << " us (" << sink % 2 << ")" << std::endl;
+}
+
+// whether `html` holds only balanced tags, with every character that needs it escaped outside of them
+bool balanced_html(std::string_view html) {
+    std::vector<std::string_view> open;
+    for (size_t pos = 0; pos < html.size(); ++pos) {
+        char c = html[pos];
+        if (c == '>' || c == '"' || c == '\'') {
+            return false;
+        }
+        if (c == '&') {
+            auto entity = html.substr(pos, html.find(';', pos) - pos);
+            if (entity != "&lt" && entity != "&gt" && entity != "&amp" && entity != "&quot" && entity != "&#39") {
+                return false;
+            }
+        }
+        if (c != '<') {
+            continue;
+        }
+        auto end = html.find('>', pos);
+        if (end == std::string_view::npos) {
+            return false;
+        }
+        auto tag = html.substr(pos + 1, end - pos - 1);
+        if (tag.starts_with('/')) {
+            if (open.empty() || open.back() != tag.substr(1)) {
+                return false;
+            }
+            open.pop_back();
+        } else {
+            open.push_back(tag.substr(0, tag.find(' ')));
+        }
+        pos = end;
+    }
+    return open.empty();
+}
+
+// Markup fuzzing: GRPC_EXP_MARKUP_FUZZ=1000000 converts that many random mixes of BBCode, HTML and entity fragments
+// both ways and checks that steam_to_html always gives balanced, escaped HTML and that text without BBCode
+// survives a round trip. Exits with 1 on the first failure.
+bool fuzz_markup(int count) {
+    const char *fragments[] = {"[b]", "[/b]", "[i]", "[/i]", "[u]", "[/u]", "[s]", "[/s]", "[code]", "[/code]",
+                               "[spoiler]", "[/spoiler]", "[url=https://a.example/?x=1&y=2]", "[url=javascript:x]",
+                               "[url=\"https://a.example\"]", "[url]", "[/url]", "[emoticon]", "[/emoticon]",
+                               "[sticker type=\"x\"]", "\\[", "\\]", "\\", "[", "]", "=", "<b>", "</b>", "<I>", "</i>",
+                               "<a href=\"https://a.example/?x=1&amp;y=2\">", "<a href='steam://x'>", "<a>", "</a>",
+                               "<br>", "<br/>", "<font color=\"#ff0000\">", "</font>", "<span", "&amp;", "&lt;",
+                               "&#91;", "&#x5D;", "&#0;", "&#xD800;", "&nbsp;", "&bogus;", "&", "<", ">", "\"", "'",
+                               "https://a.example", "steamhappy", "text", " ", "\n", "\xc3\xa9", "\xff"};
+    std::mt19937 random(1);
+    std::string input, html, steam, scratch;
+    for (int i = 0; i < count; ++i) {
+        input.clear();
+        for (auto n = random() % 24; n > 0; --n) {
+            input += fragments[random() % std::size(fragments)];
+        }
+        auto fail = [&](const char *what) {
+            std::cerr << "fuzz markup: " << what << " for input \"" << input << "\"" << std::endl;
+            return false;
+        };
+        html = SteamClient::steam_to_html(input, scratch);
+        if (!balanced_html(html)) {
+            return fail("unbalanced or unescaped HTML");
+        }
+        steam = SteamClient::html_to_steam(html, scratch);
+        if (input.find_first_of("[\\") == std::string::npos && steam != input) {
+            return fail("round trip changed plain text");
+        }
+        steam = SteamClient::html_to_steam(input, scratch);
+        if (!balanced_html(SteamClient::steam_to_html(steam, html))) {
+            return fail("unbalanced HTML from html_to_steam output");
+        }
+    }
+    std::cerr << "fuzz markup: " << count << " inputs ok" << std::endl;
+    return true;
+}
+
+// Markup throughput: GRPC_EXP_MARKUP_BENCH=64 converts that many MiB of plain, punctuated and BBCode-heavy chat text,
+// Pidgin HTML, and an unterminated run of '[' (which must stay linear)
+void bench_markup(int mib) {
+    using Clock = std::chrono::steady_clock;
+    auto size = (size_t) mib << 20;
+    auto repeat = [size](std::string_view line) {
+        std::string text;
+        text.reserve(size + line.size());
+        while (text.size() < size) {
+            text += line;
+        }
+        return text;
+    };
+    std::string scratch;
+    auto run = [&](const char *name, const std::string &text, auto convert) {
+        auto start = Clock::now();
+        auto result = convert(text, scratch);
+        auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cerr << "  " << name << ": " << (double) text.size() / seconds / 1e6 << " MB/s"
+                  << (result.data() == text.data() ? " (unchanged)" : "") << std::endl;
+    };
+    std::cerr << "bench markup: " << mib << " MiB per input" << std::endl;
+    run("plain text to HTML", repeat("The quick brown fox jumps over the lazy dog, again and again. "),
+        SteamClient::steam_to_html);
+    run("punctuated text to HTML", repeat("it's <3 & \"fine\", isn't it? "), SteamClient::steam_to_html);
+    run("BBCode to HTML", repeat("Hi [b]there[/b] [url=https://a.example]x[/url] [emoticon]steamhappy[/emoticon] ok. "),
+        SteamClient::steam_to_html);
+    run("plain text from HTML", repeat("The quick brown fox jumps over the lazy dog, again and again. "),
+        SteamClient::html_to_steam);
+    run("HTML to BBCode", repeat("Hi <b>there</b> <a href=\"https://a.example/?a=1&amp;b=2\">x</a> &lt;3<br>"),
+        SteamClient::html_to_steam);
+    run("unterminated [ to HTML", std::string(size, '['), SteamClient::steam_to_html);
+}
+
 int main() {
+    auto searchMessages = std::stoul(EnvVars::get("GRPC_EXP_SEARCH_MESSAGES")().value_or("0"));
+    if (searchMessages > 0) {
+        bench_message_index((uint32_t) searchMessages);
+        return 0;
+    }
+    auto friendsParse = std::stoi(EnvVars::get("GRPC_EXP_FRIENDS_PARSE")().value_or("0"));
+    if (friendsParse > 0) {
+        bench_friends_view(friendsParse);
+        return 0;
+    }
+    auto markupFuzz = std::stoi(EnvVars::get("GRPC_EXP_MARKUP_FUZZ")().value_or("0"));
+    if (markupFuzz > 0) {
+        return fuzz_markup(markupFuzz) ? 0 : 1;
+    }
+    auto markupBench = std::stoi(EnvVars::get("GRPC_EXP_MARKUP_BENCH")().value_or("0"));
+    if (markupBench > 0) {
+        bench_markup(markupBench);
+        return 0;
+    }
     async();
     return 0;
 }
\ No newline at end of file
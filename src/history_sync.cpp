@@ -0,0 +1,160 @@
+#include "history_sync.h"
+
+namespace SteamClient {
+    void DeliveredRanges::insert(HistoryPosition lo, HistoryPosition hi) {
+        auto it = _ranges.upper_bound(lo);
+        if (it != _ranges.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second >= lo) {
+                lo = prev->first;
+                hi = std::max(hi, prev->second);
+                it = _ranges.erase(prev);
+            }
+        }
+        while (it != _ranges.end() && it->first <= hi) {
+            hi = std::max(hi, it->second);
+            it = _ranges.erase(it);
+        }
+        _ranges.emplace(lo, hi);
+    }
+
+    bool DeliveredRanges::contains(HistoryPosition position) const {
+        auto it = _ranges.upper_bound(position);
+        return it != _ranges.begin() && position <= std::prev(it)->second;
+    }
+
+    HistoryPosition DeliveredRanges::runStart(HistoryPosition position) const {
+        auto it = _ranges.upper_bound(position);
+        if (it != _ranges.begin() && position <= std::prev(it)->second) {
+            return std::prev(it)->first;
+        }
+        return position;
+    }
+
+    std::optional<HistoryPosition> DeliveredRanges::dropThrough(HistoryPosition position) {
+        std::optional<HistoryPosition> top;
+        auto it = _ranges.begin();
+        while (it != _ranges.end() && it->first <= position) {
+            if (it->second > position) {
+                top = it->second;
+            }
+            it = _ranges.erase(it);
+        }
+        return top;
+    }
+
+    namespace {
+        // ranges at or below `synced` are implied by it; one reaching past it moves it up, possibly past the walk
+        void compact(HistorySyncState &state) {
+            if (!state.synced.has_value()) {
+                return;
+            }
+            if (auto top = state.delivered.dropThrough(state.synced.value())) {
+                state.synced = top;
+            }
+            if (state.walkUpper.has_value() && state.walkUpper <= state.synced) {
+                state.walkUpper = std::nullopt;
+                state.resumeToken = std::nullopt;
+            }
+        }
+    }
+
+    HistorySync::HistorySync(AsyncClientWrapper &client, cppcoro::async_scope &scope, std::string id,
+                             HistorySyncState &state, uint32_t pageSize, uint32_t pageBudget)
+            : _client(client), _scope(scope), _id(std::move(id)), _state(state), _pageSize(pageSize),
+              _pageBudget(pageBudget) {}
+
+    PooledTask<MessagePage> HistorySync::fetch(AsyncClientWrapper &client, std::string id, MessagePageQuery query) {
+        // everything the RPC refers to lives in this frame, which may outlive the HistorySync while prefetching
+        co_return co_await client.getMessagePage(id, query);
+    }
+
+    std::optional<MessagePageQuery> HistorySync::nextQuery() const {
+        MessagePageQuery query{_state.synced, std::nullopt, std::nullopt, _pageSize};
+        if (!_state.walkUpper.has_value()) {
+            return query;  // a new walk starts at the newest message
+        }
+        // continue below the delivered run the walk is in; the token (when still valid) says the same to the proxy
+        query.before = _state.delivered.runStart(_state.walkUpper.value());
+        query.pageToken = _state.resumeToken;
+        if (_state.synced.has_value() && query.before.value() <= _state.synced.value()) {
+            return std::nullopt;
+        }
+        return query;
+    }
+
+    void HistorySync::complete() {
+        _done = true;
+        if (_state.walkUpper.has_value() && (!_state.synced.has_value() || _state.walkUpper > _state.synced)) {
+            _state.synced = _state.walkUpper;
+        }
+        _state.walkUpper = std::nullopt;
+        _state.resumeToken = std::nullopt;
+        compact(_state);
+    }
+
+    PooledTask<std::optional<std::vector<Message>>> HistorySync::next() {
+        if (_done || (!_prefetch.has_value() && _fetched >= _pageBudget)) {
+            co_return std::nullopt;
+        }
+        MessagePage page;
+        std::optional<HistoryPosition> before;
+        if (_prefetch.has_value()) {
+            before = _prefetchBefore;
+            page = co_await _prefetch->get();
+            _prefetch.reset();
+        } else {
+            auto query = nextQuery();
+            if (!query.has_value()) {
+                complete();  // another poll on this state delivered the rest
+                co_return std::nullopt;
+            }
+            ++_fetched;
+            before = query->before;
+            page = co_await fetch(_client, _id, std::move(query.value()));
+        }
+        if (!page.ok) {
+            _done = true;
+            co_return std::nullopt;
+        }
+        if (page.messages.empty()) {
+            // reached `synced` (or the beginning of the conversation): the whole range has been delivered
+            complete();
+            co_return std::nullopt;
+        }
+
+        std::vector<Message> fresh;
+        fresh.reserve(page.messages.size());
+        for (auto &msg: page.messages) {
+            if (!_state.isDelivered(msg.position())) {
+                fresh.push_back(std::move(msg));
+            }
+        }
+        // the page covers everything from its oldest message up to the bound it was requested with
+        auto lo = page.messages.front().position();
+        auto hi = before.value_or(page.messages.back().position());
+        if (!_state.walkUpper.has_value()) {
+            _state.walkUpper = page.messages.back().position();  // first page of a new walk holds the newest message
+        }
+        _state.delivered.insert(lo, hi);
+        compact(_state);
+
+        if (!page.nextPageToken.has_value() || !_state.walkUpper.has_value()) {
+            complete();
+        } else {
+            // once something below this page has been delivered, the token would fetch it again: page by position
+            bool contiguous = _state.delivered.runStart(_state.walkUpper.value()) == lo;
+            _state.resumeToken = contiguous ? page.nextPageToken : std::nullopt;
+            if (_fetched < _pageBudget) {
+                if (auto query = nextQuery()) {
+                    ++_fetched;
+                    _prefetchBefore = query->before;
+                    _prefetch.emplace(_scope, fetch(_client, _id, std::move(query.value())));
+                } else {
+                    complete();
+                }
+            }
+        }
+        co_return fresh;
+    }
+} // SteamClient
@@ -0,0 +1,108 @@
+#ifndef PIDGIN_STEAM_HISTORY_SYNC_H
+#define PIDGIN_STEAM_HISTORY_SYNC_H
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include "coro_utils.h"
+#include "grpc_client_wrapper.h"
+#include "grpc_client_wrapper_async.h"
+
+namespace SteamClient {
+    /*
+     * Closed ranges of positions whose messages have all been delivered. Overlapping or touching ranges are merged on
+     * insertion, so the set stays small and every lookup is a single O(log n) search.
+     */
+    class DeliveredRanges {
+    public:
+        void insert(HistoryPosition lo, HistoryPosition hi);
+
+        [[nodiscard]] bool contains(HistoryPosition position) const;
+
+        // lowest position of the range containing `position`, or `position` itself if it is not delivered
+        [[nodiscard]] HistoryPosition runStart(HistoryPosition position) const;
+
+        // forgets everything at or below `position`; returns the top of a range that reached past it, if any
+        std::optional<HistoryPosition> dropThrough(HistoryPosition position);
+
+        [[nodiscard]] const std::map<HistoryPosition, HistoryPosition> &ranges() const {
+            return _ranges;
+        }
+
+        bool operator==(const DeliveredRanges &) const = default;
+
+    private:
+        std::map<HistoryPosition, HistoryPosition> _ranges;  // lo -> hi
+    };
+
+    /*
+     * Where the catch-up of one conversation stands; persisted by the caller after each page it has processed.
+     * The proxy pages newest first, so a catch-up walks backwards from the newest message to `synced`. Until the
+     * walk reaches it, `synced` stays put and `walkUpper`/`resumeToken` say where an interrupted walk continues.
+     * `delivered` covers what has been delivered above `synced`, so that overlapping or retried polls never hand out
+     * a message twice and a walk skips the spans it already has.
+     */
+    struct HistorySyncState {
+        std::optional<HistoryPosition> synced;  // everything up to and including this position has been delivered
+        std::optional<HistoryPosition> walkUpper;  // newest message of the walk in progress
+        std::optional<std::string> resumeToken;  // page token of the next page of the walk in progress
+        DeliveredRanges delivered;
+
+        [[nodiscard]] bool isDelivered(HistoryPosition position) const {
+            return (synced.has_value() && position <= synced.value()) || delivered.contains(position);
+        }
+
+        bool operator==(const HistorySyncState &) const = default;
+    };
+
+    /*
+     * Exact, resumable catch-up of one conversation over paged PollChatMessages. Each `next()` returns the next page
+     * (chronological within the page, pages going back in time) without the messages that were already delivered,
+     * and already has the following page in flight, so processing a page overlaps with fetching the next one. At
+     * most `pageBudget` pages are fetched, and nothing is left in flight past the last one; a walk that does not fit
+     * continues from the state in a new HistorySync.
+     *
+     * The state is updated in place and must outlive the HistorySync. Several HistorySyncs may share one state (e.g.
+     * a poll that overlaps the previous one); each message is still returned by only one of them.
+     *
+     * The prefetch runs in `scope`, so a HistorySync dropped mid-walk leaves no RPC behind that outlives it: the
+     * client must stay alive until `scope` is joined (the account's scope, joined before the client is deleted).
+     */
+    class HistorySync {
+    public:
+        HistorySync(AsyncClientWrapper &client, cppcoro::async_scope &scope, std::string id, HistorySyncState &state,
+                    uint32_t pageSize = 200, uint32_t pageBudget = UINT32_MAX);
+
+        // nullopt once the walk is complete (the state is then advanced), when the page budget is used up, or when a
+        // page could not be fetched (the state is left at the last good page, so a new HistorySync resumes there)
+        PooledTask<std::optional<std::vector<Message>>> next();
+
+        [[nodiscard]] const HistorySyncState &state() const {
+            return _state;
+        }
+
+    private:
+        static PooledTask<MessagePage> fetch(AsyncClientWrapper &client, std::string id, MessagePageQuery query);
+
+        // the page below what the walk has delivered so far, or nullopt if nothing is left between it and `synced`
+        [[nodiscard]] std::optional<MessagePageQuery> nextQuery() const;
+
+        // the walk has reached `synced`: everything up to `walkUpper` has been delivered
+        void complete();
+
+        AsyncClientWrapper &_client;
+        cppcoro::async_scope &_scope;
+        std::string _id;
+        HistorySyncState &_state;
+        uint32_t _pageSize;
+        uint32_t _pageBudget;
+        uint32_t _fetched = 0;
+        std::optional<Prefetched<MessagePage>> _prefetch;
+        std::optional<HistoryPosition> _prefetchBefore;  // upper bound of the prefetched page
+        bool _done = false;
+    };
+} // SteamClient
+
+#endif //PIDGIN_STEAM_HISTORY_SYNC_H
@@ -1,8 +1,12 @@
 // From https://github.com/EionRobb/pidgin-opensteamworks/blob/master/steam-mobile/libsteam.c
 #include "libdummy.h"
+#include "account_snapshot.h"
+#include "coro_utils.h"
+#include "markup.h"
 #include "cppcoro/task.hpp"
 #include "cppcoro/sync_wait.hpp"
 #include "cppcoro/when_all.hpp"
+#include "cppcoro/operation_cancelled.hpp"
 #include <stdexcept>
 #include <json/value.h>
 #include <json/reader.h>
@@ -11,39 +15,185 @@
 
 
 static constexpr bool core_is_haze = false;
+static constexpr auto ack_debounce = std::chrono::seconds(2);
+static constexpr auto send_retry_initial_backoff = std::chrono::milliseconds(500);
+static constexpr auto send_retry_max_backoff = std::chrono::seconds(8);
+static constexpr int send_max_attempts = 5;
+static constexpr auto send_retry_later = std::chrono::seconds(60);  // after send_max_attempts failed in a row
+static constexpr uint32_t history_page_size = 50;
+static constexpr uint32_t history_pages_per_tick = 2;  // per conversation; longer catch-ups resume on the next tick
+static constexpr auto render_slice_budget = std::chrono::milliseconds(8);  // UI time per slice of a large backlog
+static constexpr auto render_slice_pause = std::chrono::milliseconds(20);  // lets the main loop redraw in between
+static constexpr size_t render_collapse_threshold = 200;
+static constexpr size_t render_collapse_tail = 50;  // newest messages still written when a backlog is collapsed
+static constexpr const char *default_proxy_address = "localhost:8080";
+static constexpr gssize avatar_max_bytes = 512 * 1024;
+static constexpr uint64_t avatar_cache_max_bytes = 32 * 1024 * 1024;
+static constexpr size_t chat_backlog_limit = 2000;  // unwritten messages per chat room before the oldest are dropped
+static constexpr auto chat_watch_initial_backoff = std::chrono::seconds(1);
+static constexpr auto chat_watch_max_backoff = std::chrono::seconds(30);
+static constexpr size_t search_result_limit = 50;
+
+static constexpr guint preconnect_lifetime_s = 30;
+
+/*
+ * Client created in plugin_load so that the channel is up by the time auto-login runs steam_login. Protocol plugins
+ * are loaded while plugins are probed, before the accounts are, so it is made for the default proxy address and
+ * channel profile; an account with other settings builds its own. Dropped if nobody takes it within
+ * preconnect_lifetime_s.
+ */
+struct PreconnectedClient {
+    std::string proxyAddress;
+    std::string profileName;
+    std::unique_ptr<SteamClient::AsyncClientWrapper> client;
+};
+static std::optional<PreconnectedClient> preconnected_client;
+static guint preconnect_timer_id;
+
+std::unique_ptr<SteamClient::AsyncClientWrapper> make_client(const char *proxyAddress, const char *profileName) {
+    std::vector<std::string> proxyAddresses;
+    gchar **addressList = g_strsplit(proxyAddress, ",", -1);
+    for (gchar **address = addressList; *address != nullptr; ++address) {
+        if (*g_strstrip(*address) != '\0') {
+            proxyAddresses.emplace_back(*address);
+        }
+    }
+    g_strfreev(addressList);
+    if (proxyAddresses.empty()) {
+        proxyAddresses.emplace_back(default_proxy_address);
+    }
+    auto channelOptions = SteamClient::channelProfile(profileName);
+    if (!channelOptions.has_value()) {
+        purple_debug_warning("dummy", "make_client unknown channel profile %s, using default\n", profileName);
+        channelOptions = SteamClient::channelProfile("default");
+    }
+    purple_debug_info("dummy", "make_client proxy %s (profile %s)\n", proxyAddress, profileName);
+    auto client = std::make_unique<SteamClient::AsyncClientWrapper>(proxyAddresses, channelOptions.value());
+    client->preconnect();
+    return client;
+}
 
 
-bool read_last_timestamps(SteamAccount &sa) {
-    // Read as JSON mapping of string SteamIDs to int timestamps
-    auto rawMappings = purple_account_get_string(sa.account, "last_message_timestamps", nullptr);
+Json::Value position_to_json(const SteamClient::HistoryPosition &position) {
+    Json::Value value;
+    value["ts"] = (Json::Int64) position.timestampNs;
+    value["ord"] = position.ordinal;
+    return value;
+}
+
+SteamClient::HistoryPosition position_from_json(const Json::Value &value) {
+    return {value["ts"].asInt64(), value["ord"].asUInt()};
+}
+
+bool read_history_sync(SteamAccount &sa) {
+    // JSON mapping of string SteamIDs to {"synced": position, "walkUpper": position, "resumeToken": string,
+    // "delivered": [[lo, hi], ...]}
+    auto rawMappings = purple_account_get_string(sa.account, "history_sync", nullptr);
     if (rawMappings == nullptr) {
-        return false;
+        // older versions kept one timestamp per buddy: everything before it had been fetched
+        rawMappings = purple_account_get_string(sa.account, "last_message_timestamps", nullptr);
+        if (rawMappings == nullptr) {
+            return false;
+        }
+        purple_debug_info("dummy", "steam_login migrating last_message_timestamps %s\n", rawMappings);
+        Json::Value root;
+        Json::Reader reader;
+        if (reader.parse(rawMappings, root)) {
+            for (auto &x: root.getMemberNames()) {
+                sa.historySync[x].synced = SteamClient::HistoryPosition{root[x].asInt64() - 1, UINT32_MAX};
+            }
+        }
+        return true;
     }
 
-    purple_debug_info("dummy", "steam_login read last_message_timestamps %s\n", rawMappings);
+    purple_debug_info("dummy", "steam_login read history_sync %s\n", rawMappings);
     Json::Value root;
     Json::Reader reader;
     if (!reader.parse(rawMappings, root)) {
-        purple_debug_info("dummy", "steam_login failed to parse last_message_timestamps\n");
+        purple_debug_info("dummy", "steam_login failed to parse history_sync\n");
     } else {
         for (auto &x: root.getMemberNames()) {
-            sa.lastMessageTimestamps[x] = root[x].asInt64();
+            auto &entry = root[x];
+            auto &state = sa.historySync[x];
+            if (entry.isMember("synced")) {
+                state.synced = position_from_json(entry["synced"]);
+            }
+            if (entry.isMember("walkUpper")) {
+                state.walkUpper = position_from_json(entry["walkUpper"]);
+            }
+            if (entry.isMember("resumeToken")) {
+                state.resumeToken = entry["resumeToken"].asString();
+            }
+            for (auto &range: entry["delivered"]) {
+                state.delivered.insert(position_from_json(range[0]), position_from_json(range[1]));
+            }
         }
     }
     return true;
 }
 
-void write_last_timestamps(SteamAccount &sa) {
-    // Write as JSON mapping of string SteamIDs to int timestamps
-    Json::Value root;
-    for (auto &x: sa.lastMessageTimestamps) {
-        root[x.first] = x.second;
+void write_history_sync(SteamAccount &sa) {
+    Json::Value root(Json::objectValue);
+    for (auto &[id, state]: sa.historySync) {
+        Json::Value entry(Json::objectValue);
+        if (state.synced.has_value()) {
+            entry["synced"] = position_to_json(state.synced.value());
+        }
+        if (state.walkUpper.has_value()) {
+            entry["walkUpper"] = position_to_json(state.walkUpper.value());
+        }
+        if (state.resumeToken.has_value()) {
+            entry["resumeToken"] = state.resumeToken.value();
+        }
+        for (auto &[lo, hi]: state.delivered.ranges()) {
+            Json::Value range(Json::arrayValue);
+            range.append(position_to_json(lo));
+            range.append(position_to_json(hi));
+            entry["delivered"].append(range);
+        }
+        root[id] = entry;
     }
     Json::StreamWriterBuilder builder;
     builder["indentation"] = "";
     std::string rawMappings = Json::writeString(builder, root);
-    purple_debug_info("dummy", "steam_login write last_message_timestamps %s\n", rawMappings.c_str());
-    purple_account_set_string(sa.account, "last_message_timestamps", rawMappings.c_str());
+    purple_debug_info("dummy", "steam_login write history_sync %s\n", rawMappings.c_str());
+    purple_account_set_string(sa.account, "history_sync", rawMappings.c_str());
+}
+
+std::string snapshot_path(PurpleAccount *account) {
+    gchar *dir = g_build_filename(purple_user_dir(), "steam", nullptr);
+    purple_build_dir(dir, 0700);
+    gchar *escaped = g_strdup(purple_escape_filename(purple_account_get_username(account)));
+    gchar *path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s.snapshot", dir, escaped);
+    std::string result(path);
+    g_free(path);
+    g_free(escaped);
+    g_free(dir);
+    return result;
+}
+
+std::string message_index_dir(PurpleAccount *account) {
+    gchar *dir = g_build_filename(purple_user_dir(), "steam", nullptr);
+    purple_build_dir(dir, 0700);
+    gchar *escaped = g_strdup(purple_escape_filename(purple_account_get_username(account)));
+    gchar *path = g_strdup_printf("%s" G_DIR_SEPARATOR_S "%s.search", dir, escaped);
+    std::string result(path);
+    g_free(path);
+    g_free(escaped);
+    g_free(dir);
+    return result;
+}
+
+void save_snapshot(SteamAccount &sa, const SteamClient::FriendsList &friendsList) {
+    auto payload = SteamClient::encode_snapshot(friendsList);
+    if (payload == sa.lastSnapshot) {
+        return;
+    }
+    if (!SteamClient::write_snapshot(snapshot_path(sa.account), payload)) {
+        purple_debug_warning("dummy", "save_snapshot failed to write snapshot\n");
+        return;
+    }
+    sa.lastSnapshot = std::move(payload);
 }
 
 static const char *steam_list_icon(PurpleAccount *account, PurpleBuddy *buddy) {
@@ -64,12 +214,35 @@ static gchar *steam_status_text(PurpleBuddy *buddy) {
     return nullptr;
 }
 
+PooledTask<void> flush_acks(SteamAccount &sa);  // defined with the rest of the read acknowledgements below
+
 static void steam_close(PurpleConnection *pc) {
     purple_debug_info("dummy", "steam_close start\n");
     auto *sa = static_cast<SteamAccount *>(pc->proto_data);
 
+    sa->scope.spawn(flush_acks(*sa));
     sa->cancelTokenSource.request_cancellation();
+    sa->client->cancelRetries();  // scope.join() below would otherwise wait out every retry backoff
     purple_timeout_remove(sa->poll_callback_id);
+    for (auto &[hash, fetch]: sa->avatarFetches) {
+        if (fetch.request != nullptr) {
+            purple_util_fetch_url_cancel(fetch.request);
+        }
+    }
+    sa->avatarFetches.clear();
+    for (auto &[id, room]: sa->chatRooms) {
+        room.cancel.request_cancellation();
+    }
+    if (sa->messageIndex != nullptr) {
+        sa->messageIndex->flush();
+    }
+
+    // SteamBuddy objects live entirely in sa->buddyResource, which is released in bulk with the account below,
+    // so only detach them here instead of destroying them one by one
+    for (GSList *buddies = purple_find_buddies(sa->account, nullptr); buddies != nullptr;
+         buddies = g_slist_delete_link(buddies, buddies)) {
+        static_cast<PurpleBuddy *>(buddies->data)->proto_data = nullptr;
+    }
 
     std::thread([=]() {
         std::atomic<bool> done = false;
@@ -80,7 +253,7 @@ static void steam_close(PurpleConnection *pc) {
             }
         });
         cppcoro::sync_wait(sa->scope.join());  // TODO: check if this deadlocks
-        sa->client.shutdown();  // TODO: still see "ASSERTION FAILED: grpc_cq_begin_op(cq_, notify_tag)" sometimes
+        sa->client->shutdown();  // TODO: still see "ASSERTION FAILED: grpc_cq_begin_op(cq_, notify_tag)" sometimes
         done = true;
         pump_thread.join();
         sa->ioService.stop();
@@ -118,10 +291,23 @@ static const gchar *steam_personastate_to_statustype(gint64 state) {
     return status_id;
 }
 
+SteamBuddy *new_steam_buddy(SteamAccount &sa, PurpleBuddy *buddy, const SteamClient::Buddy &x) {
+    std::pmr::polymorphic_allocator<> alloc(&sa.buddyResource);
+    return alloc.new_object<SteamBuddy>(&sa, buddy, x.id.str(), x.nickname);
+}
+
+void delete_steam_buddy(SteamBuddy *steamBuddy) {
+    steamBuddy->get_allocator().delete_object(steamBuddy);
+}
+
 void add_buddy(SteamAccount &sa, const SteamClient::Buddy &x) {
-    purple_debug_info("dummy", "receive_messages %s add buddy %s\n", sa.account->username, x.id.c_str());
-    auto buddy = purple_buddy_new(sa.account, x.id.c_str(), nullptr);
-    buddy->proto_data = new SteamBuddy{&sa, buddy, x.id, x.nickname, "", "", 0, "", 0};
+    if (sa.cancelToken.is_cancellation_requested()) {
+        return;  // closing: the SteamBuddy would outlive sa.buddyResource
+    }
+    auto id = x.id.str();
+    purple_debug_info("dummy", "receive_messages %s add buddy %s\n", sa.account->username, id.c_str());
+    auto buddy = purple_buddy_new(sa.account, id.c_str(), nullptr);
+    buddy->proto_data = new_steam_buddy(sa, buddy, x);
     purple_blist_add_buddy(buddy, nullptr, purple_find_group("Steam"), nullptr);
 }
 
@@ -131,116 +317,417 @@ SteamBuddy* getSteamBuddy(SteamAccount &sa, std::string id) {
     return steamBuddy;
 }
 
+std::string avatar_dir() {
+    gchar *dir = g_build_filename(purple_user_dir(), "steam", "avatars", nullptr);
+    purple_build_dir(dir, 0700);
+    std::string result(dir);
+    g_free(dir);
+    return result;
+}
+
+void set_buddy_icon(SteamAccount &sa, const std::string &id, std::string_view image, const std::string &hash) {
+    // libpurple takes ownership of the data and persists `hash` as the icon checksum
+    auto *data = g_malloc(image.size());
+    memcpy(data, image.data(), image.size());
+    purple_buddy_icons_set_for_user(sa.account, id.c_str(), data, image.size(), hash.c_str());
+}
+
+static void avatar_fetched(PurpleUtilFetchUrlData *urlData, gpointer userData, const gchar *data, gsize len,
+                           const gchar *errorMessage) {
+    auto *fetch = static_cast<AvatarFetch *>(userData);
+    SteamAccount &sa = *fetch->sa;
+    auto hash = fetch->hash;
+    auto node = sa.avatarFetches.extract(hash);
+    if (data == nullptr || len == 0) {
+        purple_debug_warning("dummy", "avatar_fetched %s failed: %s\n", hash.c_str(),
+                             errorMessage != nullptr ? errorMessage : "empty response");
+        return;
+    }
+    std::string_view image(data, len);
+    if (!sa.avatarCache->put(hash, image)) {
+        purple_debug_warning("dummy", "avatar_fetched %s could not be cached\n", hash.c_str());
+    }
+    for (auto &id: node.mapped().buddies) {
+        set_buddy_icon(sa, id, image, hash);
+    }
+}
+
+/*
+ * Brings the buddy icon up to date when the avatar hash differs from the checksum libpurple keeps with the icon, so
+ * unchanged avatars cost nothing, not even across restarts. The medium size is 64x64, what icon_spec asks for, so
+ * the image is used as is. Buddies sharing an avatar (e.g. the default one) share one download.
+ */
+void update_avatar(SteamAccount &sa, PurpleBuddy *purpleBuddy, const SteamClient::Buddy &friendInfo) {
+    const auto &url = friendInfo.avatarUrl.medium.empty() ? friendInfo.avatarUrl.icon : friendInfo.avatarUrl.medium;
+    if (url.empty() || sa.avatarCache == nullptr) {
+        return;
+    }
+    auto hash = SteamClient::avatar_hash(url);
+    if (g_strcmp0(purple_buddy_icons_get_checksum_for_user(purpleBuddy), hash.c_str()) == 0) {
+        return;
+    }
+    auto id = friendInfo.id.str();
+    if (auto cached = sa.avatarCache->get(hash)) {
+        set_buddy_icon(sa, id, cached.value(), hash);
+        return;
+    }
+
+    auto [it, inserted] = sa.avatarFetches.try_emplace(hash);
+    auto &fetch = it->second;
+    if (std::find(fetch.buddies.begin(), fetch.buddies.end(), id) == fetch.buddies.end()) {
+        fetch.buddies.push_back(id);
+    }
+    if (!inserted) {
+        return;
+    }
+    purple_debug_info("dummy", "update_avatar fetching %s for %s\n", url.c_str(), id.c_str());
+    fetch.sa = &sa;
+    fetch.hash = hash;
+    auto *request = purple_util_fetch_url_request_len(url.c_str(), TRUE, nullptr, TRUE, nullptr, FALSE,
+                                                      avatar_max_bytes, avatar_fetched, &fetch);
+    // a request that fails right away may already have run the callback, which removes the entry
+    if (auto found = sa.avatarFetches.find(hash); found != sa.avatarFetches.end()) {
+        if (request == nullptr) {
+            sa.avatarFetches.erase(found);
+        } else {
+            found->second.request = request;
+        }
+    }
+}
+
 void update_buddy_info(SteamAccount &sa, const SteamClient::Buddy &friendInfo) {
-    purple_debug_info("dummy", "receive_messages %s update buddy %s %s\n", sa.account->username, friendInfo.id.c_str(),
+    if (sa.cancelToken.is_cancellation_requested()) {
+        return;  // closing: steam_close has detached the buddies, whose SteamBuddy pool goes with the account
+    }
+    auto id = friendInfo.id.str();
+    purple_debug_info("dummy", "receive_messages %s update buddy %s %s\n", sa.account->username, id.c_str(),
                       friendInfo.nickname.c_str());
-    if (!purple_find_buddy(sa.account, friendInfo.id.c_str())) {
+    if (!purple_find_buddy(sa.account, id.c_str())) {
         add_buddy(sa, friendInfo);
     }
-    purple_serv_got_private_alias(sa.pc, friendInfo.id.c_str(), friendInfo.nickname.c_str());
-    purple_prpl_got_user_status(sa.account, friendInfo.id.c_str(),
+    purple_serv_got_private_alias(sa.pc, id.c_str(), friendInfo.nickname.c_str());
+    purple_prpl_got_user_status(sa.account, id.c_str(),
                                 steam_personastate_to_statustype(friendInfo.personaState), nullptr);
 
-    auto purpleBuddy = static_cast<PurpleBuddy *>(purple_find_buddy(sa.account, friendInfo.id.c_str()));
+    auto purpleBuddy = static_cast<PurpleBuddy *>(purple_find_buddy(sa.account, id.c_str()));
     if (purpleBuddy->proto_data == nullptr) {
-        purpleBuddy->proto_data = new SteamBuddy{
-                &sa, purpleBuddy, friendInfo.id, friendInfo.nickname, "", "", 0, "", 0};
+        purpleBuddy->proto_data = new_steam_buddy(sa, purpleBuddy, friendInfo);
     }
     auto steamBuddy = static_cast<SteamBuddy *>(purpleBuddy->proto_data);
     steamBuddy->gameextrainfo = friendInfo.gameExtraInfo;
     steamBuddy->gameid = friendInfo.gameid;
     steamBuddy->avatarUrl = friendInfo.avatarUrl.icon;
+    update_avatar(sa, purpleBuddy, friendInfo);
+
+    const char *alias = purple_buddy_get_local_buddy_alias(purpleBuddy);
+    sa.friendIndex.upsert(id, {friendInfo.nickname, alias != nullptr ? alias : ""}, true);
+}
+
+// warm start: show the last known buddy list right away; the first receive_messages tick brings it up to date
+bool restore_snapshot(SteamAccount &sa) {
+    auto snapshot = SteamClient::read_snapshot(snapshot_path(sa.account));
+    if (!snapshot.has_value()) {
+        purple_debug_info("dummy", "steam_login no snapshot\n");
+        return false;
+    }
+    purple_debug_info("dummy", "steam_login restoring %zu buddies from snapshot\n",
+                      snapshot->friends.buddies.size());
+    for (auto &friendInfo: snapshot->friends.buddies) {
+        update_buddy_info(sa, friendInfo);
+    }
+    sa.lastSnapshot = SteamClient::encode_snapshot(snapshot->friends);
+    return true;
 }
 
-void process_messages(SteamAccount &sa, const SteamClient::Buddy &me, SteamBuddy *steamBuddy, PurpleConversation *conv,
-                      const std::vector<SteamClient::Message> &messages,
-                      std::optional<int64_t> &newStartTimestampNs, std::optional<int64_t> &lastTimestampNs) {
+// collects a page for the conversation with `id`; written by render_incoming at the end of the tick
+void queue_messages(SteamAccount &sa, const std::string &id, SteamBuddy *steamBuddy,
+                    std::vector<SteamClient::Message> messages) {
+    auto &queue = sa.renderQueues[id];
+    auto &history = sa.history[id];
+    auto first = queue.incoming.size();
     for (auto &msg: messages) {
         purple_debug_info("dummy", "receive_messages received %s\n", msg.message.c_str());
-        gchar *html = purple_markup_escape_text(msg.message.c_str(), -1);
+        if (steamBuddy != nullptr && steamBuddy->msgBuffer.remove(msg.message, (time_t) (msg.timestamp_ns / 1000000000LL))) {
+            continue;  // echo of a message sent from here
+        }
+        history.oldestShown = std::min(msg.position(), history.oldestShown.value_or(msg.position()));
+        queue.incoming.push_back(std::move(msg));
+    }
+    if (sa.messageIndex != nullptr) {
+        // echoes were indexed as they were sent
+        sa.messageIndex->add_page(id, std::span(queue.incoming).subspan(first));
+    }
+}
+
+/*
+ * Writes the pending messages of the conversation with `id`, creating it only now that there is something to show.
+ * Every purple_conversation_write runs UI signals, logging and scrolling, so a large backlog is written in slices of
+ * render_slice_budget with the main loop running in between, instead of freezing the window until it is done.
+ */
+PooledTask<void> render_conversation(SteamAccount &sa, std::string id) {
+    auto &queue = sa.renderQueues[id];
+    auto conversation = SteamClient::SteamId::parse(id);
+    queue.draining = true;
+    while (!queue.pending.empty()) {
+        PurpleConversation *conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, id.c_str(), sa.account);
         if (conv == nullptr) {
-            conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, sa.account, msg.senderId.c_str());
-            purple_debug_info("dummy", "receive_messages make new conv %p\n", conv);
+            conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, sa.account, id.c_str());
+            purple_debug_info("dummy", "render_conversation make new conv %p\n", conv);
+        }
+        auto sliceEnd = std::chrono::steady_clock::now() + render_slice_budget;
+        std::string scratch;
+        do {
+            auto msg = std::move(queue.pending.front());
+            queue.pending.pop_front();
+            auto html = SteamClient::steam_to_html(msg.message, scratch);
+            purple_conversation_write(conv, msg.senderId.str().c_str(), html.data(),
+                                      msg.senderId == conversation ? PURPLE_MESSAGE_RECV : PURPLE_MESSAGE_SEND,
+                                      (time_t) (msg.timestamp_ns / 1000000000LL));
+        } while (!queue.pending.empty() && std::chrono::steady_clock::now() < sliceEnd);
+
+        if (!queue.pending.empty()) {
+            purple_debug_info("dummy", "render_conversation %s: %zu left\n", id.c_str(), queue.pending.size());
+            try {
+                co_await sa.ioService.schedule_after(render_slice_pause, sa.cancelToken);
+            } catch (const cppcoro::operation_cancelled &) {
+                break;  // closing: the conversations go away with the account
+            }
+        }
+    }
+    queue.draining = false;
+}
+
+// hands what this tick collected to render_conversation, oldest first
+void render_incoming(SteamAccount &sa) {
+    for (auto &[id, queue]: sa.renderQueues) {
+        if (queue.incoming.empty()) {
+            continue;
+        }
+        auto incoming = std::exchange(queue.incoming, {});
+        std::sort(incoming.begin(), incoming.end(), [](const SteamClient::Message &a, const SteamClient::Message &b) {
+            return a.position() < b.position();
+        });
+        if (sa.collapseBacklogs && incoming.size() > render_collapse_threshold) {
+            auto tail = incoming.end() - render_collapse_tail;
+            queue.collapsed.insert(queue.collapsed.end(), std::make_move_iterator(incoming.begin()),
+                                   std::make_move_iterator(tail));
+            incoming.erase(incoming.begin(), tail);
+
+            PurpleConversation *conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, id.c_str(),
+                                                                             sa.account);
+            if (conv == nullptr) {
+                conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, sa.account, id.c_str());
+            }
+            gchar *notice = g_strdup_printf(_("%zu earlier messages (type /expand to show them)"),
+                                            queue.collapsed.size());
+            purple_conversation_write(conv, nullptr, notice,
+                                      (PurpleMessageFlags) (PURPLE_MESSAGE_SYSTEM | PURPLE_MESSAGE_NO_LOG),
+                                      time(nullptr));
+            g_free(notice);
+        }
+        queue.pending.insert(queue.pending.end(), std::make_move_iterator(incoming.begin()),
+                             std::make_move_iterator(incoming.end()));
+        if (!queue.draining) {
+            sa.scope.spawn(render_conversation(sa, id));
         }
-        time_t mtime{msg.timestamp_ns / 1000000000LL};
-        if (!steamBuddy->msgBuffer.remove(msg.message, mtime)) {
-            purple_conversation_write(conv, msg.senderId.c_str(), html,
-                                      msg.senderId == me.id ? PURPLE_MESSAGE_SEND : PURPLE_MESSAGE_RECV,
-                                      mtime);
+    }
+}
+
+PooledTask<void> flush_acks(SteamAccount &sa) {
+    if (sa.pendingAcks.empty() || !sa.client->isSessionKeySet()) {
+        co_return;
+    }
+    auto acks = std::exchange(sa.pendingAcks, {});
+    purple_debug_info("dummy", "flush_acks %zu conversations\n", acks.size());
+    if (!co_await sa.client->ackFriendMessages(acks)) {
+        // keep them for the next flush, unless a newer ack has been queued in the meantime
+        for (auto &[id, timestampNs]: acks) {
+            auto &pending = sa.pendingAcks[id];
+            pending = std::max(pending, timestampNs);
         }
+    }
+}
 
-        purple_debug_info("dummy", "receive_messages done\n");
-        g_free(html);
+PooledTask<void> debounced_flush_acks(SteamAccount &sa) {
+    try {
+        co_await sa.ioService.schedule_after(ack_debounce, sa.cancelToken);
+    } catch (const cppcoro::operation_cancelled &) {
+        // closing: flush right away
+    }
+    sa.ackFlushScheduled = false;
+    co_await flush_acks(sa);
+}
 
-        auto ts = msg.timestamp_ns;
-        lastTimestampNs = std::min(ts, lastTimestampNs.value_or(ts));
-        newStartTimestampNs = std::max(ts, newStartTimestampNs.value_or(ts)) + 1;
+void queue_ack(SteamAccount &sa, const std::string &id, int64_t timestampNs) {
+    // acks are coalesced for ack_debounce after the first one is queued, keeping the newest timestamp per buddy
+    auto &pending = sa.pendingAcks[id];
+    pending = std::max(pending, timestampNs);
+    if (!sa.ackFlushScheduled) {
+        sa.ackFlushScheduled = true;
+        sa.scope.spawn(debounced_flush_acks(sa));
     }
 }
 
-cppcoro::task<std::optional<int64_t>> poll_friend_messages(
-        SteamAccount &sa, const SteamClient::Buddy &me, const SteamClient::Buddy &friendInfo) {
-    constexpr int max_iterations = 3;
-    auto otherId = friendInfo.id;
-    PurpleConversation *conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, otherId.c_str(), sa.account);
+// continues the catch-up of the conversation with `otherId` for up to history_pages_per_tick pages, updating its
+// sa.historySync entry in place; returns whether it moved. Messages already delivered are never returned again.
+PooledTask<bool> poll_friend_messages(SteamAccount &sa, std::string otherId) {
     SteamBuddy *steamBuddy = getSteamBuddy(sa, otherId);
+    auto &state = sa.historySync[otherId];
+    auto before = state;
 
-    std::optional<int64_t> lastTimestampNs, startTimestampNs;
-    std::optional<int64_t> newStartTimestampNs;
-    if (auto it = sa.lastMessageTimestamps.find(friendInfo.id); it != sa.lastMessageTimestamps.end()) {
-        newStartTimestampNs = startTimestampNs = it->second;
+    SteamClient::HistorySync sync(*sa.client, sa.scope, otherId, state, history_page_size,
+                                  history_pages_per_tick);
+    while (auto messages = co_await sync.next()) {
+        queue_messages(sa, otherId, steamBuddy, std::move(messages.value()));
     }
-    for (int i = 0; i < max_iterations; ++i) {
-        auto messages = co_await sa.client.getMessages(friendInfo.id, startTimestampNs, lastTimestampNs);
-        if (messages.empty()) {
-            break;
+    if (state.synced != before.synced && state.synced.has_value()) {
+        // acks keep their exclusive timestamp bound: everything before it has been read
+        queue_ack(sa, otherId, state.synced->timestampNs + 1);
+    }
+    co_return state != before;
+}
+
+/*
+ * Loads one page of history older than anything shown in the conversation with `id`, e.g. when it is opened or on
+ * /history. The newest (exclusive) bound is the oldest message already shown, but never past the sync position, so
+ * that the catch-up in poll_friend_messages and this backwards paging never overlap.
+ */
+PooledTask<void> load_history(SteamAccount &sa, std::string id) {
+    auto &history = sa.history[id];
+    if (history.loading || history.exhausted) {
+        co_return;
+    }
+    history.loading = true;
+    // let the caller (e.g. purple_conversation_new in render_conversation) write its first messages
+    co_await sa.ioService.schedule();
+
+    SteamClient::MessagePageQuery query;
+    query.before = history.oldestShown;
+    if (auto cursor = sa.historySync.find(id); cursor != sa.historySync.end() && cursor->second.synced.has_value()) {
+        // anything newer than `synced` belongs to the catch-up in poll_friend_messages, even while it is under way
+        auto pastSynced = cursor->second.synced.value();
+        if (pastSynced.ordinal != UINT32_MAX) {
+            ++pastSynced.ordinal;  // include the synced message itself
         }
-        process_messages(sa, me, steamBuddy, conv, messages, newStartTimestampNs, lastTimestampNs);
+        query.before = std::min(pastSynced, query.before.value_or(pastSynced));
+    }
+    purple_debug_info("dummy", "load_history %s before %" G_GINT64_FORMAT "\n", id.c_str(),
+                      query.before.has_value() ? query.before->timestampNs : -1);
+    auto page = co_await sa.client->getMessagePage(id, query);
+    history.loading = false;  // the entry is not erased while loading (see steam_deleting_conversation)
+    if (!page.ok) {
+        co_return;
     }
-    if (newStartTimestampNs.has_value()) {
-        co_await sa.client.ackFriendMessage(friendInfo.id, newStartTimestampNs.value());
+    history.exhausted = !page.nextPageToken.has_value();
+    auto &messages = page.messages;
+    if (messages.empty()) {
+        co_return;
+    }
+    if (sa.messageIndex != nullptr) {
+        sa.messageIndex->add_page(id, messages);
+    }
+    PurpleConversation *conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, id.c_str(), sa.account);
+    if (conv == nullptr) {
+        co_return;  // closed while loading
+    }
+    auto conversation = SteamClient::SteamId::parse(id);
+    std::string scratch;
+    for (auto &msg: messages) {
+        auto html = SteamClient::steam_to_html(msg.message, scratch);
+        auto flags = msg.senderId == conversation ? PURPLE_MESSAGE_RECV : PURPLE_MESSAGE_SEND;
+        purple_conversation_write(conv, msg.senderId.str().c_str(), html.data(),
+                                  (PurpleMessageFlags) (flags | PURPLE_MESSAGE_DELAYED | PURPLE_MESSAGE_NO_LOG),
+                                  (time_t) (msg.timestamp_ns / 1000000000LL));
+        history.oldestShown = std::min(msg.position(), history.oldestShown.value_or(msg.position()));
     }
-    co_return newStartTimestampNs;
 }
 
-cppcoro::task<void> receive_messages(SteamAccount &sa) {
-    auto [me, buddies] = co_await sa.client.getFriendsList();  // TODO: store in SteamAccount
-
-    auto [sessions, timestamp] = co_await sa.client.getActiveMessageSessions();
-    std::map<std::string, SteamClient::ActiveMessageSessions::Session> sessionsById;
+PooledTask<void> receive_messages(SteamAccount &sa) {
+    // independent reads: issue both at once so the tick waits for the slower one, not the sum
+    auto [friendsList, activeSessions] = co_await cppcoro::when_all(sa.client->getFriendsListView(),
+                                                                    sa.client->getActiveMessageSessions());
+    if (sa.cancelToken.is_cancellation_requested()) {
+        co_return;  // finished on steam_close's pump thread; the buddies are no longer ours to touch
+    }
+    auto &[sessions, timestamp] = activeSessions;
+    std::unordered_map<SteamClient::SteamId, SteamClient::ActiveMessageSessions::Session> sessionsById;
     for (auto &session: sessions) {
         sessionsById[session.id] = session;
     }
 
-    std::vector<cppcoro::task<std::optional<int64_t>>> tasks;
-    std::vector<std::string> taskInputs;
-    for (auto &friendInfo: buddies) {
-        update_buddy_info(sa, friendInfo);
-        auto it = sessionsById.find(friendInfo.id);
-        std::cout << "receive_messages check " << friendInfo.id << " " << friendInfo.nickname << ": "
+    struct PollCandidate {
+        std::string id;
+        bool conversationOpen;
+        int unreadMessageCount;
+        int64_t lastMessageTimestampNs;
+    };
+    // a response identical to the last one changes no buddy; otherwise only the personas whose encoding changed are
+    // decoded and applied
+    auto listHash = std::hash<std::string_view>{}(friendsList.bytes());
+    bool listChanged = friendsList.ok() && listHash != sa.friendsListHash;
+    std::vector<PollCandidate> candidates;
+    bool changed = false;
+    for (auto &persona: friendsList.friends()) {
+        auto steamId = persona.id();
+        auto id = steamId.str();
+        if (listChanged) {
+            auto personaHash = std::hash<std::string_view>{}(persona.bytes());
+            auto purpleBuddy = static_cast<PurpleBuddy *>(purple_find_buddy(sa.account, id.c_str()));
+            auto steamBuddy = purpleBuddy != nullptr ? static_cast<SteamBuddy *>(purpleBuddy->proto_data) : nullptr;
+            if (steamBuddy == nullptr || steamBuddy->personaHash != personaHash) {
+                update_buddy_info(sa, persona.to_buddy());
+                getSteamBuddy(sa, id)->personaHash = personaHash;
+            }
+        }
+        auto it = sessionsById.find(steamId);
+        auto cursor = sa.historySync.find(id);
+        bool synced = cursor != sa.historySync.end() && cursor->second.synced.has_value();
+        std::cout << "receive_messages check " << steamId << " " << persona.name() << ": "
                   << (it == sessionsById.end() ? "null" : std::to_string(it->second.lastMessageTimestampNs)) << " vs "
-                  << sa.lastMessageTimestamps[friendInfo.id] << std::endl;
+                  << (synced ? std::to_string(cursor->second.synced->timestampNs) : "null") << std::endl;
         if (it == sessionsById.end()) continue;
         auto session = it->second;
-        if (session.lastMessageTimestampNs > sa.lastMessageTimestamps[friendInfo.id]) {
-            tasks.push_back(poll_friend_messages(sa, me.value(), friendInfo));
-            taskInputs.push_back(friendInfo.id);
+        bool conversationOpen = purple_find_conversation_with_account(
+                PURPLE_CONV_TYPE_IM, id.c_str(), sa.account) != nullptr;
+        if (!synced) {
+            // first sight: only what has not been read yet; with nothing unread, no history until the conversation
+            // is opened (see load_history)
+            auto seenNs = session.unreadMessageCount > 0 ? session.lastViewedTimestampNs
+                                                         : session.lastMessageTimestampNs;
+            sa.historySync[id].synced = SteamClient::HistoryPosition{seenNs, UINT32_MAX};
+            changed = true;
+            if (session.unreadMessageCount == 0) {
+                continue;
+            }
+        }
+        auto &state = sa.historySync[id];
+        if (session.lastMessageTimestampNs > state.synced->timestampNs || state.walkUpper.has_value()) {
+            candidates.push_back({std::move(id), conversationOpen, session.unreadMessageCount,
+                                  session.lastMessageTimestampNs});
         }
     }
+    if (listChanged) {
+        sa.friendsListHash = listHash;
+        save_snapshot(sa, friendsList.to_friends_list());
+    }
 
-    bool changed = false;
-    auto res = co_await cppcoro::when_all(std::move(tasks));
-    for (int i = 0; i < res.size(); ++i) {
-        auto ts = res[i];
-        auto id = taskInputs[i];
-        if (ts.has_value()) {
-            changed = true;
-            sa.lastMessageTimestamps[id] = ts.value();
-        }
+    // Open conversations first, then the ones with the most unread messages
+    std::sort(candidates.begin(), candidates.end(), [](const PollCandidate &a, const PollCandidate &b) {
+        return std::make_tuple(a.conversationOpen, a.unreadMessageCount, a.lastMessageTimestampNs) >
+               std::make_tuple(b.conversationOpen, b.unreadMessageCount, b.lastMessageTimestampNs);
+    });
+
+    auto res = co_await when_all_bounded<bool>(
+            candidates.size(), sa.maxConcurrentPolls, [&](size_t i) {
+                return poll_friend_messages(sa, candidates[i].id);
+            });
+    for (bool moved: res) {
+        changed = changed || moved;
     }
+    render_incoming(sa);
 
     if (changed) {
-        write_last_timestamps(sa);
+        write_history_sync(sa);
     }
     co_return;
 }
@@ -256,37 +743,197 @@ gboolean step_io_service(PurpleConnection *pc) {
     return G_SOURCE_CONTINUE;
 }
 
-cppcoro::task<int> send_message(
-        PurpleConnection *pc, SteamAccount &sa, const std::string &who, const std::string &msg) {
-    purple_debug_info("dummy", "send_message with %s %s\n", who.c_str(), msg.c_str());
-    getSteamBuddy(sa, who)->msgBuffer.add(msg, time(nullptr));
+enum class SendOutcome {
+    SENT,
+    REJECTED,  // Steam refused the message; retrying will not help
+    RETRY,
+    STOP       // session is unusable; keep the message queued until the next login
+};
+
+// `previous` is the message sent just before in the same window: the proxy only delivers `out` once it has succeeded
+PooledTask<SendOutcome> send_message(PurpleConnection *pc, SteamAccount &sa, const std::string &who,
+                                     const OutgoingMessage &out, const OutgoingMessage *previous) {
+    purple_debug_info("dummy", "send_message with %s %s (attempt %d)\n", who.c_str(), out.message.c_str(),
+                      out.attempts + 1);
 
-    // TODO: better error handling
-    switch (co_await sa.client.sendMessage(who, msg)) {
+    auto afterKey = previous != nullptr ? std::optional(previous->idempotencyKey) : std::nullopt;
+    switch (co_await sa.client->sendMessage(who, out.message, out.idempotencyKey, afterKey)) {
         case SteamClient::SEND_SUCCESS:
-            co_return 0;
+            co_return SendOutcome::SENT;
         case SteamClient::SEND_INVALID_SESSION_KEY:
             purple_notify_warning(pc, "Session Issue", "Session Issue",
                                   "There seems to be an issue with your current session. Please log out and log back in again.");
             purple_connection_error_reason(pc, PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
                                            "Invalid session key");
-            co_return -ENOTCONN;
+            co_return SendOutcome::STOP;
         case SteamClient::SEND_INVALID_TARGET_ID:
             purple_debug_warning("dummy", "send_message invalid target ID %s\n", who.c_str());
-            // purple_connection_error_reason(pc, PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
-            //                                "Invalid target ID");
-            co_return -1;
+            purple_conv_present_error(who.c_str(), sa.account, "Message could not be sent: invalid recipient");
+            co_return SendOutcome::REJECTED;
         case SteamClient::SEND_INVALID_MESSAGE:
-            purple_debug_warning("dummy", "send_message invalid message %s\n", msg.c_str());
-            // purple_connection_error_reason(pc, PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
-            //                                "Invalid message");
-            co_return -2;
+            purple_debug_warning("dummy", "send_message invalid message %s\n", out.message.c_str());
+            purple_conv_present_error(who.c_str(), sa.account, "Message could not be sent: rejected by Steam");
+            co_return SendOutcome::REJECTED;
         case SteamClient::SEND_UNKNOWN_FAILURE:
-            purple_notify_warning(pc, "Session Issue", "Session Issue",
-                                  "There seems to be an issue with your current session. Please log out and log back in again.");
-            purple_connection_error_reason(pc, PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
-                                           "Unknown error");
-            co_return -3;
+        case SteamClient::SEND_RPC_FAILURE:
+            co_return SendOutcome::RETRY;
+    }
+    co_return SendOutcome::RETRY;
+}
+
+void write_pending_messages(SteamAccount &sa) {
+    // Write as JSON mapping of string SteamIDs to lists of unsent messages
+    Json::Value root(Json::objectValue);
+    for (auto &[who, queue]: sa.sendQueues) {
+        for (auto &out: queue.pending) {
+            Json::Value entry;
+            entry["key"] = out.idempotencyKey;
+            entry["message"] = out.message;
+            root[who].append(entry);
+        }
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    purple_account_set_string(sa.account, "pending_messages", Json::writeString(builder, root).c_str());
+}
+
+bool read_pending_messages(SteamAccount &sa) {
+    auto rawMessages = purple_account_get_string(sa.account, "pending_messages", nullptr);
+    if (rawMessages == nullptr) {
+        return false;
+    }
+
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(rawMessages, root)) {
+        purple_debug_info("dummy", "steam_login failed to parse pending_messages\n");
+        return false;
+    }
+    for (auto &who: root.getMemberNames()) {
+        for (auto &entry: root[who]) {
+            sa.sendQueues[who].pending.push_back({entry["key"].asString(), entry["message"].asString()});
+        }
+    }
+    return true;
+}
+
+PooledTask<void> drain_send_queue(PurpleConnection *pc, SteamAccount &sa, std::string who);
+
+// drains the queue again once send_retry_later has passed, unless the account closes first
+PooledTask<void> retry_send_queue_later(PurpleConnection *pc, SteamAccount &sa, std::string who) {
+    bool cancelled = false;
+    try {
+        co_await sa.ioService.schedule_after(send_retry_later, sa.cancelToken);
+    } catch (const cppcoro::operation_cancelled &) {
+        cancelled = true;
+    }
+    if (!cancelled) {
+        co_await drain_send_queue(pc, sa, std::move(who));
+    }
+}
+
+PooledTask<void> drain_send_queue(PurpleConnection *pc, SteamAccount &sa, std::string who) {
+    auto &queue = sa.sendQueues[who];
+    if (queue.draining) {
+        co_return;
+    }
+    queue.draining = true;
+    for (auto &out: queue.pending) {
+        out.attempts = 0;
+    }
+
+    auto backoff = send_retry_initial_backoff;
+    while (!queue.pending.empty() && sa.client->isSessionKeySet() && !sa.cancelToken.is_cancellation_requested()) {
+        if (!sa.client->isConnected() && !co_await sa.client->waitForConnected(sa.cancelToken)) {
+            break;
+        }
+        // Pipeline the oldest messages. Each names its predecessor in the window, so the proxy refuses it unless that
+        // one went through: a failure fails the rest of the window instead of letting it overtake.
+        auto window = std::min(sa.maxInFlightSends, queue.pending.size());
+        auto outcomes = co_await when_all_bounded<SendOutcome>(window, window, [&](size_t i) {
+            return send_message(pc, sa, who, queue.pending[i], i > 0 ? &queue.pending[i - 1] : nullptr);
+        });
+
+        bool retry = false, stop = false;
+        std::deque<OutgoingMessage> unsent;
+        for (size_t i = 0; i < window; ++i) {
+            auto &out = queue.pending[i];
+            if (!unsent.empty() && outcomes[i] == SendOutcome::SENT) {
+                // behind a failure (e.g. delivered, but the response was lost): resent in order under its
+                // idempotency key, which the proxy answers without sending it again
+                unsent.push_back(std::move(out));
+                continue;
+            }
+            switch (outcomes[i]) {
+                case SendOutcome::SENT:
+                    queue.failureShown = false;
+                    if (sa.messageIndex != nullptr) {
+                        sa.messageIndex->add_sent(who, out.message, g_get_real_time() * 1000);
+                    }
+                    break;
+                case SendOutcome::REJECTED:
+                    break;
+                case SendOutcome::RETRY:
+                    if (sa.client->isConnected()) {  // failures during an outage do not count against the message
+                        ++out.attempts;
+                    }
+                    retry = true;
+                    unsent.push_back(std::move(out));
+                    break;
+                case SendOutcome::STOP:
+                    stop = true;
+                    unsent.push_back(std::move(out));
+                    break;
+            }
+        }
+        queue.pending.erase(queue.pending.begin(), queue.pending.begin() + (ptrdiff_t) window);
+        queue.pending.insert(queue.pending.begin(), std::make_move_iterator(unsent.begin()),
+                             std::make_move_iterator(unsent.end()));
+        write_pending_messages(sa);
+
+        if (stop) {
+            break;
+        }
+        if (!retry || !sa.client->isConnected()) {
+            backoff = send_retry_initial_backoff;
+            continue;
+        }
+        if (queue.pending.front().attempts >= send_max_attempts) {
+            purple_debug_warning("dummy", "drain_send_queue %s giving up for now, %zu messages queued\n",
+                                 who.c_str(), queue.pending.size());
+            if (!queue.failureShown) {
+                queue.failureShown = true;
+                purple_conv_present_error(who.c_str(), sa.account,
+                                          "Message not sent yet: Steam keeps failing to accept it. It stays queued "
+                                          "and is retried every minute.");
+            }
+            sa.scope.spawn(retry_send_queue_later(pc, sa, who));
+            break;
+        }
+        bool cancelled = false;
+        try {
+            co_await sa.ioService.schedule_after(backoff, sa.cancelToken);
+        } catch (const cppcoro::operation_cancelled &) {
+            cancelled = true;
+        }
+        if (cancelled) {
+            break;
+        }
+        backoff = std::min(backoff * 2, send_retry_max_backoff);
+    }
+
+    queue.draining = false;
+    if (queue.pending.empty()) {
+        sa.sendQueues.erase(who);
+    }
+}
+
+void flush_send_queues(PurpleConnection *pc, SteamAccount &sa) {
+    for (auto &[who, queue]: sa.sendQueues) {
+        if (!queue.pending.empty()) {
+            purple_debug_info("dummy", "flush_send_queues %s: %zu messages\n", who.c_str(), queue.pending.size());
+            sa.scope.spawn(drain_send_queue(pc, sa, who));
+        }
     }
 }
 
@@ -294,13 +941,390 @@ static gint steam_send_im(PurpleConnection *pc, const gchar *who, const gchar *m
                           PurpleMessageFlags flags) {
     purple_debug_info("dummy", "steam_send_im start\n");
     SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
-    sa.scope.spawn(send_message(pc, sa, std::string{who}, std::string{msg}));
+    std::string scratch;
+    std::string text(SteamClient::html_to_steam(msg, scratch));  // what Steam stores, and so what polls echo back
+    if (auto *purpleBuddy = purple_find_buddy(sa.account, who); purpleBuddy && purpleBuddy->proto_data) {
+        static_cast<SteamBuddy *>(purpleBuddy->proto_data)->msgBuffer.add(text, time(nullptr));
+    }
+
+    gchar *idempotencyKey = g_uuid_string_random();
+    sa.sendQueues[who].pending.push_back({idempotencyKey, text});
+    g_free(idempotencyKey);
+    write_pending_messages(sa);
+
+    sa.scope.spawn(drain_send_queue(pc, sa, who));
     return 1;
 }
 
+// name shown for member `id` in the user list: the Steam name, unless another member already shows under it
+std::string shown_name(const ChatRoomState &room, const std::string &id, const std::string &name) {
+    if (name.empty()) {
+        return id;
+    }
+    if (auto owner = room.shownNames.find(name); owner != room.shownNames.end() && owner->second != id) {
+        return name + " (" + id + ")";
+    }
+    return name;
+}
+
+/*
+ * Applies the member changes received since the last call with one purple_conv_chat_remove_users and one
+ * purple_conv_chat_add_users call. Each call updates the UI's user list once, whereas adding the members of a large
+ * room one at a time re-sorts and redraws the list for every one of them.
+ */
+void apply_member_changes(SteamAccount &sa, ChatRoomState &room, PurpleConvChat *chat) {
+    bool reset = std::exchange(room.pendingReset, false);
+    auto changes = std::exchange(room.pendingMembers, {});
+    if (reset) {
+        for (auto &[id, names]: room.members) {
+            changes.try_emplace(id, std::nullopt);
+        }
+    }
+    if (changes.empty()) {
+        return;
+    }
+
+    std::vector<std::string> removed;
+    for (auto &[id, member]: changes) {
+        if (auto it = room.members.find(id); !member.has_value() && it != room.members.end()) {
+            room.shownNames.erase(it->second.second);
+            removed.push_back(std::move(it->second.second));
+            room.members.erase(it);
+        }
+    }
+    std::vector<std::string> added;
+    for (auto &[id, member]: changes) {
+        if (!member.has_value()) {
+            continue;
+        }
+        sa.friendIndex.upsert(id, {member->name}, false);
+        auto it = room.members.find(id);
+        if (it == room.members.end()) {
+            auto shown = shown_name(room, id, member->name);
+            room.shownNames[shown] = id;
+            room.members.emplace(id, std::make_pair(member->name, shown));
+            added.push_back(std::move(shown));
+        } else if (it->second.first != member->name) {
+            room.shownNames.erase(it->second.second);
+            auto shown = shown_name(room, id, member->name);
+            room.shownNames[shown] = id;
+            purple_conv_chat_rename_user(chat, it->second.second.c_str(), shown.c_str());
+            it->second = {member->name, std::move(shown)};
+        }
+    }
+
+    if (!removed.empty()) {
+        GList *users = nullptr;
+        for (auto &name: removed) {
+            users = g_list_prepend(users, (gpointer) name.c_str());
+        }
+        purple_conv_chat_remove_users(chat, users, nullptr);
+        g_list_free(users);
+    }
+    if (!added.empty()) {
+        GList *users = nullptr, *flags = nullptr;
+        for (auto &name: added) {
+            users = g_list_prepend(users, (gpointer) name.c_str());
+            flags = g_list_prepend(flags, GINT_TO_POINTER(PURPLE_CBFLAGS_NONE));
+        }
+        // a reset lists who is there, it does not announce arrivals
+        purple_conv_chat_add_users(chat, users, nullptr, flags, !reset);
+        g_list_free(users);
+        g_list_free(flags);
+    }
+    purple_debug_info("dummy", "apply_member_changes %s/%s: %zu joined, %zu left, %zu members\n",
+                      room.groupId.c_str(), room.chatId.c_str(), added.size(), removed.size(), room.members.size());
+}
+
+/*
+ * Brings the chat window up to date with what ingest_chat_event queued: member changes first, then the messages in
+ * slices of render_slice_budget, as render_conversation does. A room that talks faster than Pidgin can write is
+ * thinned out by ingest_chat_event rather than allowed to fall further and further behind.
+ */
+PooledTask<void> render_chat_room(SteamAccount &sa, int id) {
+    while (true) {
+        auto it = sa.chatRooms.find(id);
+        if (it == sa.chatRooms.end()) {
+            co_return;  // left
+        }
+        auto &room = it->second;
+        PurpleConversation *conv = purple_find_chat(sa.pc, id);
+        if (conv == nullptr) {
+            room.draining = false;
+            co_return;
+        }
+        room.draining = true;
+        apply_member_changes(sa, room, PURPLE_CONV_CHAT(conv));
+        if (room.skipped > 0) {
+            gchar *notice = g_strdup_printf(_("%zu messages skipped to keep up with the room"), room.skipped);
+            purple_conversation_write(conv, nullptr, notice,
+                                      (PurpleMessageFlags) (PURPLE_MESSAGE_SYSTEM | PURPLE_MESSAGE_NO_LOG),
+                                      time(nullptr));
+            g_free(notice);
+            room.skipped = 0;
+        }
+        if (room.pending.empty()) {
+            room.draining = false;
+            co_return;
+        }
+
+        auto sliceEnd = std::chrono::steady_clock::now() + render_slice_budget;
+        std::string scratch;
+        do {
+            auto msg = std::move(room.pending.front());
+            room.pending.pop_front();
+            auto html = SteamClient::steam_to_html(msg.message, scratch);
+            auto senderId = msg.senderId.str();
+            auto member = room.members.find(senderId);
+            const auto &who = member != room.members.end() ? member->second.second : senderId;
+            serv_got_chat_in(sa.pc, id, who.c_str(), PURPLE_MESSAGE_RECV, html.data(),
+                             (time_t) (msg.timestamp_ns / 1000000000LL));
+        } while (!room.pending.empty() && std::chrono::steady_clock::now() < sliceEnd);
+
+        if (!room.pending.empty()) {
+            try {
+                co_await sa.ioService.schedule_after(render_slice_pause, sa.cancelToken);
+            } catch (const cppcoro::operation_cancelled &) {
+                co_return;  // closing
+            }
+        }
+    }
+}
+
+// runs for every event of a watched room as it arrives; it only queues, so a busy room never holds up the stream
+void ingest_chat_event(SteamAccount &sa, int id, SteamClient::ChatRoomEvent &&event) {
+    auto it = sa.chatRooms.find(id);
+    if (it == sa.chatRooms.end()) {
+        return;
+    }
+    auto &room = it->second;
+    room.version = event.version;
+    if (event.reset) {
+        room.pendingReset = true;
+        room.pendingMembers.clear();
+    }
+    for (auto &member: event.joined) {
+        auto memberId = member.id;
+        room.pendingMembers.insert_or_assign(std::move(memberId), std::move(member));
+    }
+    for (auto &memberId: event.left) {
+        room.pendingMembers.insert_or_assign(std::move(memberId), std::nullopt);
+    }
+    for (auto &msg: event.messages) {
+        if (room.msgBuffer.remove(msg.message, (time_t) (msg.timestamp_ns / 1000000000LL))) {
+            continue;  // echo of a message sent from here
+        }
+        room.pending.push_back(std::move(msg));
+    }
+    if (room.pending.size() > chat_backlog_limit) {
+        auto excess = room.pending.size() - chat_backlog_limit;
+        room.pending.erase(room.pending.begin(), room.pending.begin() + (ptrdiff_t) excess);
+        room.skipped += excess;
+    }
+    if (!room.draining) {
+        room.draining = true;
+        sa.scope.spawn(render_chat_room(sa, id));
+    }
+}
+
+// follows the room until it is left or the account closes; a broken stream is re-watched from the last version
+PooledTask<void> watch_chat_room(SteamAccount &sa, int id) {
+    auto backoff = chat_watch_initial_backoff;
+    while (true) {
+        auto it = sa.chatRooms.find(id);
+        if (it == sa.chatRooms.end()) {
+            co_return;
+        }
+        auto &room = it->second;
+        auto token = room.cancel.token();
+        if (token.is_cancellation_requested()) {
+            co_return;
+        }
+        if (sa.client->isSessionKeySet()) {
+            // the room may be left while the stream is open, so nothing below refers to it
+            auto groupId = room.groupId;
+            auto chatId = room.chatId;
+            purple_debug_info("dummy", "watch_chat_room %s/%s from version %s\n", groupId.c_str(), chatId.c_str(),
+                              room.version.has_value() ? std::to_string(room.version.value()).c_str() : "none");
+            bool ok = co_await sa.client->watchChatRoom(
+                    groupId, chatId, room.version, [&sa, id](SteamClient::ChatRoomEvent &&event) {
+                        ingest_chat_event(sa, id, std::move(event));
+                    }, token);
+            if (ok) {
+                backoff = chat_watch_initial_backoff;
+            }
+        }
+        try {
+            co_await sa.ioService.schedule_after(backoff, sa.cancelToken);
+        } catch (const cppcoro::operation_cancelled &) {
+            co_return;
+        }
+        backoff = std::min(backoff * 2, chat_watch_max_backoff);
+    }
+}
+
+// retried with the same idempotency key while the failure is transient, as drain_send_queue does for IMs
+PooledTask<void> send_chat_room_message(SteamAccount &sa, int id, std::string groupId, std::string chatId,
+                                        std::string text, std::string idempotencyKey) {
+    auto backoff = send_retry_initial_backoff;
+    for (int attempt = 1; sa.client->isSessionKeySet(); ++attempt) {
+        auto code = co_await sa.client->sendChatRoomMessage(groupId, chatId, text, idempotencyKey);
+        if (code == SteamClient::SEND_SUCCESS) {
+            co_return;
+        }
+        if ((code != SteamClient::SEND_RPC_FAILURE && code != SteamClient::SEND_UNKNOWN_FAILURE) ||
+            attempt >= send_max_attempts) {
+            break;
+        }
+        try {
+            co_await sa.ioService.schedule_after(backoff, sa.cancelToken);
+        } catch (const cppcoro::operation_cancelled &) {
+            co_return;
+        }
+        backoff = std::min(backoff * 2, send_retry_max_backoff);
+    }
+    purple_debug_warning("dummy", "send_chat_room_message %s/%s failed\n", groupId.c_str(), chatId.c_str());
+    if (PurpleConversation *conv = purple_find_chat(sa.pc, id)) {
+        purple_conversation_write(conv, nullptr, _("Message could not be sent"),
+                                  (PurpleMessageFlags) (PURPLE_MESSAGE_ERROR | PURPLE_MESSAGE_NO_LOG), time(nullptr));
+    }
+}
+
+static GList *steam_chat_info(PurpleConnection *pc) {
+    GList *entries = nullptr;
+    auto *entry = g_new0(struct proto_chat_entry, 1);
+    entry->label = _("_Group ID:");
+    entry->identifier = "group_id";
+    entry->required = TRUE;
+    entries = g_list_append(entries, entry);
+
+    entry = g_new0(struct proto_chat_entry, 1);
+    entry->label = _("_Channel ID:");
+    entry->identifier = "chat_id";
+    entry->required = TRUE;
+    entries = g_list_append(entries, entry);
+    return entries;
+}
+
+// chat names are "groupId/chatId"
+static GHashTable *steam_chat_info_defaults(PurpleConnection *pc, const char *chatName) {
+    GHashTable *defaults = g_hash_table_new_full(g_str_hash, g_str_equal, nullptr, g_free);
+    if (chatName != nullptr) {
+        gchar **parts = g_strsplit(chatName, "/", 2);
+        if (parts[0] != nullptr && parts[1] != nullptr) {
+            g_hash_table_insert(defaults, (gpointer) "group_id", g_strdup(parts[0]));
+            g_hash_table_insert(defaults, (gpointer) "chat_id", g_strdup(parts[1]));
+        }
+        g_strfreev(parts);
+    }
+    return defaults;
+}
+
+static char *steam_get_chat_name(GHashTable *components) {
+    auto *groupId = static_cast<const char *>(g_hash_table_lookup(components, "group_id"));
+    auto *chatId = static_cast<const char *>(g_hash_table_lookup(components, "chat_id"));
+    if (groupId == nullptr || chatId == nullptr) {
+        return nullptr;
+    }
+    return g_strdup_printf("%s/%s", groupId, chatId);
+}
+
+static void steam_join_chat(PurpleConnection *pc, GHashTable *components) {
+    SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
+    auto *groupId = static_cast<const char *>(g_hash_table_lookup(components, "group_id"));
+    auto *chatId = static_cast<const char *>(g_hash_table_lookup(components, "chat_id"));
+    if (groupId == nullptr || chatId == nullptr) {
+        return;
+    }
+    for (auto &[id, room]: sa.chatRooms) {
+        if (room.groupId == groupId && room.chatId == chatId) {
+            if (PurpleConversation *conv = purple_find_chat(pc, id)) {
+                purple_conversation_present(conv);
+            }
+            return;
+        }
+    }
+
+    int id = ++sa.lastChatId;
+    auto &room = sa.chatRooms[id];
+    room.groupId = groupId;
+    room.chatId = chatId;
+    gchar *chatName = steam_get_chat_name(components);
+    purple_debug_info("dummy", "steam_join_chat %s as %d\n", chatName, id);
+    PurpleConversation *conv = serv_got_joined_chat(pc, id, chatName);
+    if (auto *title = static_cast<const char *>(g_hash_table_lookup(components, "name")); conv && title) {
+        purple_conversation_set_title(conv, title);  // "group / channel" when joined from the room list
+    }
+    g_free(chatName);
+    sa.scope.spawn(watch_chat_room(sa, id));
+}
+
+static void steam_chat_leave(PurpleConnection *pc, int id) {
+    SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
+    if (auto it = sa.chatRooms.find(id); it != sa.chatRooms.end()) {
+        purple_debug_info("dummy", "steam_chat_leave %s/%s\n", it->second.groupId.c_str(), it->second.chatId.c_str());
+        it->second.cancel.request_cancellation();
+        sa.chatRooms.erase(it);
+    }
+}
+
+static int steam_chat_send(PurpleConnection *pc, int id, const char *message, PurpleMessageFlags flags) {
+    SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
+    auto it = sa.chatRooms.find(id);
+    if (it == sa.chatRooms.end()) {
+        return -EINVAL;
+    }
+    auto &room = it->second;
+    std::string scratch;
+    std::string text(SteamClient::html_to_steam(message, scratch));
+    room.msgBuffer.add(text, time(nullptr));
+    if (PurpleConversation *conv = purple_find_chat(pc, id)) {
+        serv_got_chat_in(pc, id, purple_conv_chat_get_nick(PURPLE_CONV_CHAT(conv)), PURPLE_MESSAGE_SEND, message,
+                         time(nullptr));
+    }
+    gchar *idempotencyKey = g_uuid_string_random();
+    sa.scope.spawn(send_chat_room_message(sa, id, room.groupId, room.chatId, text, idempotencyKey));
+    g_free(idempotencyKey);
+    return 0;
+}
+
+PooledTask<void> fill_roomlist(SteamAccount &sa, PurpleRoomlist *roomlist) {
+    std::optional<std::vector<SteamClient::ChatRoom>> rooms;
+    if (sa.client->isSessionKeySet()) {
+        rooms = co_await sa.client->getChatRooms();
+    }
+    for (auto &room: rooms.value_or(std::vector<SteamClient::ChatRoom>{})) {
+        auto *entry = purple_roomlist_room_new(PURPLE_ROOMLIST_ROOMTYPE_ROOM, room.name.c_str(), nullptr);
+        purple_roomlist_room_add_field(roomlist, entry, room.groupId.c_str());
+        purple_roomlist_room_add_field(roomlist, entry, room.chatId.c_str());
+        purple_roomlist_room_add_field(roomlist, entry, GUINT_TO_POINTER(room.memberCount));
+        purple_roomlist_room_add(roomlist, entry);
+    }
+    purple_roomlist_set_in_progress(roomlist, FALSE);
+    purple_roomlist_unref(roomlist);
+}
+
+static PurpleRoomlist *steam_roomlist_get_list(PurpleConnection *pc) {
+    SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
+    PurpleRoomlist *roomlist = purple_roomlist_new(sa.account);
+    // joining a room hands these fields (by name) to steam_join_chat
+    GList *fields = nullptr;
+    fields = g_list_append(fields, purple_roomlist_field_new(PURPLE_ROOMLIST_FIELD_STRING, "", "group_id", TRUE));
+    fields = g_list_append(fields, purple_roomlist_field_new(PURPLE_ROOMLIST_FIELD_STRING, "", "chat_id", TRUE));
+    fields = g_list_append(fields, purple_roomlist_field_new(PURPLE_ROOMLIST_FIELD_INT, _("Members"), "members",
+                                                             FALSE));
+    purple_roomlist_set_fields(roomlist, fields);
+    purple_roomlist_set_in_progress(roomlist, TRUE);
+    purple_roomlist_ref(roomlist);  // released by fill_roomlist
+    sa.scope.spawn(fill_roomlist(sa, roomlist));
+    return roomlist;
+}
+
 static void steam_buddy_free(PurpleBuddy *buddy) {
     purple_debug_info("dummy", "steam_buddy_free start\n");
-    delete static_cast<SteamBuddy *>(buddy->proto_data);
+    if (buddy->proto_data != nullptr) {
+        delete_steam_buddy(static_cast<SteamBuddy *>(buddy->proto_data));
+    }
     buddy->proto_data = nullptr;
 }
 
@@ -333,13 +1357,138 @@ void steam_add_buddy(PurpleConnection *pc, PurpleBuddy *buddy, PurpleGroup *grou
     }
 }
 
+// a local alias is only indexed for search when the buddy is updated: make the next tick update it
+static void steam_alias_buddy(PurpleConnection *pc, const char *who, const char *alias) {
+    purple_debug_info("dummy", "steam_alias_buddy %s\n", who);
+    auto *sa = static_cast<SteamAccount *>(pc->proto_data);
+    auto purpleBuddy = static_cast<PurpleBuddy *>(purple_find_buddy(sa->account, who));
+    if (purpleBuddy == nullptr || purpleBuddy->proto_data == nullptr) {
+        return;
+    }
+    static_cast<SteamBuddy *>(purpleBuddy->proto_data)->personaHash = 0;
+    sa->friendsListHash = 0;
+}
+
+static SteamAccount *steam_account_for(PurpleConversation *conv) {
+    PurpleConnection *pc = purple_conversation_get_gc(conv);
+    if (pc == nullptr || pc->proto_data == nullptr ||
+        g_strcmp0(purple_account_get_protocol_id(purple_conversation_get_account(conv)), STEAM_PLUGIN_ID) != 0) {
+        return nullptr;
+    }
+    return static_cast<SteamAccount *>(pc->proto_data);
+}
+
+static void steam_conversation_updated(PurpleConversation *conv, PurpleConvUpdateType type) {
+    // the UI marks a conversation as seen when it gets focus; acknowledge it right away instead of waiting
+    if (type != PURPLE_CONV_UPDATE_UNSEEN || purple_conversation_get_type(conv) != PURPLE_CONV_TYPE_IM) {
+        return;
+    }
+    SteamAccount *p_sa = steam_account_for(conv);
+    if (p_sa == nullptr || GPOINTER_TO_INT(purple_conversation_get_data(conv, "unseen-count")) != 0) {
+        return;
+    }
+    SteamAccount &sa = *p_sa;
+    if (sa.pendingAcks.contains(purple_conversation_get_name(conv))) {
+        purple_debug_info("dummy", "steam_conversation_updated flush acks on focus %s\n",
+                          purple_conversation_get_name(conv));
+        sa.scope.spawn(flush_acks(sa));
+    }
+}
+
+static void steam_conversation_created(PurpleConversation *conv) {
+    SteamAccount *sa = steam_account_for(conv);
+    if (sa == nullptr || purple_conversation_get_type(conv) != PURPLE_CONV_TYPE_IM) {
+        return;
+    }
+    purple_debug_info("dummy", "steam_conversation_created %s\n", purple_conversation_get_name(conv));
+    sa->scope.spawn(load_history(*sa, purple_conversation_get_name(conv)));
+}
+
+static void steam_deleting_conversation(PurpleConversation *conv) {
+    SteamAccount *sa = steam_account_for(conv);
+    if (sa != nullptr && purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM) {
+        // start over when it is opened again, unless a load still holds on to the entry
+        if (auto it = sa->history.find(purple_conversation_get_name(conv)); it != sa->history.end() &&
+                                                                             !it->second.loading) {
+            sa->history.erase(it);
+        }
+    }
+}
+
+static PurpleCmdRet steam_cmd_history(PurpleConversation *conv, const gchar *cmd, gchar **args, gchar **error,
+                                      void *data) {
+    SteamAccount *sa = steam_account_for(conv);
+    if (sa == nullptr) {
+        return PURPLE_CMD_RET_FAILED;
+    }
+    sa->scope.spawn(load_history(*sa, purple_conversation_get_name(conv)));
+    return PURPLE_CMD_RET_OK;
+}
+
+static PurpleCmdRet steam_cmd_expand(PurpleConversation *conv, const gchar *cmd, gchar **args, gchar **error,
+                                     void *data) {
+    SteamAccount *sa = steam_account_for(conv);
+    if (sa == nullptr) {
+        return PURPLE_CMD_RET_FAILED;
+    }
+    auto &queue = sa->renderQueues[purple_conversation_get_name(conv)];
+    if (queue.collapsed.empty()) {
+        return PURPLE_CMD_RET_OK;
+    }
+    // older than what has been written since, so they go ahead of anything still pending
+    queue.pending.insert(queue.pending.begin(), std::make_move_iterator(queue.collapsed.begin()),
+                         std::make_move_iterator(queue.collapsed.end()));
+    queue.collapsed.clear();
+    if (!queue.draining) {
+        sa->scope.spawn(render_conversation(*sa, purple_conversation_get_name(conv)));
+    }
+    return PURPLE_CMD_RET_OK;
+}
+
+static PurpleCmdId history_cmd_id;
+static PurpleCmdId expand_cmd_id;
+
+static gboolean drop_preconnected_client(gpointer) {
+    if (preconnected_client.has_value()) {
+        purple_debug_info("dummy", "dropping unused pre-connected client\n");
+        preconnected_client.reset();
+    }
+    preconnect_timer_id = 0;
+    return FALSE;
+}
+
 static gboolean plugin_load(PurplePlugin *plugin) {
     purple_debug_info("dummy", "plugin_load start\n");
+    preconnected_client = PreconnectedClient{default_proxy_address, "default",
+                                             make_client(default_proxy_address, "default")};
+    preconnect_timer_id = purple_timeout_add_seconds(preconnect_lifetime_s, drop_preconnected_client, nullptr);
+    purple_signal_connect(purple_conversations_get_handle(), "conversation-updated", plugin,
+                          PURPLE_CALLBACK(steam_conversation_updated), nullptr);
+    purple_signal_connect(purple_conversations_get_handle(), "conversation-created", plugin,
+                          PURPLE_CALLBACK(steam_conversation_created), nullptr);
+    purple_signal_connect(purple_conversations_get_handle(), "deleting-conversation", plugin,
+                          PURPLE_CALLBACK(steam_deleting_conversation), nullptr);
+    history_cmd_id = purple_cmd_register("history", "", PURPLE_CMD_P_PRPL,
+                                         (PurpleCmdFlag) (PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_PRPL_ONLY),
+                                         STEAM_PLUGIN_ID, steam_cmd_history,
+                                         _("history:  Load older messages of this conversation."), nullptr);
+    expand_cmd_id = purple_cmd_register("expand", "", PURPLE_CMD_P_PRPL,
+                                        (PurpleCmdFlag) (PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_PRPL_ONLY),
+                                        STEAM_PLUGIN_ID, steam_cmd_expand,
+                                        _("expand:  Show the messages left out of a large backlog."), nullptr);
     return TRUE;
 }
 
 static gboolean plugin_unload(PurplePlugin *plugin) {
     purple_debug_info("dummy", "plugin_unload start\n");
+    purple_signals_disconnect_by_handle(plugin);
+    purple_cmd_unregister(history_cmd_id);
+    purple_cmd_unregister(expand_cmd_id);
+    if (preconnect_timer_id != 0) {
+        purple_timeout_remove(preconnect_timer_id);
+        preconnect_timer_id = 0;
+    }
+    preconnected_client.reset();
 //#ifdef G_OS_UNIX
 //#ifdef USE_GNOME_KEYRING
 //    if (gnome_keyring_lib) {
@@ -356,22 +1505,183 @@ static gboolean plugin_unload(PurplePlugin *plugin) {
     return TRUE;
 }
 
+static void steam_search_results_im(PurpleConnection *pc, GList *row, gpointer user_data) {
+    auto *id = static_cast<const char *>(g_list_nth_data(row, 1));
+    PurpleAccount *account = purple_connection_get_account(pc);
+    PurpleConversation *conv = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, id, account);
+    if (conv == nullptr) {
+        conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, account, id);
+    }
+    purple_conversation_present(conv);
+}
+
+void show_search_results(PurpleConnection *pc, const char *query,
+                         const std::vector<SteamClient::FriendIndex::Match> &matches) {
+    PurpleNotifySearchResults *results = purple_notify_searchresults_new();
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("Name")));
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("SteamID")));
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("Friend")));
+    purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM, steam_search_results_im);
+    for (auto &match: matches) {
+        GList *row = nullptr;
+        row = g_list_append(row, g_strdup(match.name.c_str()));
+        row = g_list_append(row, g_strdup(match.id.c_str()));
+        row = g_list_append(row, g_strdup(match.isFriend ? _("Yes") : _("No")));
+        purple_notify_searchresults_row_add(results, row);
+    }
+    gchar *secondary = g_strdup_printf(_("Users matching \"%s\""), query);
+    purple_notify_searchresults(pc, _("Search for friends"), _("Search results"), secondary, results, nullptr,
+                                nullptr);
+    g_free(secondary);
+}
+
+// the proxy's search, for queries the friend index has no match for; what it finds is indexed for next time
+PooledTask<void> search_users_remote(SteamAccount &sa, std::string query) {
+    std::optional<std::vector<SteamClient::Buddy>> users;
+    if (sa.client->isSessionKeySet()) {
+        users = co_await sa.client->searchUsers(query, search_result_limit);
+    }
+    if (!users.has_value()) {
+        purple_notify_error(sa.pc, _("Search for friends"), _("Search failed"), query.c_str());
+        co_return;
+    }
+    if (users->empty()) {
+        purple_notify_info(sa.pc, _("Search for friends"), _("No users found"), query.c_str());
+        co_return;
+    }
+    std::vector<SteamClient::FriendIndex::Match> matches;
+    for (auto &user: *users) {
+        auto id = user.id.str();
+        sa.friendIndex.upsert(id, {user.nickname}, false);
+        matches.push_back({id, user.nickname, purple_find_buddy(sa.account, id.c_str()) != nullptr});
+    }
+    show_search_results(sa.pc, query.c_str(), matches);
+}
+
+static void steam_search_users_text(PurpleConnection *pc, const gchar *text) {
+    if (pc->proto_data == nullptr || text == nullptr) {
+        return;
+    }
+    SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
+    auto start = std::chrono::steady_clock::now();
+    auto matches = sa.friendIndex.search(text, search_result_limit);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    purple_debug_info("dummy", "steam_search_users \"%s\": %zu of %zu users in %lld us\n", text, matches.size(),
+                      sa.friendIndex.size(), (long long) elapsed.count());
+    if (matches.empty()) {
+        sa.scope.spawn(search_users_remote(sa, text));
+        return;
+    }
+    show_search_results(pc, text, matches);
+}
+
 void steam_search_users(PurplePluginAction *action) {
-    purple_debug_info("dummy", "steam_search_users start\n");  // TODO
+    purple_debug_info("dummy", "steam_search_users start\n");
+    auto *pc = static_cast<PurpleConnection *>(action->context);
+    if (pc == nullptr || pc->proto_data == nullptr) {
+        return;
+    }
+    purple_request_input(pc, _("Search for friends"), _("Search for friends"),
+                         _("Part of a name or alias, or a SteamID"), nullptr, FALSE, FALSE, nullptr,
+                         _("_Search"), G_CALLBACK(steam_search_users_text), _("_Cancel"), nullptr,
+                         purple_connection_get_account(pc), nullptr, nullptr, pc);
+}
+
+static void steam_search_messages_text(PurpleConnection *pc, const gchar *text) {
+    if (pc->proto_data == nullptr || text == nullptr) {
+        return;
+    }
+    SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
+    if (sa.messageIndex == nullptr) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto hits = sa.messageIndex->search(text, search_result_limit);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    purple_debug_info("dummy", "steam_search_messages \"%s\": %zu of %u messages in %lld us\n", text, hits.size(),
+                      sa.messageIndex->size(), (long long) elapsed.count());
+    if (hits.empty()) {
+        purple_notify_info(pc, _("Search messages"), _("No messages found"), text);
+        return;
+    }
+
+    PurpleNotifySearchResults *results = purple_notify_searchresults_new();
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("Conversation")));
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("SteamID")));
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("Time")));
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("From")));
+    purple_notify_searchresults_column_add(results, purple_notify_searchresults_column_new(_("Message")));
+    purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM, steam_search_results_im);
+    const char *me = purple_account_get_alias(sa.account);
+    if (me == nullptr) {
+        me = purple_account_get_username(sa.account);
+    }
+    for (auto &hit: hits) {
+        PurpleBuddy *buddy = purple_find_buddy(sa.account, hit.conversation.c_str());
+        const char *name = buddy != nullptr ? purple_buddy_get_alias(buddy) : hit.conversation.c_str();
+        time_t when = (time_t) (hit.message.timestamp_ns / 1000000000LL);
+        GList *row = nullptr;
+        row = g_list_append(row, g_strdup(name));
+        row = g_list_append(row, g_strdup(hit.conversation.c_str()));
+        row = g_list_append(row, g_strdup(purple_date_format_full(localtime(&when))));
+        row = g_list_append(row, g_strdup(hit.sent() ? me : name));
+        row = g_list_append(row, g_strdup(hit.message.message.c_str()));
+        purple_notify_searchresults_row_add(results, row);
+    }
+    gchar *secondary = g_strdup_printf(_("Messages containing \"%s\""), text);
+    purple_notify_searchresults(pc, _("Search messages"), _("Search results"), secondary, results, nullptr, nullptr);
+    g_free(secondary);
+}
+
+void steam_search_messages(PurplePluginAction *action) {
+    purple_debug_info("dummy", "steam_search_messages start\n");
+    auto *pc = static_cast<PurpleConnection *>(action->context);
+    if (pc == nullptr || pc->proto_data == nullptr) {
+        return;
+    }
+    purple_request_input(pc, _("Search messages"), _("Search messages"),
+                         _("Words to look for in all Steam conversations"), nullptr, FALSE, FALSE, nullptr,
+                         _("_Search"), G_CALLBACK(steam_search_messages_text), _("_Cancel"), nullptr,
+                         purple_connection_get_account(pc), nullptr, nullptr, pc);
 }
 
 void steam_register_game_key(PurplePluginAction *action) {
     purple_debug_info("dummy", "steam_register_game_key start\n");  // TODO
 }
 
+void steam_show_proxy_endpoints(PurplePluginAction *action) {
+    purple_debug_info("dummy", "steam_show_proxy_endpoints start\n");
+    auto *pc = static_cast<PurpleConnection *>(action->context);
+    if (pc == nullptr || pc->proto_data == nullptr) {
+        return;
+    }
+    SteamAccount &sa = *static_cast<SteamAccount *>(pc->proto_data);
+    GString *text = g_string_new(nullptr);
+    for (auto &endpoint: sa.client->endpointStats()) {
+        gchar *address = g_markup_escape_text(endpoint.address.c_str(), -1);
+        g_string_append_printf(text, "<b>%s</b>%s: %s<br>", address, endpoint.active ? " (active)" : "",
+                               endpoint.ready ? "connected" : "not connected");
+        g_string_append_printf(text, "%" G_GUINT64_FORMAT " calls, %" G_GUINT64_FORMAT " failed, %"
+                                     G_GUINT64_FORMAT " in flight, %.1f ms mean latency<br><br>",
+                               endpoint.calls, endpoint.failures, endpoint.inFlight, endpoint.meanLatencyMs);
+        g_free(address);
+    }
+    purple_notify_formatted(pc, _("Proxy endpoints"), _("Proxy endpoints"), nullptr, text->str, nullptr, nullptr);
+    g_string_free(text, TRUE);
+}
+
 static GList *steam_actions(PurplePlugin *plugin, gpointer context) {
     purple_debug_info("dummy", "steam_actions start\n");
     GList *m = nullptr;
     PurplePluginAction *act;
     act = purple_plugin_action_new(_("Search for friends..."), steam_search_users);
     m = g_list_append(m, act);
+    act = purple_plugin_action_new(_("Search messages..."), steam_search_messages);
+    m = g_list_append(m, act);
     act = purple_plugin_action_new(_("Redeem game key..."), steam_register_game_key);
     m = g_list_append(m, act);
+    act = purple_plugin_action_new(_("Proxy endpoints..."), steam_show_proxy_endpoints);
+    m = g_list_append(m, act);
     return m;
 }
 
@@ -439,24 +1749,46 @@ cppcoro::task<void> attempt_login(PurpleConnection *pc, SteamAccount &sa) {
     purple_connection_set_state(pc, PURPLE_CONNECTING);
     purple_connection_update_progress(pc, _("Connecting"), 1, 3);
 
+    if (!sa.client->isConnected()) {
+        purple_debug_info("dummy", "steam_login waiting for proxy connection\n");
+        if (!co_await sa.client->waitForConnected(sa.cancelToken)) {
+            co_return;
+        }
+    }
+
     SteamClient::AuthResponseState res;
-    if (sa.client.shouldReset()) {
-        sa.client.resetSessionKey();
+    if (sa.client->shouldReset()) {
+        sa.client->resetSessionKey();
     }
 
-    for (int i = 0; i < 2; ++i) {
+    sa.client->setRefreshToken(sa.refreshToken);
+    for (int i = 0; i < 3; ++i) {
         purple_debug_info("dummy", "steam_login authenticate attempt %d\n", i);
         // TODO: verify auth flow
         // TODO: wait for Steam Guard code (since Steam will send an email with a new code for each login attempt)
-        res = co_await sa.client.authenticate(sa.username, sa.password, sa.steamGuardCode);
+        bool usedRefreshToken = sa.client->refreshToken().has_value();
+        res = co_await sa.client->authenticate(sa.username, sa.password, sa.steamGuardCode);
+        if (sa.client->refreshToken() != sa.refreshToken) {
+            sa.refreshToken = sa.client->refreshToken();
+            if (sa.refreshToken.has_value()) {
+                purple_account_set_string(sa.account, "refreshToken", sa.refreshToken->c_str());
+            } else {
+                purple_account_remove_setting(sa.account, "refreshToken");
+            }
+        }
         switch (res) {
             case SteamClient::AUTH_SUCCESS:
                 purple_debug_info("dummy", "steam_login authenticate success\n");
                 purple_connection_set_state(pc, PURPLE_CONNECTED);
                 purple_connection_update_progress(pc, _("Connected"), 2, 3);
+                flush_send_queues(pc, sa);
                 co_return;
             case SteamClient::AUTH_INVALID_CREDENTIALS:
                 purple_debug_info("dummy", "steam_login authenticate invalid credentials\n");
+                if (usedRefreshToken) {
+                    purple_debug_info("dummy", "steam_login refresh token rejected, retrying with password\n");
+                    break;
+                }
                 purple_connection_error_reason(pc, PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
                                                "Invalid username or password");
                 co_return;
@@ -488,6 +1820,18 @@ static void steam_login(PurpleAccount *account) {
     pc->proto_data = p_sa;
     SteamAccount &sa = *p_sa;
 
+    const char *proxyAddress = purple_account_get_string(account, "proxy_address", default_proxy_address);
+    const char *profileName = purple_account_get_string(account, "channel_profile", "default");
+    if (preconnected_client.has_value() && preconnected_client->proxyAddress == proxyAddress &&
+        preconnected_client->profileName == profileName) {
+        purple_debug_info("dummy", "steam_login using pre-connected client\n");
+        sa.client = std::move(preconnected_client->client);
+        preconnected_client.reset();
+    }
+    if (!sa.client) {
+        sa.client = make_client(proxyAddress, profileName);
+    }
+
     if (!purple_ssl_is_supported()) {
         purple_connection_error_reason(pc,
                                        PURPLE_CONNECTION_ERROR_NO_SSL_SUPPORT,
@@ -507,7 +1851,14 @@ static void steam_login(PurpleAccount *account) {
     // sa->sent_messages_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, nullptr);
     // sa->waiting_conns = g_queue_new();
 //    sa.last_message_timestamp = purple_account_get_int(sa.account, "last_message_timestamp", 0);
-    read_last_timestamps(sa);
+    sa.avatarCache = std::make_unique<SteamClient::AvatarCache>(avatar_dir(), avatar_cache_max_bytes);
+    sa.messageIndex = std::make_unique<SteamClient::MessageIndex>(message_index_dir(sa.account));
+    read_history_sync(sa);
+    read_pending_messages(sa);
+    restore_snapshot(sa);
+    sa.maxConcurrentPolls = std::max(1, purple_account_get_int(account, "max_concurrent_polls", 4));
+    sa.maxInFlightSends = std::max(1, purple_account_get_int(account, "max_inflight_sends", 1));
+    sa.collapseBacklogs = purple_account_get_bool(account, "collapse_backlogs", FALSE);
 
     if (const char *x = purple_account_get_string(account, "refreshToken", nullptr)) {
         sa.refreshToken = x;
@@ -519,12 +1870,29 @@ static void steam_login(PurpleAccount *account) {
 
     sa.cancelToken = sa.cancelTokenSource.token();
 
-    sa.scope.spawn(sa.client.run_cq(reinterpret_cast<SteamAccount *>(pc->proto_data)->ioService));
+    sa.scope.spawn(sa.client->run_cq(reinterpret_cast<SteamAccount *>(pc->proto_data)->ioService));
     sa.scope.spawn(attempt_login(pc, sa));
     sa.scope.spawn([](SteamAccount &sa) -> cppcoro::task<void> {
         while (!sa.cancelToken.is_cancellation_requested()) {
-            co_await sa.ioService.schedule_after(std::chrono::milliseconds(500));
-            if (sa.client.isSessionKeySet()) {
+            if (sa.client->isConnected()) {
+                co_await sa.ioService.schedule_after(std::chrono::milliseconds(500));
+            } else {
+                // park until the proxy is reachable again, then sync immediately to catch up
+                purple_debug_info("dummy", "steam_login poll loop waiting for proxy connection\n");
+                if (!co_await sa.client->waitForConnected(sa.cancelToken)) {
+                    continue;
+                }
+                purple_debug_info("dummy", "steam_login poll loop connected, catching up\n");
+            }
+            if (auto lost = sa.client->sessionLost()) {
+                // re-authentication after a failover cannot succeed without the user
+                purple_connection_error_reason(sa.pc, PURPLE_CONNECTION_ERROR_AUTHENTICATION_FAILED,
+                                               lost.value() == SteamClient::AUTH_PENDING_STEAM_GUARD_CODE
+                                               ? "Steam Guard code required to reconnect"
+                                               : "Invalid username or password");
+                co_return;
+            }
+            if (sa.client->isSessionKeySet()) {
                 co_await receive_messages(sa);
             }
         }
@@ -546,6 +1914,9 @@ static void steam_set_status(PurpleAccount *account, PurpleStatus *status) {
 
 void steam_buddy_remove(PurpleConnection *pc, PurpleBuddy *buddy, PurpleGroup *group) {
     purple_debug_info("dummy", "steam_buddy_remove start\n");
+    if (pc->proto_data != nullptr) {
+        static_cast<SteamAccount *>(pc->proto_data)->friendIndex.remove(buddy->name);
+    }
 }
 
 void steam_fake_group_buddy(PurpleConnection *pc, const char *who, const char *old_group, const char *new_group) {
@@ -568,6 +1939,7 @@ static void plugin_init(PurplePlugin *plugin) {
     PurplePluginInfo *info = plugin->info;
     auto *prpl_info = static_cast<PurplePluginProtocolInfo *>(info->extra_info);
     GList *ui_mode_list = nullptr;
+    GList *channel_profile_list = nullptr;
     PurpleKeyValuePair *kvp;
 
     option = purple_account_option_string_new(
@@ -590,6 +1962,39 @@ static void plugin_init(PurplePlugin *plugin) {
             "download_offline_history", TRUE);
     prpl_info->protocol_options = g_list_append(prpl_info->protocol_options, option);
 
+    option = purple_account_option_int_new(
+            "Maximum concurrent history polls",
+            "max_concurrent_polls", 4);
+    prpl_info->protocol_options = g_list_append(prpl_info->protocol_options, option);
+
+    option = purple_account_option_bool_new(
+            "Collapse large backlogs (show them with /expand)",
+            "collapse_backlogs", FALSE);
+    prpl_info->protocol_options = g_list_append(prpl_info->protocol_options, option);
+
+    option = purple_account_option_int_new(
+            "Maximum in-flight messages per conversation",
+            "max_inflight_sends", 1);
+    prpl_info->protocol_options = g_list_append(prpl_info->protocol_options, option);
+
+    // host:port, or unix:/path/to/socket for a proxy on the same machine; a comma-separated list of equivalent
+    // proxies to spread accounts over and fail over between
+    option = purple_account_option_string_new(
+            "Proxy address",
+            "proxy_address", default_proxy_address);
+    prpl_info->protocol_options = g_list_append(prpl_info->protocol_options, option);
+
+    static const std::pair<const char *, const char *> channel_profiles[] = {
+            {"Default", "default"}, {"Local (same host)", "local"}, {"Bulk (compressed)", "bulk"}};
+    for (auto [label, value]: channel_profiles) {
+        kvp = g_new0(PurpleKeyValuePair, 1);
+        kvp->key = g_strdup(_(label));
+        kvp->value = g_strdup(value);
+        channel_profile_list = g_list_append(channel_profile_list, kvp);
+    }
+    option = purple_account_option_list_new("Proxy connection profile", "channel_profile", channel_profile_list);
+    prpl_info->protocol_options = g_list_append(prpl_info->protocol_options, option);
+
     kvp = g_new0(PurpleKeyValuePair, 1);
     kvp->key = g_strdup(_("Mobile"));
     kvp->value = g_strdup("mobile");
@@ -624,8 +2029,8 @@ static PurplePluginProtocolInfo prpl_info = {
         steam_tooltip_text,        /* tooltip_text */
         steam_status_types,        /* status_types */
         steam_node_menu,           /* blist_node_menu */
-        nullptr,//steam_chat_info,           /* chat_info */
-        nullptr,//steam_chat_info_defaults,  /* chat_info_defaults */
+        steam_chat_info,           /* chat_info */
+        steam_chat_info_defaults,  /* chat_info_defaults */
         steam_login,               /* login */
         steam_close,               /* close */
         steam_send_im,             /* send_im */
@@ -644,20 +2049,20 @@ static PurplePluginProtocolInfo prpl_info = {
         nullptr,                   /* rem_permit */
         nullptr,                   /* rem_deny */
         nullptr,                   /* set_permit_deny */
-        nullptr,//steam_fake_join_chat,      /* join_chat */
+        steam_join_chat,           /* join_chat */
         nullptr,                   /* reject chat invite */
-        nullptr,//steam_get_chat_name,       /* get_chat_name */
+        steam_get_chat_name,       /* get_chat_name */
         nullptr,                   /* chat_invite */
-        nullptr,//steam_chat_fake_leave,     /* chat_leave */
+        steam_chat_leave,          /* chat_leave */
         nullptr,                   /* chat_whisper */
-        nullptr,//steam_chat_send,           /* chat_send */
+        steam_chat_send,           /* chat_send */
         nullptr,                   /* keepalive */
         nullptr,                   /* register_user */
         nullptr,                   /* get_cb_info */
 #if !PURPLE_VERSION_CHECK(3, 0, 0)
         nullptr,                   /* get_cb_away */
 #endif
-        nullptr,                   /* alias_buddy */
+        steam_alias_buddy,         /* alias_buddy */
         steam_fake_group_buddy,    /* group_buddy */
         steam_fake_group_rename,   /* rename_group */
         steam_buddy_free,          /* buddy_free */
@@ -668,7 +2073,7 @@ static PurplePluginProtocolInfo prpl_info = {
         nullptr,                   /* get_cb_real_name */
         nullptr,                   /* set_chat_topic */
         nullptr,                   /* find_blist_chat */
-        nullptr,                   /* roomlist_get_list */
+        steam_roomlist_get_list,   /* roomlist_get_list */
         nullptr,                   /* roomlist_cancel */
         nullptr,                   /* roomlist_expand_category */
         nullptr,                   /* can_receive_file */
@@ -46,6 +46,8 @@
 
 #include "accountopt.h"
 #include "blist.h"
+#include "buddyicon.h"
+#include "cmds.h"
 #include "core.h"
 #include "connection.h"
 #include "debug.h"
@@ -53,11 +55,18 @@
 #include "proxy.h"
 #include "prpl.h"
 #include "request.h"
+#include "roomlist.h"
 #include "savedstatuses.h"
+#include "server.h"
 #include "sslconn.h"
+#include "util.h"
 #include "version.h"
+#include "avatar_cache.h"
+#include "friend_index.h"
+#include "message_index.h"
 #include "grpc_client_wrapper.h"
 #include "grpc_client_wrapper_async.h"
+#include "history_sync.h"
 #include "cppcoro/async_scope.hpp"
 #include "cppcoro/io_service.hpp"
 #include "cppcoro/cancellation_source.hpp"
@@ -67,7 +76,9 @@
 #include <fcntl.h>
 #include <type_traits>
 #include <string>
+#include <deque>
 #include <map>
+#include <memory_resource>
 #include <optional>
 #include <stdexcept>
 #include <semaphore>
@@ -131,6 +142,103 @@ struct SteamBuddy {
 #else
 
 
+class SentMessageBuffer {
+    /*
+     * This is a buffer of messages that have been sent to the server, but have not yet been acknowledged.
+     * The buffer is used to prevent duplicate messages from being displayed in the chat window.
+     */
+    size_t _capacity;
+    int64_t _tolerance_ns;
+    std::pmr::multiset<std::pair<std::pmr::string, time_t>> _buffer;
+
+    void evict() {
+        if (_buffer.size() > _capacity) {
+            _buffer.erase(_buffer.begin());
+        }
+    }
+
+public:
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    SentMessageBuffer(size_t capacity = 5, int64_t tolerance_ns = 2000000000, allocator_type alloc = {})
+            : _capacity(capacity), _tolerance_ns(tolerance_ns), _buffer(alloc) {}
+
+    explicit SentMessageBuffer(allocator_type alloc) : SentMessageBuffer(5, 2000000000, alloc) {}
+
+    void add(std::string_view msg, time_t approx_time) {
+        evict();
+        _buffer.emplace(msg, approx_time);
+    }
+
+    bool remove(std::string_view msg, time_t approx_time) {
+        for (auto it = _buffer.begin(); it != _buffer.end(); ++it) {
+            if (std::string_view(it->first) == msg && (int64_t) std::abs(it->second - approx_time) <= _tolerance_ns) {
+                _buffer.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// a joined group chat channel, keyed by its purple chat id in SteamAccount::chatRooms; see watch_chat_room
+struct ChatRoomState {
+    std::string groupId;
+    std::string chatId;
+    std::optional<uint64_t> version;  // of the last event received; lets a re-watch start with a delta
+
+    // the user list: who is shown under which name (the Steam name, made unique with the SteamID if needed)
+    std::map<std::string, std::pair<std::string, std::string>> members;  // SteamID -> (Steam name, shown name)
+    std::map<std::string, std::string> shownNames;  // shown name -> SteamID
+
+    // received but not applied yet; render_chat_room applies them in one batch per slice
+    bool pendingReset = false;  // members not in pendingMembers are gone
+    std::map<std::string, std::optional<SteamClient::ChatRoomMember>> pendingMembers;  // nullopt: left
+    std::deque<SteamClient::Message> pending;
+    size_t skipped = 0;  // messages dropped because rendering fell too far behind
+    bool draining = false;
+
+    SentMessageBuffer msgBuffer{20};
+    cppcoro::cancellation_source cancel;  // stops the watch when the chat is left
+};
+
+struct OutgoingMessage {
+    std::string idempotencyKey;
+    std::string message;
+    int attempts = 0;
+};
+
+struct BuddySendQueue {
+    std::deque<OutgoingMessage> pending;  // oldest first; persisted until Steam accepts or rejects them
+    bool draining = false;
+    bool failureShown = false;  // the conversation says the queue is stuck; cleared when a message goes out
+};
+
+// messages on their way into one conversation; see queue_messages and render_conversation
+struct RenderQueue {
+    std::vector<SteamClient::Message> incoming;  // collected during a receive_messages tick, in any order
+    std::deque<SteamClient::Message> pending;  // chronological; written in time-budgeted slices
+    std::vector<SteamClient::Message> collapsed;  // left out of a large backlog until /expand
+    bool draining = false;
+};
+
+struct SteamAccount;
+
+// avatar download in flight, shared by every buddy waiting for that avatar
+struct AvatarFetch {
+    SteamAccount *sa = nullptr;
+    std::string hash;
+    PurpleUtilFetchUrlData *request = nullptr;
+    std::vector<std::string> buddies;
+};
+
+// backwards paging through the history shown in an open conversation
+struct ConversationHistory {
+    std::optional<SteamClient::HistoryPosition> oldestShown;  // oldest message written to the conversation
+    bool loading = false;
+    bool exhausted = false;  // the proxy returned an empty page
+};
+
 struct SteamAccount {
     // libpurple compatibility
     PurpleAccount *account;
@@ -144,10 +252,53 @@ struct SteamAccount {
 //    std::map<std::string, std::string> cookies;
 
     // messaging state for websocket connection
-    std::map<std::string, int64_t> lastMessageTimestamps;  // TODO: refactor to per-buddy state
+    // catch-up position per buddy, persisted in the "history_sync" setting
+    std::map<std::string, SteamClient::HistorySyncState> historySync;
+
+    // newest read timestamp per buddy that has not been acknowledged yet; flushed as one AckFriendMessages RPC
+    std::map<std::string, int64_t> pendingAcks;
+    bool ackFlushScheduled = false;
+
+    // outgoing messages per buddy, sent in order by drain_send_queue
+    std::map<std::string, BuddySendQueue> sendQueues;
+    size_t maxInFlightSends = 1;
+
+    // maximum number of PollChatMessages streams per receive_messages tick
+    size_t maxConcurrentPolls = 4;
+
+    // large backlogs are collapsed into an "N earlier messages" notice instead of being written out
+    bool collapseBacklogs = false;
+    std::map<std::string, RenderQueue> renderQueues;
+
+    // group chats by purple chat id
+    std::map<int, ChatRoomState> chatRooms;
+    int lastChatId = 0;
+
+    // friends (by nickname and alias) and chat room members seen this session, for "Search for friends..."
+    SteamClient::FriendIndex friendIndex;
 
-    // for stub implementation
-    SteamClient::AsyncClientWrapper client{"localhost:8080"};
+    // buddy icons: downloads in flight by avatar hash, and the on-disk cache they are kept in
+    std::map<std::string, AvatarFetch> avatarFetches;
+    std::unique_ptr<SteamClient::AvatarCache> avatarCache;
+
+    // full-text index of the friend conversations delivered to and sent from this client, for "Search messages..."
+    std::unique_ptr<SteamClient::MessageIndex> messageIndex;
+
+    // history is only fetched for conversations that get opened, one page per load_history call
+    std::map<std::string, ConversationHistory> history;
+
+    // backs every SteamBuddy of this account (and their strings); released in bulk when the account is deleted
+    std::pmr::unsynchronized_pool_resource buddyResource;
+
+    // encoded friends list last written to the warm-start snapshot; empty until the first write or restore
+    std::string lastSnapshot;
+
+    // hash of the last GetFriendsList response applied; an identical response skips all buddy updates
+    size_t friendsListHash = 0;
+
+    // proxy connection; created in steam_login from the "proxy_address" and "channel_profile" account options
+    // (or taken over from the one pre-connected in plugin_load)
+    std::unique_ptr<SteamClient::AsyncClientWrapper> client;
     guint poll_callback_id;
     cppcoro::cancellation_source cancelTokenSource;
     cppcoro::cancellation_token cancelToken;
@@ -164,65 +315,75 @@ struct SteamAccount {
     }
 };
 
-class SentMessageBuffer {
-    /*
-     * This is a buffer of messages that have been sent to the server, but have not yet been acknowledged.
-     * The buffer is used to prevent duplicate messages from being displayed in the chat window.
-     */
-    size_t _capacity;
-    int64_t _tolerance_ns;
-    std::multiset<std::pair<std::string, time_t>> _buffer;
+// Profile fields that are rarely (if ever) populated; allocated on first use to keep SteamBuddy small.
+struct SteamBuddyDetails {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
 
-    void evict() {
-        if (_buffer.size() > _capacity) {
-            _buffer.erase(_buffer.begin());
-        }
-    }
-
-public:
-    SentMessageBuffer(size_t capacity = 5, int64_t tolerance_ns = 2000000000)
-            : _capacity(capacity), _tolerance_ns(tolerance_ns) {}
-
-    void add(std::string msg, time_t approx_time) {
-        evict();
-        _buffer.emplace(std::move(msg), approx_time);
-    }
+    std::pmr::string realname;
+    std::pmr::string profileurl;
+    std::pmr::string gameserversteamid;
+    std::pmr::string lobbysteamid;
+    std::pmr::string gameserverip;
 
-    bool remove(const std::string &msg, time_t approx_time) {
-        for (auto it = _buffer.begin(); it != _buffer.end(); ++it) {
-            if (it->first == msg && (int64_t) std::abs(it->second - approx_time) <= _tolerance_ns) {
-                _buffer.erase(it);
-                return true;
-            }
-        }
-        return false;
-    }
+    explicit SteamBuddyDetails(allocator_type alloc = {})
+            : realname(alloc), profileurl(alloc), gameserversteamid(alloc), lobbysteamid(alloc), gameserverip(alloc) {}
 };
 
 struct SteamBuddy {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
     SteamAccount *sa;
     PurpleBuddy *buddy;
 
-    std::string steamid;
-    std::string personaname;
-    std::string realname;
-    std::string profileurl;
-    guint lastlogoff;
-    std::string avatarUrl;
-    guint personastateflags;
+    std::pmr::string steamid;
+    std::pmr::string personaname;
+    guint lastlogoff = 0;
+    std::pmr::string avatarUrl;
+    guint personastateflags = 0;
 
     std::optional<int> gameid;
-    std::string gameextrainfo;
-    std::string gameserversteamid;
-    std::string lobbysteamid;
-    std::string gameserverip;
+    std::pmr::string gameextrainfo;
+
+    // hash of the encoded persona last applied by update_buddy_info; 0 makes the next tick apply it again
+    size_t personaHash = 0;
 
     SentMessageBuffer msgBuffer;
+
+    SteamBuddy(SteamAccount *sa, PurpleBuddy *buddy, std::string_view steamid, std::string_view personaname,
+               allocator_type alloc = {})
+            : sa(sa), buddy(buddy), steamid(steamid, alloc), personaname(personaname, alloc), avatarUrl(alloc),
+              gameextrainfo(alloc), msgBuffer(alloc) {}
+
+    SteamBuddy(const SteamBuddy &) = delete;
+
+    SteamBuddy &operator=(const SteamBuddy &) = delete;
+
+    ~SteamBuddy() {
+        if (_details != nullptr) {
+            get_allocator().delete_object(_details);
+        }
+    }
+
+    [[nodiscard]] allocator_type get_allocator() const {
+        return steamid.get_allocator();
+    }
+
+    [[nodiscard]] const SteamBuddyDetails *details() const {
+        return _details;
+    }
+
+    SteamBuddyDetails &mutable_details() {
+        if (_details == nullptr) {
+            _details = get_allocator().new_object<SteamBuddyDetails>();
+        }
+        return *_details;
+    }
+
+private:
+    SteamBuddyDetails *_details = nullptr;
 };
 #endif
 
-#define STEAMID_IS_GROUP(id) G_UNLIKELY(((g_ascii_strtoll((id), NULL, 10) >> 52) & 0x0F) == 7)
-
 typedef void (*SteamFunc)(SteamAccount *sa);
 
 #endif /* LIBSTEAM_H */
@@ -0,0 +1,430 @@
+#include "markup.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace SteamClient {
+    namespace {
+        // position of the first of `Specials` in `text` at or after `pos`, or text.size()
+        template<char... Specials>
+        size_t find_special(std::string_view text, size_t pos) {
+            const char *data = text.data();
+            size_t size = text.size();
+#if defined(__SSE2__)
+            for (; pos + 16 <= size; pos += 16) {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+                __m128i hits = _mm_setzero_si128();
+                ((hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(Specials)))), ...);
+                if (int mask = _mm_movemask_epi8(hits)) {
+                    return pos + __builtin_ctz(mask);
+                }
+            }
+#endif
+            for (; pos < size; ++pos) {
+                if (((data[pos] == Specials) || ...)) {
+                    return pos;
+                }
+            }
+            return size;
+        }
+
+        void append_escaped(std::string &out, std::string_view text) {
+            size_t pos = 0;
+            while (pos < text.size()) {
+                size_t next = find_special<'<', '>', '&', '"', '\''>(text, pos);
+                out.append(text.substr(pos, next - pos));
+                if (next == text.size()) {
+                    break;
+                }
+                switch (text[next]) {
+                    case '<':
+                        out += "&lt;";
+                        break;
+                    case '>':
+                        out += "&gt;";
+                        break;
+                    case '&':
+                        out += "&amp;";
+                        break;
+                    case '"':
+                        out += "&quot;";
+                        break;
+                    default:
+                        out += "&#39;";
+                        break;
+                }
+                pos = next + 1;
+            }
+        }
+
+        bool is_link(std::string_view href) {
+            return href.starts_with("https://") || href.starts_with("http://") || href.starts_with("steam://");
+        }
+
+        struct BBCodeTag {
+            std::string_view name;
+            std::string_view open;
+            std::string_view close;
+        };
+
+        constexpr BBCodeTag bbcode_tags[] = {
+                {"b",       "<b>",  "</b>"},
+                {"i",       "<i>",  "</i>"},
+                {"u",       "<u>",  "</u>"},
+                {"s",       "<s>",  "</s>"},
+                {"code",    "<tt>", "</tt>"},
+                {"spoiler", "<span style=\"background-color: #000000; color: #000000\">", "</span>"},
+        };
+
+        // lookahead limits, so that unterminated tags cost linear time overall
+        constexpr size_t max_bbcode_tag = 2048;  // longer "[...]" runs (or tag contents) are text
+        constexpr size_t max_html_tag = 4096;
+        constexpr size_t max_entity = 12;
+
+        // position of `needle` within `limit` bytes after `pos`, or npos
+        size_t find_within(std::string_view text, std::string_view needle, size_t pos, size_t limit) {
+            return text.substr(0, std::min(text.size(), pos + limit + needle.size())).find(needle, pos);
+        }
+
+        // BBCode to HTML; `_open` holds the closing HTML of the tags not closed yet, innermost last
+        class SteamToHtml {
+        public:
+            SteamToHtml(std::string_view text, std::string &out) : _text(text), _out(out) {}
+
+            void run(size_t pos) {
+                while (pos < _text.size()) {
+                    size_t next = find_special<'<', '>', '&', '"', '\'', '[', '\\'>(_text, pos);
+                    _out.append(_text.substr(pos, next - pos));
+                    if (next == _text.size()) {
+                        break;
+                    }
+                    pos = step(next);
+                }
+                while (!_open.empty()) {
+                    _out.append(_open.back().second);
+                    _open.pop_back();
+                }
+            }
+
+        private:
+            // handles the special character at `pos`; returns where to continue
+            size_t step(size_t pos) {
+                char c = _text[pos];
+                if (c == '\\') {
+                    if (pos + 1 < _text.size() && (_text[pos + 1] == '[' || _text[pos + 1] == ']')) {
+                        _out += _text[pos + 1];
+                        return pos + 2;
+                    }
+                    _out += '\\';
+                    return pos + 1;
+                }
+                if (c == '[') {
+                    if (size_t end = tag(pos); end != pos) {
+                        return end;
+                    }
+                    _out += '[';
+                    return pos + 1;
+                }
+                append_escaped(_out, _text.substr(pos, 1));
+                return pos + 1;
+            }
+
+            // translates the tag starting at `pos`; returns where it ends, or `pos` if it is not one we handle
+            size_t tag(size_t pos) {
+                size_t end = find_within(_text, "]", pos, max_bbcode_tag);
+                if (end == std::string_view::npos) {
+                    return pos;
+                }
+                auto body = _text.substr(pos + 1, end - pos - 1);
+                if (body.starts_with('/')) {
+                    auto name = body.substr(1);
+                    if (_open.empty() || _open.back().first != name) {
+                        return pos;
+                    }
+                    _out.append(_open.back().second);
+                    _open.pop_back();
+                    return end + 1;
+                }
+
+                std::string_view name = body, arg;
+                if (auto eq = body.find('='); eq != std::string_view::npos) {
+                    name = body.substr(0, eq);
+                    arg = body.substr(eq + 1);
+                    if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') {
+                        arg = arg.substr(1, arg.size() - 2);
+                    }
+                }
+                if (name == "emoticon" || (name == "url" && arg.empty())) {
+                    // the content is the value: take it up to the closing tag in one go
+                    std::string closing = "[/" + std::string(name) + "]";
+                    size_t close = find_within(_text, closing, end + 1, max_bbcode_tag);
+                    if (close == std::string_view::npos) {
+                        return pos;
+                    }
+                    auto inner = _text.substr(end + 1, close - end - 1);
+                    if (name == "emoticon") {
+                        _out += ':';
+                        append_escaped(_out, inner);
+                        _out += ':';
+                    } else if (is_link(inner)) {
+                        _out += "<a href=\"";
+                        append_escaped(_out, inner);
+                        _out += "\">";
+                        append_escaped(_out, inner);
+                        _out += "</a>";
+                    } else {
+                        append_escaped(_out, inner);
+                    }
+                    return close + closing.size();
+                }
+                if (name == "url") {
+                    if (is_link(arg)) {
+                        _out += "<a href=\"";
+                        append_escaped(_out, arg);
+                        _out += "\">";
+                        _open.emplace_back(name, "</a>");
+                    } else {
+                        _open.emplace_back(name, "");  // keep the text, drop the link
+                    }
+                    return end + 1;
+                }
+                for (auto &known: bbcode_tags) {
+                    if (name == known.name && arg.empty()) {
+                        _out.append(known.open);
+                        _open.emplace_back(name, known.close);
+                        return end + 1;
+                    }
+                }
+                return pos;
+            }
+
+            std::string_view _text;
+            std::string &_out;
+            std::vector<std::pair<std::string_view, std::string_view>> _open;
+        };
+
+        void append_utf8(std::string &out, uint32_t cp) {
+            if (cp < 0x80) {
+                out += (char) cp;
+            } else if (cp < 0x800) {
+                out += (char) (0xC0 | (cp >> 6));
+                out += (char) (0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                out += (char) (0xE0 | (cp >> 12));
+                out += (char) (0x80 | ((cp >> 6) & 0x3F));
+                out += (char) (0x80 | (cp & 0x3F));
+            } else {
+                out += (char) (0xF0 | (cp >> 18));
+                out += (char) (0x80 | ((cp >> 12) & 0x3F));
+                out += (char) (0x80 | ((cp >> 6) & 0x3F));
+                out += (char) (0x80 | (cp & 0x3F));
+            }
+        }
+
+        // decodes the entity starting at `pos` (the '&'); returns where it ends, or `pos` if it is not one
+        size_t decode_entity(std::string_view html, size_t pos, std::string &out) {
+            size_t end = find_within(html, ";", pos, max_entity);
+            if (end == std::string_view::npos) {
+                return pos;
+            }
+            auto name = html.substr(pos + 1, end - pos - 1);
+            uint32_t cp;
+            if (name == "amp") {
+                cp = '&';
+            } else if (name == "lt") {
+                cp = '<';
+            } else if (name == "gt") {
+                cp = '>';
+            } else if (name == "quot") {
+                cp = '"';
+            } else if (name == "apos") {
+                cp = '\'';
+            } else if (name == "nbsp") {
+                cp = ' ';
+            } else if (name.size() >= 2 && name[0] == '#') {
+                std::string digits(name.substr(name[1] == 'x' || name[1] == 'X' ? 2 : 1));
+                char *parsed = nullptr;
+                unsigned long value = std::strtoul(digits.c_str(), &parsed, digits.size() + 1 == name.size() ? 10 : 16);
+                if (digits.empty() || *parsed != '\0' || value == 0 || value > 0x10FFFF ||
+                    (value >= 0xD800 && value <= 0xDFFF)) {
+                    return pos;
+                }
+                cp = (uint32_t) value;
+            } else {
+                return pos;
+            }
+            if (cp == '[') {
+                out += '\\';
+            }
+            append_utf8(out, cp);
+            return end + 1;
+        }
+
+        // value of attribute `name` in the body of an HTML tag, undecoded
+        std::string_view attribute(std::string_view tag, std::string_view name) {
+            size_t pos = 0;
+            while ((pos = tag.find(name, pos)) != std::string_view::npos) {
+                size_t value = pos + name.size();
+                bool boundary = pos > 0 && (tag[pos - 1] == ' ' || tag[pos - 1] == '\t' || tag[pos - 1] == '\n');
+                if (boundary && value < tag.size() && tag[value] == '=') {
+                    ++value;
+                    if (value < tag.size() && (tag[value] == '"' || tag[value] == '\'')) {
+                        size_t close = tag.find(tag[value], value + 1);
+                        if (close == std::string_view::npos) {
+                            return {};
+                        }
+                        return tag.substr(value + 1, close - value - 1);
+                    }
+                    size_t close = tag.find_first_of(" \t\n", value);
+                    return tag.substr(value, close == std::string_view::npos ? close : close - value);
+                }
+                pos = value;
+            }
+            return {};
+        }
+
+        // BBCode for an HTML element name, if Steam has one
+        std::string_view bbcode_for(std::string_view element) {
+            if (element == "b" || element == "strong") {
+                return "b";
+            }
+            if (element == "i" || element == "em") {
+                return "i";
+            }
+            if (element == "u") {
+                return "u";
+            }
+            if (element == "s" || element == "strike" || element == "del") {
+                return "s";
+            }
+            return {};
+        }
+
+        class HtmlToSteam {
+        public:
+            HtmlToSteam(std::string_view html, std::string &out) : _html(html), _out(out) {}
+
+            void run(size_t pos) {
+                while (pos < _html.size()) {
+                    size_t next = find_special<'<', '&', '['>(_html, pos);
+                    _out.append(_html.substr(pos, next - pos));
+                    if (next == _html.size()) {
+                        break;
+                    }
+                    pos = step(next);
+                }
+            }
+
+        private:
+            size_t step(size_t pos) {
+                switch (_html[pos]) {
+                    case '[':
+                        _out += "\\[";
+                        return pos + 1;
+                    case '&':
+                        if (size_t end = decode_entity(_html, pos, _out); end != pos) {
+                            return end;
+                        }
+                        _out += '&';
+                        return pos + 1;
+                    default:
+                        break;
+                }
+                size_t end = find_within(_html, ">", pos, max_html_tag);
+                if (end == std::string_view::npos) {
+                    _out += '<';
+                    return pos + 1;
+                }
+                element(_html.substr(pos + 1, end - pos - 1));
+                return end + 1;
+            }
+
+            void element(std::string_view tag) {
+                bool closing = tag.starts_with('/');
+                if (closing) {
+                    tag.remove_prefix(1);
+                }
+                size_t nameEnd = 0;
+                while (nameEnd < tag.size() && std::isalnum((unsigned char) tag[nameEnd])) {
+                    ++nameEnd;
+                }
+                std::string element(tag.substr(0, nameEnd));
+                for (auto &c: element) {
+                    c = (char) std::tolower((unsigned char) c);
+                }
+
+                if (element == "br") {
+                    _out += '\n';
+                } else if (element == "a") {
+                    // links without a usable href keep their text only, and so must their closing tag
+                    if (closing) {
+                        if (!_anchors.empty()) {
+                            if (_anchors.back()) {
+                                _out += "[/url]";
+                            }
+                            _anchors.pop_back();
+                        }
+                        return;
+                    }
+                    std::string href;
+                    auto raw = attribute(tag, "href");
+                    for (size_t pos = 0; pos < raw.size();) {
+                        if (raw[pos] == '&') {
+                            if (size_t end = decode_entity(raw, pos, href); end != pos) {
+                                pos = end;
+                                continue;
+                            }
+                        }
+                        href += raw[pos++];
+                    }
+                    bool link = is_link(href) && href.find_first_of("[]") == std::string::npos;
+                    if (link) {
+                        _out += "[url=";
+                        _out += href;
+                        _out += ']';
+                    }
+                    _anchors.push_back(link);
+                } else if (auto bbcode = bbcode_for(element); !bbcode.empty()) {
+                    _out += closing ? "[/" : "[";
+                    _out.append(bbcode);
+                    _out += ']';
+                }
+            }
+
+            std::string_view _html;
+            std::string &_out;
+            std::vector<bool> _anchors;  // whether each open <a> became a [url]
+        };
+    }
+
+    std::string_view steam_to_html(std::string_view text, std::string &scratch) {
+        size_t pos = find_special<'<', '>', '&', '"', '\'', '[', '\\'>(text, 0);
+        if (pos == text.size()) {
+            return text;
+        }
+        scratch.clear();
+        scratch.reserve(text.size() + text.size() / 8 + 16);
+        scratch.append(text.substr(0, pos));
+        SteamToHtml(text, scratch).run(pos);
+        return scratch;
+    }
+
+    std::string_view html_to_steam(std::string_view html, std::string &scratch) {
+        size_t pos = find_special<'<', '&', '['>(html, 0);
+        if (pos == html.size()) {
+            return html;
+        }
+        scratch.clear();
+        scratch.reserve(html.size());
+        scratch.append(html.substr(0, pos));
+        HtmlToSteam(html, scratch).run(pos);
+        return scratch;
+    }
+} // SteamClient
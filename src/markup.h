@@ -0,0 +1,26 @@
+#ifndef PIDGIN_STEAM_MARKUP_H
+#define PIDGIN_STEAM_MARKUP_H
+
+#include <string>
+#include <string_view>
+
+namespace SteamClient {
+    /*
+     * Conversion between Steam chat text (plain text plus BBCode such as [url], [spoiler] and [emoticon], with `\[`
+     * for a literal bracket) and the HTML subset Pidgin conversations use. Each direction is a single pass that jumps
+     * from one character of interest to the next (16 bytes at a time with SSE2). Input without any such character
+     * is returned as is; otherwise the result is built in `scratch`. Either way the result is a whole string, so its
+     * `data()` is NUL-terminated when the input was a std::string.
+     */
+
+    // escapes text for HTML and translates the BBCode Pidgin can show. Unknown tags, and closing tags that do not match
+    // the innermost open one, stay literal; tags still open at the end are closed there, so the HTML is always
+    // balanced: "[b]x" gives "<b>x</b>", "[i][b]x[/i][/b]" gives "<i><b>x[/i]</b></i>"
+    std::string_view steam_to_html(std::string_view text, std::string &scratch);
+
+    // keeps the formatting Steam has BBCode for (bold, italics, underline, strikethrough, links), drops the rest of
+    // the markup and decodes entities
+    std::string_view html_to_steam(std::string_view html, std::string &scratch);
+} // SteamClient
+
+#endif //PIDGIN_STEAM_MARKUP_H
@@ -0,0 +1,769 @@
+#include "message_index.h"
+#include "friend_index.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SteamClient {
+    namespace {
+        constexpr char segment_magic[8] = {'P', 'S', 'T', 'I', 'D', 'X', 'S', '\0'};
+        constexpr char covered_magic[8] = {'P', 'S', 'T', 'I', 'D', 'X', 'C', '\0'};
+        constexpr uint32_t index_version = 1;
+        constexpr std::string_view segment_prefix = "segment-";
+        constexpr size_t max_term_bytes = 64;  // longer "words" (links, keyboard mashing) are not worth indexing
+        constexpr size_t max_segments = 16;
+        constexpr uint8_t doc_sent = 1;
+
+        // Segment file: header, posting lists, TermEntry array (sorted by term), term strings
+        struct SegmentHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t docBase;
+            uint32_t docCount;
+            uint32_t termCount;
+            uint64_t termsOffset;
+            uint64_t stringsOffset;
+            uint64_t size;
+        };
+
+        struct TermEntry {
+            uint32_t stringOffset;
+            uint32_t stringSize;
+            uint64_t postingsOffset;
+            uint32_t postingsCount;
+            uint32_t postingsSize;
+        };
+
+        template<typename T>
+        void put(std::string &out, T value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        void put_string(std::string &out, std::string_view value) {
+            put<uint32_t>(out, (uint32_t) value.size());
+            out.append(value);
+        }
+
+        void put_varint(std::string &out, uint32_t value) {
+            while (value >= 0x80) {
+                out.push_back((char) (value | 0x80));
+                value >>= 7;
+            }
+            out.push_back((char) value);
+        }
+
+        // bounds-checked reads, as in account_snapshot.cpp
+        struct Cursor {
+            std::string_view data;
+            bool ok = true;
+
+            template<typename T>
+            T get() {
+                T value{};
+                if (data.size() < sizeof(T)) {
+                    ok = false;
+                    return value;
+                }
+                std::memcpy(&value, data.data(), sizeof(T));
+                data.remove_prefix(sizeof(T));
+                return value;
+            }
+
+            std::string_view get_string() {
+                auto size = get<uint32_t>();
+                if (!ok || data.size() < size) {
+                    ok = false;
+                    return {};
+                }
+                auto value = data.substr(0, size);
+                data.remove_prefix(size);
+                return value;
+            }
+        };
+
+        // Store record: u32 size of the rest, u8 flags, i64 timestamp, u32 ordinal, conversation, sender, text
+        struct DocView {
+            uint8_t flags;
+            int64_t timestampNs;
+            uint32_t ordinal;
+            std::string_view conversation, senderId, text;
+        };
+
+        std::optional<DocView> parse_doc(std::string_view record) {
+            Cursor cursor{record};
+            DocView doc{};
+            doc.flags = cursor.get<uint8_t>();
+            doc.timestampNs = cursor.get<int64_t>();
+            doc.ordinal = cursor.get<uint32_t>();
+            doc.conversation = cursor.get_string();
+            doc.senderId = cursor.get_string();
+            doc.text = cursor.get_string();
+            if (!cursor.ok) {
+                return std::nullopt;
+            }
+            return doc;
+        }
+
+        bool write_all(int fd, std::string_view data) {
+            while (!data.empty()) {
+                auto written = write(fd, data.data(), data.size());
+                if (written <= 0) {
+                    return false;
+                }
+                data.remove_prefix((size_t) written);
+            }
+            return true;
+        }
+
+        bool write_file(const std::string &path, std::string_view data) {
+            auto tmpPath = path + ".tmp";
+            int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if (fd < 0) {
+                return false;
+            }
+            bool ok = write_all(fd, data);
+            ok = close(fd) == 0 && ok;
+            if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+                unlink(tmpPath.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        void intersect(std::vector<uint32_t> &docs, const std::vector<uint32_t> &other) {
+            std::vector<uint32_t> result;
+            std::set_intersection(docs.begin(), docs.end(), other.begin(), other.end(), std::back_inserter(result));
+            docs.swap(result);
+        }
+
+        void sort_unique(std::vector<uint32_t> &docs) {
+            std::sort(docs.begin(), docs.end());
+            docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+        }
+    }
+
+    struct MessageIndex::Segment {
+        std::string path;
+        const char *base = nullptr;
+        size_t size = 0;
+        SegmentHeader header{};
+        const TermEntry *terms = nullptr;
+        const char *strings = nullptr;
+
+        ~Segment() {
+            if (base != nullptr) {
+                munmap(const_cast<char *>(base), size);
+            }
+        }
+
+        [[nodiscard]] std::string_view term(uint32_t i) const {
+            return {strings + terms[i].stringOffset, terms[i].stringSize};
+        }
+
+        // index of the first term not less than `term`
+        [[nodiscard]] uint32_t lower_bound(std::string_view term) const {
+            uint32_t lo = 0, hi = header.termCount;
+            while (lo < hi) {
+                auto mid = lo + (hi - lo) / 2;
+                if (this->term(mid) < term) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        void decode(uint32_t i, std::vector<uint32_t> &out) const {
+            auto *p = reinterpret_cast<const uint8_t *>(base + terms[i].postingsOffset);
+            auto *end = p + terms[i].postingsSize;
+            uint32_t doc = header.docBase;
+            while (p < end) {
+                uint32_t delta = 0;
+                for (int shift = 0; p < end && shift <= 28; shift += 7) {
+                    uint8_t byte = *p++;
+                    delta |= (uint32_t) (byte & 0x7f) << shift;
+                    if (!(byte & 0x80)) {
+                        break;
+                    }
+                }
+                doc += delta;
+                out.push_back(doc);
+            }
+        }
+
+        // maps and checks a segment file; nullptr if it is not one or is damaged
+        static std::unique_ptr<Segment> open(const std::string &path) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return nullptr;
+            }
+            struct stat st{};
+            if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SegmentHeader)) {
+                close(fd);
+                return nullptr;
+            }
+            auto segment = std::make_unique<Segment>();
+            segment->path = path;
+            segment->size = (size_t) st.st_size;
+            void *base = mmap(nullptr, segment->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (base == MAP_FAILED) {
+                return nullptr;
+            }
+            segment->base = static_cast<const char *>(base);
+            auto &header = segment->header;
+            std::memcpy(&header, base, sizeof(header));
+            if (std::memcmp(header.magic, segment_magic, sizeof(header.magic)) != 0 ||
+                header.version != index_version || header.size != segment->size ||
+                header.termsOffset % alignof(TermEntry) != 0 ||
+                header.termsOffset + (uint64_t) header.termCount * sizeof(TermEntry) > header.stringsOffset ||
+                header.stringsOffset > header.size) {
+                return nullptr;
+            }
+            segment->terms = reinterpret_cast<const TermEntry *>(segment->base + header.termsOffset);
+            segment->strings = segment->base + header.stringsOffset;
+            auto stringsSize = header.size - header.stringsOffset;
+            for (uint32_t i = 0; i < header.termCount; ++i) {
+                auto &entry = segment->terms[i];
+                if ((uint64_t) entry.stringOffset + entry.stringSize > stringsSize ||
+                    entry.postingsOffset < sizeof(SegmentHeader) ||
+                    entry.postingsOffset + entry.postingsSize > header.termsOffset) {
+                    return nullptr;
+                }
+            }
+            return segment;
+        }
+    };
+
+    MessageIndex::MessageIndex(std::string dir, uint32_t segmentDocs)
+            : _dir(std::move(dir)), _segmentDocs(std::max<uint32_t>(segmentDocs, 1)) {
+        mkdir(_dir.c_str(), 0700);
+        _docsFd = open((_dir + "/docs").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        _offsetsFd = open((_dir + "/docs.idx").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (!ok()) {
+            return;
+        }
+        struct stat st{};
+        fstat(_offsetsFd, &st);
+        _offsets.resize((size_t) st.st_size / sizeof(uint64_t));
+        if (pread(_offsetsFd, _offsets.data(), _offsets.size() * sizeof(uint64_t), 0) !=
+            (ssize_t) (_offsets.size() * sizeof(uint64_t))) {
+            _offsets.clear();
+        }
+        fstat(_docsFd, &st);
+        // a write cut short leaves a record (or an offset) behind that is not whole; both files end at the last
+        // whole record again
+        uint64_t docsEnd = 0;
+        while (!_offsets.empty()) {
+            uint32_t recordSize = 0;
+            auto offset = _offsets.back();
+            if (pread(_docsFd, &recordSize, sizeof(recordSize), (off_t) offset) == (ssize_t) sizeof(recordSize) &&
+                offset + sizeof(recordSize) + recordSize <= (uint64_t) st.st_size) {
+                docsEnd = offset + sizeof(recordSize) + recordSize;
+                break;
+            }
+            _offsets.pop_back();
+        }
+        if (ftruncate(_docsFd, (off_t) docsEnd) != 0 ||
+            ftruncate(_offsetsFd, (off_t) (_offsets.size() * sizeof(uint64_t))) != 0) {
+            close(_docsFd);
+            close(_offsetsFd);
+            _docsFd = _offsetsFd = -1;
+            _offsets.clear();
+            return;
+        }
+        _docsSize = docsEnd;
+        _docCount = (uint32_t) _offsets.size();
+
+        open_segments();
+        reindex_tail(read_covered());
+    }
+
+    MessageIndex::~MessageIndex() {
+        if (_build.valid()) {
+            _build.wait();  // its segments are found again when the index is next opened
+        }
+        if (_docsFd >= 0) {
+            close(_docsFd);
+        }
+        if (_offsetsFd >= 0) {
+            close(_offsetsFd);
+        }
+    }
+
+    void MessageIndex::open_segments() {
+        std::vector<std::unique_ptr<Segment>> found;
+        if (DIR *dir = opendir(_dir.c_str())) {
+            while (dirent *entry = readdir(dir)) {
+                std::string_view name(entry->d_name);
+                if (!name.starts_with(segment_prefix) || name.ends_with(".tmp")) {
+                    continue;
+                }
+                auto path = _dir + "/" + std::string(name);
+                if (auto segment = Segment::open(path)) {
+                    found.push_back(std::move(segment));
+                } else {
+                    unlink(path.c_str());
+                }
+            }
+            closedir(dir);
+        }
+        // a merge that did not get to remove its inputs leaves segments behind that a larger one covers
+        std::sort(found.begin(), found.end(), [](const auto &a, const auto &b) {
+            return a->header.docBase != b->header.docBase ? a->header.docBase < b->header.docBase
+                                                          : a->header.docCount > b->header.docCount;
+        });
+        uint32_t next = 0;
+        for (auto &segment: found) {
+            auto end = (uint64_t) segment->header.docBase + segment->header.docCount;
+            if (segment->header.docBase == next && end <= _docCount) {
+                next = (uint32_t) end;
+                _segments.push_back(std::move(segment));
+            } else {
+                unlink(segment->path.c_str());
+            }
+        }
+        _sealedBase = _liveBase = next;
+    }
+
+    uint32_t MessageIndex::read_covered() {
+        int fd = open((_dir + "/covered").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return 0;
+        }
+        std::string data;
+        char buffer[65536];
+        for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0;) {
+            data.append(buffer, (size_t) n);
+        }
+        close(fd);
+
+        Cursor cursor{data};
+        char magic[8];
+        for (auto &c: magic) {
+            c = cursor.get<char>();
+        }
+        auto version = cursor.get<uint32_t>();
+        auto coveredDocs = cursor.get<uint32_t>();
+        auto conversations = cursor.get<uint32_t>();
+        if (!cursor.ok || std::memcmp(magic, covered_magic, sizeof(magic)) != 0 || version != index_version) {
+            return 0;
+        }
+        std::map<std::string, DeliveredRanges> covered;
+        for (uint32_t i = 0; i < conversations && cursor.ok; ++i) {
+            auto &ranges = covered[std::string(cursor.get_string())];
+            auto count = cursor.get<uint32_t>();
+            for (uint32_t j = 0; j < count && cursor.ok; ++j) {
+                HistoryPosition lo{cursor.get<int64_t>(), cursor.get<uint32_t>()};
+                HistoryPosition hi{cursor.get<int64_t>(), cursor.get<uint32_t>()};
+                ranges.insert(lo, hi);
+            }
+        }
+        if (!cursor.ok) {
+            return 0;
+        }
+        _covered = std::move(covered);
+        return coveredDocs;
+    }
+
+    bool MessageIndex::write_covered() {
+        std::string out(covered_magic, sizeof(covered_magic));
+        put<uint32_t>(out, index_version);
+        put<uint32_t>(out, _docCount);
+        put<uint32_t>(out, (uint32_t) _covered.size());
+        for (auto &[conversation, ranges]: _covered) {
+            put_string(out, conversation);
+            put<uint32_t>(out, (uint32_t) ranges.ranges().size());
+            for (auto &[lo, hi]: ranges.ranges()) {
+                put<int64_t>(out, lo.timestampNs);
+                put<uint32_t>(out, lo.ordinal);
+                put<int64_t>(out, hi.timestampNs);
+                put<uint32_t>(out, hi.ordinal);
+            }
+        }
+        return write_file(_dir + "/covered", out);
+    }
+
+    // Documents past the last segment go back into the in-memory segment; those past the persisted ranges are
+    // marked as covered one by one (which pages they came in is not known any more)
+    void MessageIndex::reindex_tail(uint32_t coveredDocs) {
+        auto first = std::min(_liveBase, coveredDocs);
+        if (first >= _docCount) {
+            return;
+        }
+        auto start = _offsets[first];
+        auto size = (size_t) (_docsSize - start);
+        std::string data(size, '\0');
+        if (pread(_docsFd, data.data(), size, (off_t) start) != (ssize_t) size) {
+            return;
+        }
+        for (auto doc = first; doc < _docCount; ++doc) {
+            auto offset = (size_t) (_offsets[doc] - start);
+            uint32_t recordSize;
+            std::memcpy(&recordSize, data.data() + offset, sizeof(recordSize));
+            auto parsed = parse_doc(std::string_view(data).substr(offset + sizeof(recordSize), recordSize));
+            if (!parsed.has_value()) {
+                continue;
+            }
+            if (doc >= _liveBase) {
+                index_doc(doc, parsed->text);
+            }
+            if (doc >= coveredDocs && !(parsed->flags & doc_sent)) {
+                HistoryPosition position{parsed->timestampNs, parsed->ordinal};
+                _covered[std::string(parsed->conversation)].insert(position, position);
+            }
+        }
+    }
+
+    void MessageIndex::index_doc(uint32_t doc, std::string_view text) {
+        auto folded = fold_for_search(text);
+        for_each_word(folded, [&](std::string_view word) {
+            if (word.size() > max_term_bytes) {
+                return;
+            }
+            auto &docs = _live[std::string(word)];
+            if (docs.empty() || docs.back() != doc) {
+                docs.push_back(doc);
+            }
+        });
+    }
+
+    void MessageIndex::append_doc(const std::string &conversation, const Message &message, bool sent) {
+        auto offset = _docsSize + _docsBuffer.size();
+        std::string record;
+        put<uint8_t>(record, sent ? doc_sent : 0);
+        put<int64_t>(record, message.timestamp_ns);
+        put<uint32_t>(record, message.ordinal);
+        put_string(record, conversation);
+        put_string(record, message.senderId ? message.senderId.str() : "");
+        put_string(record, message.message);
+        put<uint32_t>(_docsBuffer, (uint32_t) record.size());
+        _docsBuffer += record;
+        put<uint64_t>(_offsetsBuffer, offset);
+        _offsets.push_back(offset);
+        index_doc(_docCount++, message.message);
+    }
+
+    bool MessageIndex::write_docs() {
+        if (_docsBuffer.empty()) {
+            return true;
+        }
+        // records first: an offset never points past the end of the store
+        if (!write_all(_docsFd, _docsBuffer)) {
+            // drop whatever made it out; the buffers are kept and go out again with the next write
+            if (ftruncate(_docsFd, (off_t) _docsSize) != 0) {
+                close(_docsFd);  // the offsets no longer match the store: stop here (ok() is false from now on)
+                _docsFd = -1;
+            }
+            return false;
+        }
+        _docsSize += _docsBuffer.size();
+        _docsBuffer.clear();
+        bool ok = write_all(_offsetsFd, _offsetsBuffer);
+        _offsetsBuffer.clear();  // a torn offsets file is repaired when the index is opened
+        step_build();
+        return ok;
+    }
+
+    void MessageIndex::step_build() {
+        if (_build.valid()) {
+            if (_build.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return;
+            }
+            if (auto segments = _build.get()) {
+                _segments = std::move(segments.value());
+                write_covered();
+            } else {
+                // the sealed documents go back into the in-memory segment and out again with the next build
+                for (auto &[term, docs]: *_sealed) {
+                    auto &liveDocs = _live[term];
+                    liveDocs.insert(liveDocs.begin(), docs.begin(), docs.end());
+                }
+                _liveBase = _sealedBase;
+            }
+            _sealed.reset();
+            _sealedBase = _liveBase;
+        }
+        if (_docCount - _liveBase < _segmentDocs) {
+            return;
+        }
+        _sealed = std::make_shared<const Postings>(std::move(_live));
+        _live.clear();
+        _liveBase = _docCount;
+        // the worker only reads what it is handed (and _dir); _segments is not touched until the build is taken
+        _build = std::async(std::launch::async, [this, segments = _segments, sealed = _sealed,
+                docBase = _sealedBase, docCount = _docCount - _sealedBase]() mutable {
+            return build_segments(std::move(segments), *sealed, docBase, docCount);
+        });
+    }
+
+    void MessageIndex::add_page(const std::string &conversation, std::span<const Message> messages) {
+        if (!ok() || messages.empty()) {
+            return;
+        }
+        auto &covered = _covered[conversation];
+        auto lo = messages.front().position(), hi = lo;
+        for (auto &message: messages) {
+            lo = std::min(lo, message.position());
+            hi = std::max(hi, message.position());
+            if (!covered.contains(message.position())) {
+                append_doc(conversation, message, false);
+            }
+        }
+        covered.insert(lo, hi);
+        write_docs();
+    }
+
+    void MessageIndex::add_sent(const std::string &conversation, std::string_view text, int64_t timestampNs) {
+        if (!ok()) {
+            return;
+        }
+        append_doc(conversation, {SteamId(), std::string(text), timestampNs, 0}, true);
+        write_docs();
+    }
+
+    std::unique_ptr<MessageIndex::Segment>
+    MessageIndex::write_segment_file(uint32_t docBase, uint32_t docCount, const std::string &data) const {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%.*s%010u-%010u", (int) segment_prefix.size(), segment_prefix.data(),
+                      docBase, docCount);
+        auto path = _dir + "/" + name;
+        if (!write_file(path, data)) {
+            return nullptr;
+        }
+        return Segment::open(path);
+    }
+
+    namespace {
+        // builds a segment file from terms in ascending order, each with its ascending documents
+        class SegmentWriter {
+        public:
+            SegmentWriter(uint32_t docBase, uint32_t docCount) : _docBase(docBase), _docCount(docCount) {
+                _out.resize(sizeof(SegmentHeader));
+            }
+
+            void add(std::string_view term, const std::vector<uint32_t> &docs) {
+                TermEntry entry{};
+                entry.stringOffset = (uint32_t) _strings.size();
+                entry.stringSize = (uint32_t) term.size();
+                entry.postingsOffset = _out.size();
+                entry.postingsCount = (uint32_t) docs.size();
+                auto previous = _docBase;
+                for (auto doc: docs) {
+                    put_varint(_out, doc - previous);
+                    previous = doc;
+                }
+                entry.postingsSize = (uint32_t) (_out.size() - entry.postingsOffset);
+                _strings += term;
+                _terms.push_back(entry);
+            }
+
+            std::string finish() {
+                _out.resize((_out.size() + alignof(TermEntry) - 1) / alignof(TermEntry) * alignof(TermEntry));
+                SegmentHeader header{};
+                std::memcpy(header.magic, segment_magic, sizeof(header.magic));
+                header.version = index_version;
+                header.docBase = _docBase;
+                header.docCount = _docCount;
+                header.termCount = (uint32_t) _terms.size();
+                header.termsOffset = _out.size();
+                _out.append(reinterpret_cast<const char *>(_terms.data()), _terms.size() * sizeof(TermEntry));
+                header.stringsOffset = _out.size();
+                _out += _strings;
+                header.size = _out.size();
+                std::memcpy(_out.data(), &header, sizeof(header));
+                return std::move(_out);
+            }
+
+        private:
+            uint32_t _docBase, _docCount;
+            std::string _out;
+            std::vector<TermEntry> _terms;
+            std::string _strings;
+        };
+    }
+
+    std::optional<MessageIndex::Segments>
+    MessageIndex::build_segments(Segments segments, const Postings &sealed, uint32_t docBase,
+                                 uint32_t docCount) const {
+        std::vector<const Postings::value_type *> terms;
+        terms.reserve(sealed.size());
+        for (auto &entry: sealed) {
+            terms.push_back(&entry);
+        }
+        std::sort(terms.begin(), terms.end(), [](auto *a, auto *b) { return a->first < b->first; });
+        SegmentWriter writer(docBase, docCount);
+        for (auto *term: terms) {
+            writer.add(term->first, term->second);
+        }
+        auto segment = write_segment_file(docBase, docCount, writer.finish());
+        if (segment == nullptr) {
+            return std::nullopt;
+        }
+        segments.push_back(std::move(segment));
+
+        // binary-counter merging: the segment sizes stay roughly powers of two, each document is rewritten
+        // O(log n) times over the life of the index. Unlinking the inputs is fine while searches still read them,
+        // their mappings stay valid until the last reference goes.
+        while (segments.size() >= 2) {
+            auto &older = *segments[segments.size() - 2];
+            auto &newer = *segments.back();
+            if (newer.header.docCount < older.header.docCount && segments.size() <= max_segments) {
+                break;
+            }
+            auto merged = merge(older, newer);
+            if (merged == nullptr) {
+                break;
+            }
+            unlink(older.path.c_str());
+            unlink(newer.path.c_str());
+            segments.pop_back();
+            segments.back() = std::move(merged);
+        }
+        return segments;
+    }
+
+    std::unique_ptr<MessageIndex::Segment> MessageIndex::merge(const Segment &older, const Segment &newer) const {
+        // both dictionaries are sorted and newer's documents all come after older's, so this is a single merge pass
+        SegmentWriter writer(older.header.docBase, older.header.docCount + newer.header.docCount);
+        std::vector<uint32_t> docs;
+        uint32_t i = 0, j = 0;
+        while (i < older.header.termCount || j < newer.header.termCount) {
+            docs.clear();
+            std::string_view term;
+            if (j == newer.header.termCount || (i < older.header.termCount && older.term(i) <= newer.term(j))) {
+                term = older.term(i);
+                older.decode(i++, docs);
+                if (j < newer.header.termCount && newer.term(j) == term) {
+                    newer.decode(j++, docs);
+                }
+            } else {
+                term = newer.term(j);
+                newer.decode(j++, docs);
+            }
+            writer.add(term, docs);
+        }
+        return write_segment_file(older.header.docBase, older.header.docCount + newer.header.docCount,
+                                  writer.finish());
+    }
+
+    std::vector<uint32_t> MessageIndex::postings(const Segment &segment, std::string_view term, bool prefix) const {
+        std::vector<uint32_t> docs;
+        auto i = segment.lower_bound(term);
+        if (!prefix) {
+            if (i < segment.header.termCount && segment.term(i) == term) {
+                segment.decode(i, docs);
+            }
+            return docs;
+        }
+        size_t lists = 0;
+        for (; i < segment.header.termCount && segment.term(i).starts_with(term); ++i, ++lists) {
+            segment.decode(i, docs);
+        }
+        if (lists > 1) {
+            sort_unique(docs);
+        }
+        return docs;
+    }
+
+    std::vector<uint32_t> MessageIndex::live_postings(const Postings &live, std::string_view term, bool prefix) {
+        if (!prefix) {
+            auto it = live.find(std::string(term));
+            return it == live.end() ? std::vector<uint32_t>{} : it->second;
+        }
+        std::vector<uint32_t> docs;
+        size_t lists = 0;
+        for (auto &[word, wordDocs]: live) {
+            if (word.starts_with(term)) {
+                docs.insert(docs.end(), wordDocs.begin(), wordDocs.end());
+                ++lists;
+            }
+        }
+        if (lists > 1) {
+            sort_unique(docs);
+        }
+        return docs;
+    }
+
+    std::optional<MessageIndex::Hit> MessageIndex::read_doc(uint32_t doc) const {
+        auto offset = _offsets[doc];
+        uint32_t recordSize = 0;
+        if (pread(_docsFd, &recordSize, sizeof(recordSize), (off_t) offset) != (ssize_t) sizeof(recordSize)) {
+            return std::nullopt;
+        }
+        std::string record(recordSize, '\0');
+        if (pread(_docsFd, record.data(), recordSize, (off_t) (offset + sizeof(recordSize))) != (ssize_t) recordSize) {
+            return std::nullopt;
+        }
+        auto parsed = parse_doc(record);
+        if (!parsed.has_value()) {
+            return std::nullopt;
+        }
+        return Hit{std::string(parsed->conversation),
+                   {SteamId::parse(parsed->senderId), std::string(parsed->text), parsed->timestampNs, parsed->ordinal}};
+    }
+
+    std::vector<MessageIndex::Hit> MessageIndex::search(std::string_view query, size_t limit) const {
+        auto folded = fold_for_search(query);
+        std::vector<std::string_view> terms;
+        for_each_word(folded, [&](std::string_view term) {
+            terms.push_back(term.substr(0, max_term_bytes));
+        });
+        if (terms.empty() || limit == 0 || !ok()) {
+            return {};
+        }
+
+        // newest documents first: the in-memory segment, the sealed one, then the segments from the newest on, until
+        // enough match
+        std::vector<uint32_t> found;
+        auto collect = [&](auto &&lookup) {
+            std::vector<uint32_t> docs;
+            for (size_t i = 0; i < terms.size(); ++i) {
+                auto termDocs = lookup(terms[i], i + 1 == terms.size());
+                if (i == 0) {
+                    docs = std::move(termDocs);
+                } else {
+                    intersect(docs, termDocs);
+                }
+                if (docs.empty()) {
+                    return;
+                }
+            }
+            for (auto it = docs.rbegin(); it != docs.rend() && found.size() < limit; ++it) {
+                found.push_back(*it);
+            }
+        };
+        collect([&](std::string_view term, bool prefix) { return live_postings(_live, term, prefix); });
+        if (_sealed != nullptr && found.size() < limit) {
+            collect([&](std::string_view term, bool prefix) { return live_postings(*_sealed, term, prefix); });
+        }
+        for (auto it = _segments.rbegin(); it != _segments.rend() && found.size() < limit; ++it) {
+            collect([&](std::string_view term, bool prefix) { return postings(**it, term, prefix); });
+        }
+
+        std::vector<Hit> hits;
+        hits.reserve(found.size());
+        for (auto doc: found) {
+            if (auto hit = read_doc(doc)) {
+                hits.push_back(std::move(hit.value()));
+            }
+        }
+        std::stable_sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b) {
+            return a.message.position() > b.message.position();
+        });
+        return hits;
+    }
+
+    bool MessageIndex::flush() {
+        if (!ok()) {
+            return false;
+        }
+        return write_docs() && write_covered();
+    }
+} // SteamClient
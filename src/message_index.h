@@ -0,0 +1,147 @@
+#ifndef PIDGIN_STEAM_MESSAGE_INDEX_H
+#define PIDGIN_STEAM_MESSAGE_INDEX_H
+
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "grpc_client_wrapper.h"
+#include "history_sync.h"
+
+namespace SteamClient {
+    /*
+     * Full-text index over the friend conversations of one account, kept in a directory of its own.
+     *
+     * Messages are appended to a document store (`docs`, located through the fixed-size offsets in `docs.idx`) and
+     * their words, folded as by fold_for_search, go into an in-memory segment. Every `segmentDocs` documents that
+     * segment is written out as an immutable segment file: a sorted term dictionary and delta/varint encoded posting
+     * lists, searched in place through a read-only mapping. The newest segment is merged into the one
+     * before it while it is at least as large, so an index of n documents has O(log n) segments.
+     *
+     * Writing and merging segment files happens on a worker thread, one build at a time: the full in-memory segment
+     * is sealed (and still searched) while a fresh one takes new documents, and the calls that add documents swap the
+     * finished segments in. A merge of the largest segments never holds up the caller.
+     *
+     * Segments only ever cover a prefix of the store; whatever is past the last one (e.g. after a crash) is indexed
+     * again from the store when the index is opened.
+     */
+    class MessageIndex {
+    public:
+        struct Hit {
+            std::string conversation;  // SteamID of the friend
+            Message message;  // senderId is the invalid SteamId for messages sent from this client
+
+            [[nodiscard]] bool sent() const {
+                return message.senderId != SteamId::parse(conversation);
+            }
+        };
+
+        explicit MessageIndex(std::string dir, uint32_t segmentDocs = 65536);
+
+        ~MessageIndex();
+
+        MessageIndex(const MessageIndex &) = delete;
+
+        MessageIndex &operator=(const MessageIndex &) = delete;
+
+        // false if the directory could not be opened; the index then stays empty and ignores additions
+        [[nodiscard]] bool ok() const {
+            return _docsFd >= 0 && _offsetsFd >= 0;
+        }
+
+        // indexes a contiguous run of a conversation's history (one page of it), skipping messages that an earlier
+        // run already covered, so re-delivered and re-paged history is indexed once
+        void add_page(const std::string &conversation, std::span<const Message> messages);
+
+        // a message sent from this client; its echo is never delivered, so it is indexed under the local send time
+        void add_sent(const std::string &conversation, std::string_view text, int64_t timestampNs);
+
+        // the most recently indexed messages containing every word of the query, the last one as a prefix (so that
+        // "gg wp" is found while typing "gg w"); newest message first
+        [[nodiscard]] std::vector<Hit> search(std::string_view query, size_t limit) const;
+
+        // persists which history has been indexed; the in-memory segment is not written out, it is rebuilt from the
+        // store when the index is next opened. False on I/O errors.
+        bool flush();
+
+        [[nodiscard]] uint32_t size() const {
+            return _docCount;
+        }
+
+        [[nodiscard]] size_t segmentCount() const {
+            return _segments.size();
+        }
+
+    private:
+        struct Segment;
+        using Postings = std::unordered_map<std::string, std::vector<uint32_t>>;  // term -> ascending documents
+        using Segments = std::vector<std::shared_ptr<const Segment>>;
+
+        void open_segments();
+
+        // returns the number of documents the persisted ranges account for
+        uint32_t read_covered();
+
+        bool write_covered();
+
+        void index_doc(uint32_t doc, std::string_view text);
+
+        void reindex_tail(uint32_t coveredDocs);
+
+        void append_doc(const std::string &conversation, const Message &message, bool sent);
+
+        bool write_docs();
+
+        // swaps in the segments of a finished build; then seals the in-memory segment and starts building it if it
+        // is full and no build is running
+        void step_build();
+
+        // runs on the worker thread: `segments` with the sealed documents written out as a new segment and merged;
+        // nullopt if a file could not be written
+        std::optional<Segments> build_segments(Segments segments, const Postings &sealed, uint32_t docBase,
+                                               uint32_t docCount) const;
+
+        std::unique_ptr<Segment> write_segment_file(uint32_t docBase, uint32_t docCount, const std::string &data) const;
+
+        std::unique_ptr<Segment> merge(const Segment &older, const Segment &newer) const;
+
+        [[nodiscard]] std::optional<Hit> read_doc(uint32_t doc) const;
+
+        // ascending documents matching `term` exactly, or any term starting with it
+        [[nodiscard]] std::vector<uint32_t> postings(const Segment &segment, std::string_view term, bool prefix) const;
+
+        // the same over an in-memory segment
+        [[nodiscard]] static std::vector<uint32_t> live_postings(const Postings &live, std::string_view term,
+                                                                 bool prefix);
+
+        std::string _dir;
+        uint32_t _segmentDocs;
+        int _docsFd = -1;
+        int _offsetsFd = -1;
+        uint64_t _docsSize = 0;
+        uint32_t _docCount = 0;
+        std::vector<uint64_t> _offsets;  // of each document in the store
+
+        // appended by add_page/add_sent, written before they return
+        std::string _docsBuffer;
+        std::string _offsetsBuffer;
+
+        Segments _segments;  // oldest first, covering documents [0, _sealedBase)
+        uint32_t _sealedBase = 0;
+        std::shared_ptr<const Postings> _sealed;  // documents [_sealedBase, _liveBase) while _build runs
+        std::future<std::optional<Segments>> _build;
+        uint32_t _liveBase = 0;
+        Postings _live;  // documents >= _liveBase
+
+        // per conversation, the history positions already indexed
+        std::map<std::string, DeliveredRanges> _covered;
+    };
+} // SteamClient
+
+#endif //PIDGIN_STEAM_MESSAGE_INDEX_H
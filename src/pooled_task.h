@@ -0,0 +1,403 @@
+#ifndef PIDGIN_STEAM_POOLED_TASK_H
+#define PIDGIN_STEAM_POOLED_TASK_H
+
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include "cppcoro/broken_promise.hpp"
+
+struct FramePoolStats {
+    uint64_t allocations = 0;      // frames handed out (pooled or not)
+    uint64_t deallocations = 0;
+    uint64_t poolHits = 0;         // allocations served from a freelist
+    uint64_t heapAllocations = 0;  // allocations that went to ::operator new
+    uint64_t heapFrees = 0;        // deallocations that went to ::operator delete
+    uint64_t bytesInUse = 0;
+    uint64_t bytesCached = 0;      // bytes parked on freelists
+};
+
+/*
+ * Size-class freelist allocator for coroutine frames.
+ *
+ * Frames are rounded up to a multiple of `granularity` and recycled through one freelist per class. Frames larger
+ * than the biggest class go straight to the heap. Each thread has its own pool (see `local()`), so no locking is
+ * needed on the allocating thread.
+ *
+ * Every frame starts with a small header naming the pool it came from, and always goes back to that pool. A frame
+ * freed on another thread (e.g. on the pump thread in steam_close) is not recycled: it goes to the heap and is
+ * counted in its own pool's statistics through two atomics, which the owning thread folds in when it reads them. A
+ * pool outlives its thread for as long as frames it handed out are alive elsewhere.
+ */
+class FramePool {
+public:
+    static constexpr size_t granularity = 64;
+    static constexpr size_t class_count = 32;  // classes cover blocks (header included) up to 2 KiB
+    static constexpr size_t max_cached_per_class = 256;
+
+    FramePool(const FramePool &) = delete;
+
+    FramePool &operator=(const FramePool &) = delete;
+
+    static FramePool &local() {
+        thread_local Handle handle;
+        return *handle.pool;
+    }
+
+    void *allocate(size_t size) {
+        _refs.fetch_add(1, std::memory_order_relaxed);
+        ++_stats.allocations;
+        size += sizeof(Header);
+        auto cls = size_class(size);
+        void *block;
+        if (cls >= class_count) {
+            ++_stats.heapAllocations;
+            _stats.bytesInUse += size;
+            block = ::operator new(size);
+        } else {
+            auto blockSize = (cls + 1) * granularity;
+            _stats.bytesInUse += blockSize;
+            if (auto *cached = _freelists[cls]) {
+                _freelists[cls] = cached->next;
+                --_cached[cls];
+                _stats.bytesCached -= blockSize;
+                ++_stats.poolHits;
+                block = cached;
+            } else {
+                ++_stats.heapAllocations;
+                block = ::operator new(blockSize);
+            }
+        }
+        auto *header = static_cast<Header *>(block);
+        header->owner = this;
+        return header + 1;
+    }
+
+    // returns the frame to the pool that allocated it, whichever thread this runs on
+    static void deallocate(void *ptr, size_t size) noexcept {
+        auto *header = static_cast<Header *>(ptr) - 1;
+        auto *owner = header->owner;
+        size += sizeof(Header);
+        if (owner == current()) {
+            owner->free_local(header, size);
+        } else {
+            owner->free_remote(header, size);
+        }
+        owner->release();
+    }
+
+    // frees on other threads are folded in here, so call it on the pool's own thread
+    [[nodiscard]] const FramePoolStats &stats() {
+        collect_remote();
+        return _stats;
+    }
+
+    void reset_stats() {
+        collect_remote();
+        auto cached = _stats.bytesCached;
+        auto inUse = _stats.bytesInUse;
+        _stats = {};
+        _stats.bytesCached = cached;
+        _stats.bytesInUse = inUse;
+    }
+
+private:
+    struct alignas(std::max_align_t) Header {
+        FramePool *owner;
+    };
+
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    // the thread's reference to its pool; dropped (with the cached blocks) when the thread exits
+    struct Handle {
+        FramePool *pool;
+
+        Handle() : pool(new FramePool) {
+            current() = pool;
+        }
+
+        ~Handle() {
+            current() = nullptr;
+            pool->trim();
+            pool->release();
+        }
+    };
+
+    FramePool() = default;
+
+    ~FramePool() {
+        trim();
+    }
+
+    static FramePool *&current() {
+        thread_local FramePool *pool = nullptr;
+        return pool;
+    }
+
+    static constexpr size_t size_class(size_t size) {
+        return size == 0 ? 0 : (size - 1) / granularity;
+    }
+
+    static constexpr size_t block_size(size_t size) {
+        auto cls = size_class(size);
+        return cls >= class_count ? size : (cls + 1) * granularity;
+    }
+
+    void free_local(void *block, size_t size) noexcept {
+        ++_stats.deallocations;
+        auto cls = size_class(size);
+        _stats.bytesInUse -= block_size(size);
+        if (cls >= class_count || _cached[cls] >= max_cached_per_class) {
+            ++_stats.heapFrees;
+            ::operator delete(block);
+            return;
+        }
+        auto *cached = static_cast<FreeBlock *>(block);
+        cached->next = _freelists[cls];
+        _freelists[cls] = cached;
+        ++_cached[cls];
+        _stats.bytesCached += block_size(size);
+    }
+
+    void free_remote(void *block, size_t size) noexcept {
+        ::operator delete(block);
+        _remoteFrees.fetch_add(1, std::memory_order_relaxed);
+        _remoteBytes.fetch_add(block_size(size), std::memory_order_relaxed);
+    }
+
+    void collect_remote() {
+        auto frees = _remoteFrees.exchange(0, std::memory_order_relaxed);
+        _stats.deallocations += frees;
+        _stats.heapFrees += frees;
+        _stats.bytesInUse -= _remoteBytes.exchange(0, std::memory_order_relaxed);
+    }
+
+    // one reference for the thread, one per frame handed out
+    void release() noexcept {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    void trim() noexcept {
+        for (size_t cls = 0; cls < class_count; ++cls) {
+            while (auto *block = _freelists[cls]) {
+                _freelists[cls] = block->next;
+                ::operator delete(block);
+            }
+            _stats.bytesCached -= _cached[cls] * (cls + 1) * granularity;
+            _cached[cls] = 0;
+        }
+    }
+
+    std::array<FreeBlock *, class_count> _freelists{};
+    std::array<size_t, class_count> _cached{};
+    FramePoolStats _stats;
+    std::atomic<size_t> _refs{1};
+    std::atomic<uint64_t> _remoteFrees{0};
+    std::atomic<uint64_t> _remoteBytes{0};
+};
+
+template<typename T = void>
+class PooledTask;
+
+namespace detail {
+    class pooled_task_promise_base {
+        struct final_awaitable {
+            bool await_ready() const noexcept { return false; }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> coro) noexcept {
+                auto continuation = coro.promise()._continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+    public:
+        static void *operator new(size_t size) {
+            return FramePool::local().allocate(size);
+        }
+
+        static void operator delete(void *ptr, size_t size) noexcept {
+            FramePool::deallocate(ptr, size);
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        final_awaitable final_suspend() noexcept { return {}; }
+
+        void set_continuation(std::coroutine_handle<> continuation) noexcept {
+            _continuation = continuation;
+        }
+
+    private:
+        std::coroutine_handle<> _continuation;
+    };
+
+    template<typename T>
+    class pooled_task_promise final : public pooled_task_promise_base {
+    public:
+        PooledTask<T> get_return_object() noexcept;
+
+        void unhandled_exception() noexcept {
+            _result.template emplace<2>(std::current_exception());
+        }
+
+        template<typename Value, typename = std::enable_if_t<std::is_convertible_v<Value &&, T>>>
+        void return_value(Value &&value) noexcept(std::is_nothrow_constructible_v<T, Value &&>) {
+            _result.template emplace<1>(std::forward<Value>(value));
+        }
+
+        T &result() & {
+            rethrow_if_exception();
+            return std::get<1>(_result);
+        }
+
+        T &&result() && {
+            rethrow_if_exception();
+            return std::move(std::get<1>(_result));
+        }
+
+    private:
+        void rethrow_if_exception() {
+            if (_result.index() == 2) {
+                std::rethrow_exception(std::get<2>(_result));
+            }
+        }
+
+        std::variant<std::monostate, T, std::exception_ptr> _result;
+    };
+
+    template<>
+    class pooled_task_promise<void> final : public pooled_task_promise_base {
+    public:
+        PooledTask<void> get_return_object() noexcept;
+
+        void unhandled_exception() noexcept {
+            _exception = std::current_exception();
+        }
+
+        void return_void() noexcept {}
+
+        void result() {
+            if (_exception) {
+                std::rethrow_exception(_exception);
+            }
+        }
+
+    private:
+        std::exception_ptr _exception;
+    };
+}
+
+/*
+ * Lazily-started task with the same semantics as cppcoro::task, but whose coroutine frame is allocated from the
+ * calling thread's FramePool. Use it for short-lived coroutines that are created on every poll tick.
+ */
+template<typename T>
+class [[nodiscard]] PooledTask {
+public:
+    using promise_type = detail::pooled_task_promise<T>;
+    using value_type = T;
+
+private:
+    struct awaitable_base {
+        std::coroutine_handle<promise_type> _coroutine;
+
+        explicit awaitable_base(std::coroutine_handle<promise_type> coroutine) noexcept: _coroutine(coroutine) {}
+
+        bool await_ready() const noexcept {
+            return !_coroutine || _coroutine.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept {
+            _coroutine.promise().set_continuation(awaitingCoroutine);
+            return _coroutine;  // symmetric transfer into the task body
+        }
+    };
+
+public:
+    PooledTask() noexcept = default;
+
+    explicit PooledTask(std::coroutine_handle<promise_type> coroutine) : _coroutine(coroutine) {}
+
+    PooledTask(PooledTask &&other) noexcept: _coroutine(std::exchange(other._coroutine, nullptr)) {}
+
+    PooledTask(const PooledTask &) = delete;
+
+    PooledTask &operator=(const PooledTask &) = delete;
+
+    PooledTask &operator=(PooledTask &&other) noexcept {
+        if (std::addressof(other) != this) {
+            if (_coroutine) {
+                _coroutine.destroy();
+            }
+            _coroutine = std::exchange(other._coroutine, nullptr);
+        }
+        return *this;
+    }
+
+    ~PooledTask() {
+        if (_coroutine) {
+            _coroutine.destroy();
+        }
+    }
+
+    [[nodiscard]] bool is_ready() const noexcept {
+        return !_coroutine || _coroutine.done();
+    }
+
+    auto operator co_await() const & noexcept {
+        struct awaitable : awaitable_base {
+            using awaitable_base::awaitable_base;
+
+            decltype(auto) await_resume() {
+                if (!this->_coroutine) {
+                    throw cppcoro::broken_promise{};  // a moved-from or default-constructed task
+                }
+                return this->_coroutine.promise().result();
+            }
+        };
+        return awaitable{_coroutine};
+    }
+
+    auto operator co_await() const && noexcept {
+        struct awaitable : awaitable_base {
+            using awaitable_base::awaitable_base;
+
+            decltype(auto) await_resume() {
+                if (!this->_coroutine) {
+                    throw cppcoro::broken_promise{};  // a moved-from or default-constructed task
+                }
+                return std::move(this->_coroutine.promise()).result();
+            }
+        };
+        return awaitable{_coroutine};
+    }
+
+private:
+    std::coroutine_handle<promise_type> _coroutine = nullptr;
+};
+
+namespace detail {
+    template<typename T>
+    PooledTask<T> pooled_task_promise<T>::get_return_object() noexcept {
+        return PooledTask<T>{std::coroutine_handle<pooled_task_promise>::from_promise(*this)};
+    }
+
+    inline PooledTask<void> pooled_task_promise<void>::get_return_object() noexcept {
+        return PooledTask<void>{std::coroutine_handle<pooled_task_promise>::from_promise(*this)};
+    }
+}
+
+#endif //PIDGIN_STEAM_POOLED_TASK_H
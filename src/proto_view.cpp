@@ -0,0 +1,185 @@
+#include "proto_view.h"
+#include <cstring>
+
+namespace SteamClient {
+    namespace {
+        // field numbers from message.proto
+        namespace persona_field {
+            constexpr uint32_t id = 1;
+            constexpr uint32_t name = 2;
+            constexpr uint32_t persona_state = 3;
+            constexpr uint32_t gameid = 4;
+            constexpr uint32_t game_extra_info = 5;
+            constexpr uint32_t avatar_url = 6;
+            constexpr uint32_t steam_id = 7;
+        }
+        namespace friends_list_field {
+            constexpr uint32_t user = 1;
+            constexpr uint32_t friends = 2;
+        }
+
+        // the last occurrence wins, as when parsing; empty if absent
+        std::string_view bytes_field(std::string_view message, uint32_t field) {
+            std::string_view value;
+            WireReader reader(message);
+            while (reader.next()) {
+                if (reader.field() == field && reader.type() == WireReader::LENGTH_DELIMITED) {
+                    value = reader.bytes();
+                }
+            }
+            return value;
+        }
+
+        std::optional<uint64_t> number_field(std::string_view message, uint32_t field, WireReader::WireType type) {
+            std::optional<uint64_t> value;
+            WireReader reader(message);
+            while (reader.next()) {
+                if (reader.field() == field && reader.type() == type) {
+                    value = reader.number();
+                }
+            }
+            return value;
+        }
+    }
+
+    bool WireReader::read_varint(uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (_data.empty()) {
+                return false;
+            }
+            auto byte = (uint8_t) _data.front();
+            _data.remove_prefix(1);
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool WireReader::next() {
+        if (!_ok || _data.empty()) {
+            return false;
+        }
+        uint64_t tag;
+        if (!read_varint(tag) || (tag >> 3) == 0 || (tag >> 3) > UINT32_MAX) {
+            _ok = false;
+            return false;
+        }
+        _field = (uint32_t) (tag >> 3);
+        _type = (WireType) (tag & 7);
+        switch (_type) {
+            case VARINT:
+                _ok = read_varint(_number);
+                break;
+            case FIXED64:
+            case FIXED32: {
+                size_t size = _type == FIXED64 ? 8 : 4;
+                _ok = _data.size() >= size;
+                if (_ok) {
+                    _number = 0;
+                    std::memcpy(&_number, _data.data(), size);  // little-endian, like the wire
+                    _data.remove_prefix(size);
+                }
+                break;
+            }
+            case LENGTH_DELIMITED: {
+                uint64_t size;
+                _ok = read_varint(size) && size <= _data.size();
+                if (_ok) {
+                    _bytes = _data.substr(0, size);
+                    _data.remove_prefix(size);
+                }
+                break;
+            }
+            default:
+                _ok = false;  // groups are not used by our protos
+        }
+        return _ok;
+    }
+
+    SteamId PersonaView::id() const {
+        if (auto steamId = number_field(_bytes, persona_field::steam_id, WireReader::FIXED64); steamId.value_or(0)) {
+            return SteamId(steamId.value());
+        }
+        return SteamId::parse(bytes_field(_bytes, persona_field::id));
+    }
+
+    std::string_view PersonaView::name() const {
+        return bytes_field(_bytes, persona_field::name);
+    }
+
+    PersonaState PersonaView::personaState() const {
+        return (PersonaState) (int) number_field(_bytes, persona_field::persona_state, WireReader::VARINT).value_or(0);
+    }
+
+    std::optional<int> PersonaView::gameid() const {
+        auto gameid = number_field(_bytes, persona_field::gameid, WireReader::VARINT);
+        return gameid.has_value() ? std::optional<int>((int32_t) gameid.value()) : std::nullopt;
+    }
+
+    std::string_view PersonaView::gameExtraInfo() const {
+        return bytes_field(_bytes, persona_field::game_extra_info);
+    }
+
+    std::array<std::string_view, 3> PersonaView::avatarUrl() const {
+        std::array<std::string_view, 3> urls;
+        WireReader reader(bytes_field(_bytes, persona_field::avatar_url));
+        while (reader.next()) {
+            if (reader.field() >= 1 && reader.field() <= 3 && reader.type() == WireReader::LENGTH_DELIMITED) {
+                urls[reader.field() - 1] = reader.bytes();
+            }
+        }
+        return urls;
+    }
+
+    Buddy PersonaView::to_buddy() const {
+        auto [icon, medium, full] = avatarUrl();
+        return {std::string(name()), id(), personaState(), gameid(), std::string(gameExtraInfo()),
+                {std::string(icon), std::string(medium), std::string(full)}};
+    }
+
+    FriendsListView::FriendsListView(std::shared_ptr<const void> owner, std::string_view data) {
+        auto decoded = std::make_shared<Decoded>();
+        decoded->owner = std::move(owner);
+        decoded->data = data;
+        WireReader reader(data);
+        std::optional<PersonaView> user;
+        while (reader.next()) {
+            if (reader.type() != WireReader::LENGTH_DELIMITED) {
+                continue;
+            }
+            if (reader.field() == friends_list_field::user) {
+                user.emplace(reader.bytes());
+            } else if (reader.field() == friends_list_field::friends) {
+                decoded->friends.emplace_back(reader.bytes());
+            }
+        }
+        if (!reader.ok()) {
+            decoded->friends.clear();
+        } else {
+            // an unset user decodes as an empty one when fully parsed; the list is still valid
+            decoded->user = user.value_or(PersonaView({}));
+        }
+        _decoded = std::move(decoded);
+    }
+
+    const FriendsListView::Decoded &FriendsListView::decoded() const {
+        static const Decoded failed;
+        return _decoded != nullptr ? *_decoded : failed;
+    }
+
+    FriendsList FriendsListView::to_friends_list() const {
+        auto &[owner, data, user, friends] = decoded();
+        FriendsList list;
+        if (user.has_value()) {
+            list.me = user->to_buddy();
+        }
+        list.buddies.reserve(friends.size());
+        for (auto &persona: friends) {
+            list.buddies.push_back(persona.to_buddy());
+        }
+        return list;
+    }
+} // SteamClient
@@ -0,0 +1,144 @@
+#ifndef PIDGIN_STEAM_PROTO_VIEW_H
+#define PIDGIN_STEAM_PROTO_VIEW_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "grpc_client_wrapper.h"
+
+namespace SteamClient {
+    // steps through the fields of one encoded protobuf message without copying anything out of it
+    class WireReader {
+    public:
+        enum WireType : uint8_t {
+            VARINT = 0,
+            FIXED64 = 1,
+            LENGTH_DELIMITED = 2,
+            FIXED32 = 5,
+        };
+
+        explicit WireReader(std::string_view data) : _data(data) {}
+
+        // moves to the next field; false at the end of the message, or on malformed input (ok() is false then)
+        bool next();
+
+        [[nodiscard]] bool ok() const {
+            return _ok;
+        }
+
+        [[nodiscard]] uint32_t field() const {
+            return _field;
+        }
+
+        [[nodiscard]] WireType type() const {
+            return _type;
+        }
+
+        // value of a VARINT, FIXED64 or FIXED32 field
+        [[nodiscard]] uint64_t number() const {
+            return _number;
+        }
+
+        // contents of a LENGTH_DELIMITED field (string, bytes or nested message), a view into the input
+        [[nodiscard]] std::string_view bytes() const {
+            return _bytes;
+        }
+
+    private:
+        bool read_varint(uint64_t &value);
+
+        std::string_view _data;
+        bool _ok = true;
+        uint32_t _field = 0;
+        WireType _type = VARINT;
+        uint64_t _number = 0;
+        std::string_view _bytes;
+    };
+
+    /*
+     * A steam.Persona decoded on access: every accessor scans the few fields of the encoded message for its own and
+     * returns strings as views into it. Views are valid while the FriendsListView they came from (or a copy) lives.
+     */
+    class PersonaView {
+    public:
+        explicit PersonaView(std::string_view bytes) : _bytes(bytes) {}
+
+        // the compact steamId, or the decimal id of a proxy without compactWire
+        [[nodiscard]] SteamId id() const;
+
+        [[nodiscard]] std::string_view name() const;
+
+        [[nodiscard]] PersonaState personaState() const;
+
+        [[nodiscard]] std::optional<int> gameid() const;
+
+        [[nodiscard]] std::string_view gameExtraInfo() const;
+
+        // icon, medium and full; the nested message is only decoded here
+        [[nodiscard]] std::array<std::string_view, 3> avatarUrl() const;
+
+        // the encoded persona; equal bytes mean nothing about this persona changed
+        [[nodiscard]] std::string_view bytes() const {
+            return _bytes;
+        }
+
+        // the only place the strings of a persona are copied out of the response
+        [[nodiscard]] Buddy to_buddy() const;
+
+    private:
+        std::string_view _bytes;
+    };
+
+    /*
+     * A steam.FriendsListResponse kept in the buffer it was received in (a gRPC slice, when it arrived in one piece).
+     * Construction only walks the top-level fields to find the personas; nothing inside them is decoded until it is
+     * asked for, so a tick that needs IDs and persona states never touches names or avatar URLs. Copies share the
+     * buffer and the persona index (every caller coalesced onto one GetFriendsList gets a copy).
+     */
+    class FriendsListView {
+    public:
+        // a failed call: no user and no friends
+        FriendsListView() = default;
+
+        // `owner` keeps `data` alive
+        FriendsListView(std::shared_ptr<const void> owner, std::string_view data);
+
+        // false for a failed call or a malformed response
+        [[nodiscard]] bool ok() const {
+            return decoded().user.has_value();
+        }
+
+        [[nodiscard]] const std::optional<PersonaView> &user() const {
+            return decoded().user;
+        }
+
+        [[nodiscard]] const std::vector<PersonaView> &friends() const {
+            return decoded().friends;
+        }
+
+        // the whole encoded response; equal bytes mean an unchanged list
+        [[nodiscard]] std::string_view bytes() const {
+            return decoded().data;
+        }
+
+        // decodes everything, e.g. for the account snapshot
+        [[nodiscard]] FriendsList to_friends_list() const;
+
+    private:
+        struct Decoded {
+            std::shared_ptr<const void> owner;
+            std::string_view data;
+            std::optional<PersonaView> user;
+            std::vector<PersonaView> friends;
+        };
+
+        [[nodiscard]] const Decoded &decoded() const;
+
+        std::shared_ptr<const Decoded> _decoded;
+    };
+} // SteamClient
+
+#endif //PIDGIN_STEAM_PROTO_VIEW_H
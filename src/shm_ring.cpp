@@ -0,0 +1,289 @@
+#include "shm_ring.h"
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace SteamClient {
+    namespace {
+        constexpr size_t header_size = (sizeof(ShmRing::Header) + 63) / 64 * 64;
+        constexpr size_t length_prefix = sizeof(uint32_t);
+
+        [[noreturn]] void throw_errno(const char *what) {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        // closes the descriptors on the way out unless release() handed them over
+        class FdsGuard {
+        public:
+            explicit FdsGuard(const ShmRegion::Fds &fds) : _fds(fds) {}
+
+            FdsGuard(const FdsGuard &) = delete;
+
+            FdsGuard &operator=(const FdsGuard &) = delete;
+
+            ~FdsGuard() {
+                if (!_released) {
+                    for (auto fd: {_fds.memfd, _fds.eventfds[0], _fds.eventfds[1]}) {
+                        if (fd >= 0) {
+                            close(fd);
+                        }
+                    }
+                }
+            }
+
+            ShmRegion::Fds &fds() {
+                return _fds;
+            }
+
+            ShmRegion::Fds release() {
+                _released = true;
+                return _fds;
+            }
+
+        private:
+            ShmRegion::Fds _fds;
+            bool _released = false;
+        };
+    }
+
+    ShmRing::ShmRing(void *base, size_t capacity)
+            : _header(static_cast<Header *>(base)), _data(static_cast<char *>(base) + header_size),
+              _capacity(capacity) {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+            throw std::invalid_argument("ShmRing capacity must be a power of two");
+        }
+    }
+
+    size_t ShmRing::region_size(size_t capacity) {
+        return header_size + capacity;
+    }
+
+    void ShmRing::initialize() {
+        new(_header) Header{};
+        _header->capacity = _capacity;
+    }
+
+    size_t ShmRing::max_frame_size() const {
+        return _capacity - length_prefix;
+    }
+
+    bool ShmRing::empty() const {
+        return _header->head.load(std::memory_order_acquire) == _header->tail.load(std::memory_order_acquire);
+    }
+
+    void ShmRing::copy_in(uint64_t position, const void *data, size_t size) {
+        auto offset = position & (_capacity - 1);
+        auto first = std::min(size, _capacity - offset);
+        std::memcpy(_data + offset, data, first);
+        std::memcpy(_data, static_cast<const char *>(data) + first, size - first);
+    }
+
+    void ShmRing::copy_out(uint64_t position, void *data, size_t size) const {
+        auto offset = position & (_capacity - 1);
+        auto first = std::min(size, _capacity - offset);
+        std::memcpy(data, _data + offset, first);
+        std::memcpy(static_cast<char *>(data) + first, _data, size - first);
+    }
+
+    bool ShmRing::try_write(std::string_view frame) {
+        if (frame.size() > max_frame_size()) {
+            throw std::length_error("frame larger than ShmRing capacity");
+        }
+        auto tail = _header->tail.load(std::memory_order_relaxed);
+        auto head = _header->head.load(std::memory_order_acquire);
+        if (_capacity - (tail - head) < length_prefix + frame.size()) {
+            return false;
+        }
+        auto length = (uint32_t) frame.size();
+        copy_in(tail, &length, length_prefix);
+        copy_in(tail + length_prefix, frame.data(), frame.size());
+        _header->tail.store(tail + length_prefix + frame.size(), std::memory_order_seq_cst);
+        return true;
+    }
+
+    bool ShmRing::try_read(std::string &frame) {
+        if (_broken) {
+            return false;
+        }
+        auto head = _header->head.load(std::memory_order_relaxed);
+        auto tail = _header->tail.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+        // everything below comes from the other process: check it before it sizes an allocation or a copy
+        auto available = tail - head;
+        if (available < length_prefix || available > _capacity) {
+            _broken = true;
+            return false;
+        }
+        uint32_t length;
+        copy_out(head, &length, length_prefix);
+        if (length > max_frame_size() || length_prefix + length > available) {
+            _broken = true;
+            return false;
+        }
+        frame.resize(length);
+        copy_out(head + length_prefix, frame.data(), length);
+        _header->head.store(head + length_prefix + length, std::memory_order_seq_cst);
+        return true;
+    }
+
+    std::shared_ptr<ShmRegion> ShmRegion::create(size_t ringCapacity) {
+        if (ringCapacity == 0 || (ringCapacity & (ringCapacity - 1)) != 0) {
+            throw std::invalid_argument("ShmRing capacity must be a power of two");
+        }
+        FdsGuard guard({-1, {-1, -1}});
+        auto &fds = guard.fds();
+        fds.memfd = memfd_create("pidgin-steam-shm", MFD_CLOEXEC);
+        if (fds.memfd < 0) {
+            throw_errno("memfd_create");
+        }
+        for (auto &fd: fds.eventfds) {
+            fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (fd < 0) {
+                throw_errno("eventfd");
+            }
+        }
+        if (ftruncate(fds.memfd, (off_t) (2 * ShmRing::region_size(ringCapacity))) < 0) {
+            throw_errno("ftruncate");
+        }
+        auto region = map(guard.release(), ringCapacity);
+        for (auto &ring: region->_rings) {
+            ring.initialize();
+        }
+        return region;
+    }
+
+    std::shared_ptr<ShmRegion> ShmRegion::attach(Fds fds) {
+        // the descriptors come from another process: nothing about the file is trusted until it is checked
+        FdsGuard guard(fds);
+        auto end = lseek(fds.memfd, 0, SEEK_END);
+        if (end < 0) {
+            throw_errno("lseek");
+        }
+        auto size = (size_t) end;
+        if (size % 2 != 0 || size / 2 <= header_size) {
+            throw std::invalid_argument("shared-memory region does not hold two rings");
+        }
+        auto ringCapacity = size / 2 - header_size;
+        if ((ringCapacity & (ringCapacity - 1)) != 0) {
+            throw std::invalid_argument("ShmRing capacity must be a power of two");
+        }
+        auto region = map(guard.release(), ringCapacity);
+        for (auto &ring: region->_rings) {
+            if (ring.header().capacity != ringCapacity) {
+                throw std::invalid_argument("shared-memory ring capacity does not match the region");
+            }
+        }
+        return region;
+    }
+
+    std::shared_ptr<ShmRegion> ShmRegion::map(Fds fds, size_t ringCapacity) {
+        FdsGuard guard(fds);
+        auto size = 2 * ShmRing::region_size(ringCapacity);
+        void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds.memfd, 0);
+        if (base == MAP_FAILED) {
+            throw_errno("mmap");
+        }
+        // from here on ~ShmRegion unmaps and closes; the constructor cannot throw with a checked capacity
+        return std::shared_ptr<ShmRegion>(new ShmRegion(guard.release(), base, size, ringCapacity));
+    }
+
+    ShmRegion::ShmRegion(Fds fds, void *base, size_t size, size_t ringCapacity)
+            : _fds(fds), _base(base), _size(size),
+              _rings{ShmRing(base, ringCapacity),
+                     ShmRing(static_cast<char *>(base) + ShmRing::region_size(ringCapacity), ringCapacity)} {}
+
+    ShmRegion::~ShmRegion() {
+        munmap(_base, _size);
+        close(_fds.memfd);
+        for (auto fd: _fds.eventfds) {
+            close(fd);
+        }
+    }
+
+    ShmEndpoint::ShmEndpoint(std::shared_ptr<ShmRegion> region, ShmRegion::Side side)
+            : _region(std::move(region)), _side(side), _out(_region->ring(side)),
+              _in(_region->ring(side == ShmRegion::CLIENT ? ShmRegion::PEER : ShmRegion::CLIENT)) {}
+
+    int ShmEndpoint::event_fd() const {
+        return _region->fds().eventfds[_side];
+    }
+
+    void ShmEndpoint::wake(ShmRegion::Side side) const {
+        uint64_t one = 1;
+        [[maybe_unused]] auto written = write(_region->fds().eventfds[side], &one, sizeof(one));
+    }
+
+    bool ShmEndpoint::sleep(std::chrono::milliseconds timeout) const {
+        pollfd fd{event_fd(), POLLIN, 0};
+        if (poll(&fd, 1, (int) timeout.count()) <= 0) {
+            return false;
+        }
+        uint64_t count;
+        [[maybe_unused]] auto read = ::read(event_fd(), &count, sizeof(count));  // reset the counter
+        return true;
+    }
+
+    bool ShmEndpoint::try_send(std::string_view frame) {
+        if (!_out.try_write(frame)) {
+            return false;
+        }
+        if (_out.header().readerWaiting.exchange(0, std::memory_order_seq_cst)) {
+            wake(_side == ShmRegion::CLIENT ? ShmRegion::PEER : ShmRegion::CLIENT);
+        }
+        return true;
+    }
+
+    bool ShmEndpoint::try_receive(std::string &frame) {
+        if (!_in.try_read(frame)) {
+            return false;
+        }
+        if (_in.header().writerWaiting.exchange(0, std::memory_order_seq_cst)) {
+            wake(_side == ShmRegion::CLIENT ? ShmRegion::PEER : ShmRegion::CLIENT);
+        }
+        return true;
+    }
+
+    bool ShmEndpoint::send(std::string_view frame, std::chrono::milliseconds timeout) {
+        while (!try_send(frame)) {
+            // announce that we are about to sleep, then re-check so that a concurrent read cannot be missed
+            _out.header().writerWaiting.store(1, std::memory_order_seq_cst);
+            if (try_send(frame)) {
+                return true;
+            }
+            if (!sleep(timeout)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void ShmEndpoint::wait_readable(std::chrono::milliseconds timeout) {
+        if (!_in.empty()) {
+            return;
+        }
+        _in.header().readerWaiting.store(1, std::memory_order_seq_cst);
+        if (!_in.empty()) {
+            return;
+        }
+        sleep(timeout);
+    }
+
+    bool ShmEndpoint::receive(std::string &frame, std::chrono::milliseconds timeout) {
+        while (!try_receive(frame)) {
+            _in.header().readerWaiting.store(1, std::memory_order_seq_cst);
+            if (try_receive(frame)) {
+                return true;
+            }
+            if (!sleep(timeout)) {
+                return false;
+            }
+        }
+        return true;
+    }
+} // SteamClient
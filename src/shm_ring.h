@@ -0,0 +1,168 @@
+#ifndef PIDGIN_STEAM_SHM_RING_H
+#define PIDGIN_STEAM_SHM_RING_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace SteamClient {
+    /*
+     * Lock-free single-producer/single-consumer ring of length-prefixed frames, laid out in memory that may be shared
+     * between processes. Positions are free-running 64-bit byte counters; frames are copied in and out with at most
+     * two memcpy calls each, wrapping around the end of the data area.
+     *
+     * The `readerWaiting`/`writerWaiting` flags let each side skip the wake-up syscall unless the other side is
+     * actually about to sleep (see ShmEndpoint).
+     */
+    class ShmRing {
+    public:
+        struct Header {
+            alignas(64) std::atomic<uint64_t> head;  // consumer position
+            alignas(64) std::atomic<uint64_t> tail;  // producer position
+            alignas(64) std::atomic<uint32_t> readerWaiting;
+            std::atomic<uint32_t> writerWaiting;
+            uint64_t capacity;
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                      "shared-memory atomics must be address-free");
+
+        ShmRing() = default;
+
+        // `base` points at region_size(capacity) bytes; `capacity` must be a power of two
+        ShmRing(void *base, size_t capacity);
+
+        static size_t region_size(size_t capacity);
+
+        // run once by the side that creates the region
+        void initialize();
+
+        // false if there is not enough free space; the frame is not written in that case
+        bool try_write(std::string_view frame);
+
+        // false if the ring is empty or broken; otherwise replaces the contents of `frame`
+        bool try_read(std::string &frame);
+
+        [[nodiscard]] bool empty() const;
+
+        // set once try_read finds positions or a length prefix the writer cannot have produced; the other process
+        // is not trusted to recover, so nothing is read from the ring after that
+        [[nodiscard]] bool broken() const {
+            return _broken;
+        }
+
+        [[nodiscard]] size_t max_frame_size() const;
+
+        [[nodiscard]] Header &header() const {
+            return *_header;
+        }
+
+    private:
+        void copy_in(uint64_t position, const void *data, size_t size);
+
+        void copy_out(uint64_t position, void *data, size_t size) const;
+
+        Header *_header = nullptr;
+        char *_data = nullptr;
+        size_t _capacity = 0;
+        bool _broken = false;
+    };
+
+    /*
+     * A memfd-backed region holding two ShmRings (one per direction) and the two eventfds used to wake either side.
+     * The creating side is CLIENT; the PEER attaches to the same file descriptors, either in-process or after
+     * inheriting them (fork) or receiving them over a Unix socket (SCM_RIGHTS).
+     */
+    class ShmRegion {
+    public:
+        enum Side {
+            CLIENT = 0,
+            PEER = 1
+        };
+
+        struct Fds {
+            int memfd;
+            std::array<int, 2> eventfds;  // indexed by Side: written to wake that side
+        };
+
+        static std::shared_ptr<ShmRegion> create(size_t ringCapacity = 1 << 20);
+
+        // takes ownership of the descriptors, closing them if they do not hold a region create() could have made
+        // (std::invalid_argument, or std::system_error for a failed call)
+        static std::shared_ptr<ShmRegion> attach(Fds fds);
+
+        ShmRegion(const ShmRegion &) = delete;
+
+        ShmRegion &operator=(const ShmRegion &) = delete;
+
+        ~ShmRegion();
+
+        [[nodiscard]] const Fds &fds() const {
+            return _fds;
+        }
+
+        // ring written by `from`
+        ShmRing &ring(Side from) {
+            return _rings[from];
+        }
+
+    private:
+        // maps two rings of `ringCapacity` (a power of two) from `fds.memfd`; closes the descriptors on failure
+        static std::shared_ptr<ShmRegion> map(Fds fds, size_t ringCapacity);
+
+        ShmRegion(Fds fds, void *base, size_t size, size_t ringCapacity);
+
+        Fds _fds;
+        void *_base;
+        size_t _size;
+        std::array<ShmRing, 2> _rings;
+    };
+
+    /*
+     * One side's view of a ShmRegion: sends on its own ring, receives on the other one, and sleeps on its eventfd.
+     * Each endpoint must be used by a single thread.
+     */
+    class ShmEndpoint {
+    public:
+        ShmEndpoint(std::shared_ptr<ShmRegion> region, ShmRegion::Side side);
+
+        // non-blocking; false if the outgoing ring is full
+        bool try_send(std::string_view frame);
+
+        // blocks (sleeping on the eventfd) while the outgoing ring is full; false on timeout
+        bool send(std::string_view frame, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+        // non-blocking
+        bool try_receive(std::string &frame);
+
+        // blocks until a frame arrives; false on timeout
+        bool receive(std::string &frame, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+        // waits until there may be something to receive; returns immediately if there already is
+        void wait_readable(std::chrono::milliseconds timeout);
+
+        // the incoming ring held a corrupt frame (see ShmRing::broken); nothing more will be received
+        [[nodiscard]] bool broken() const {
+            return _in.broken();
+        }
+
+        [[nodiscard]] int event_fd() const;
+
+    private:
+        void wake(ShmRegion::Side side) const;
+
+        bool sleep(std::chrono::milliseconds timeout) const;
+
+        std::shared_ptr<ShmRegion> _region;
+        ShmRegion::Side _side;
+        ShmRing &_out;
+        ShmRing &_in;
+    };
+} // SteamClient
+
+#endif //PIDGIN_STEAM_SHM_RING_H
@@ -0,0 +1,101 @@
+#include "shm_transport.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "../protobufs/comm_protobufs/message.pb.h"
+
+namespace SteamClient {
+    std::string encode_shm_frame(const ShmFrameHeader &header, std::string_view payload) {
+        std::string frame(sizeof(ShmFrameHeader) + payload.size(), '\0');
+        std::memcpy(frame.data(), &header, sizeof(ShmFrameHeader));
+        std::memcpy(frame.data() + sizeof(ShmFrameHeader), payload.data(), payload.size());
+        return frame;
+    }
+
+    std::string encode_shm_frame(const ShmFrameHeader &header, const google::protobuf::MessageLite *payload) {
+        std::string frame(sizeof(ShmFrameHeader), '\0');
+        std::memcpy(frame.data(), &header, sizeof(ShmFrameHeader));
+        if (payload != nullptr) {
+            payload->AppendToString(&frame);
+        }
+        return frame;
+    }
+
+    bool decode_shm_frame(std::string_view frame, ShmFrameHeader &header, std::string_view &payload) {
+        if (frame.size() < sizeof(ShmFrameHeader)) {
+            return false;
+        }
+        std::memcpy(&header, frame.data(), sizeof(ShmFrameHeader));
+        payload = frame.substr(sizeof(ShmFrameHeader));
+        return true;
+    }
+
+    ShmStandInPeer::ShmStandInPeer(std::shared_ptr<ShmRegion> region, size_t historyLength)
+            : _endpoint(std::move(region), ShmRegion::PEER), _historyLength(historyLength),
+              _startedAtNs(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::system_clock::now().time_since_epoch()).count()) {
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ShmStandInPeer::~ShmStandInPeer() {
+        _stop = true;
+        _thread.join();
+    }
+
+    void ShmStandInPeer::run() {
+        std::string frame;
+        while (!_stop) {
+            if (!_endpoint.receive(frame, std::chrono::milliseconds(100))) {
+                continue;
+            }
+            ShmFrameHeader header{};
+            std::string_view payload;
+            if (!decode_shm_frame(frame, header, payload)) {
+                continue;
+            }
+            switch ((ShmMethod) header.method) {
+                case ShmMethod::POLL_CHAT_MESSAGES:
+                    serve_poll(header, payload);
+                    break;
+                default:
+                    _endpoint.send(encode_shm_frame({header.callId, header.method, SHM_ERROR, 0}, "unknown method"));
+            }
+        }
+    }
+
+    void ShmStandInPeer::serve_poll(const ShmFrameHeader &request, std::string_view payload) {
+        steam::PollRequest poll;
+        if (!poll.ParseFromArray(payload.data(), (int) payload.size())) {
+            _endpoint.send(encode_shm_frame({request.callId, request.method, SHM_ERROR, 0}, "malformed request"));
+            return;
+        }
+        auto to_ns = [](const google::protobuf::Timestamp &timestamp) {
+            return timestamp.seconds() * 1000000000LL + timestamp.nanos();
+        };
+        auto after = poll.has_starttimestamp() ? to_ns(poll.starttimestamp())
+                                               : poll.has_starttimestampns() ? poll.starttimestampns() : INT64_MIN;
+        auto until = poll.has_lasttimestamp() ? to_ns(poll.lasttimestamp())
+                                              : poll.has_lasttimestampns() ? poll.lasttimestampns() : INT64_MAX;
+        bool compact = poll.target() != 0;  // answer in the form the request was made in
+
+        constexpr int64_t minute_ns = 60 * 1000000000LL;
+        steam::ResponseMessage response;
+        for (size_t i = 0; i < _historyLength; ++i) {
+            auto timestampNs = _startedAtNs - (int64_t) (_historyLength - i) * minute_ns;
+            if (timestampNs <= after || timestampNs > until) {
+                continue;
+            }
+            response.set_message("stand-in message " + std::to_string(i));
+            if (compact) {
+                response.set_sender(poll.target());
+                response.set_timestampns(timestampNs);
+            } else {
+                response.set_senderid(poll.targetid());
+                response.mutable_timestamp()->set_seconds(timestampNs / 1000000000LL);
+                response.mutable_timestamp()->set_nanos((int32_t) (timestampNs % 1000000000LL));
+            }
+            _endpoint.send(encode_shm_frame({request.callId, request.method, 0, 0}, &response));
+        }
+        _endpoint.send(encode_shm_frame({request.callId, request.method, SHM_END_OF_STREAM, 0}, nullptr));
+    }
+} // SteamClient
@@ -0,0 +1,73 @@
+#ifndef PIDGIN_STEAM_SHM_TRANSPORT_H
+#define PIDGIN_STEAM_SHM_TRANSPORT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "shm_ring.h"
+
+namespace google::protobuf {
+    class MessageLite;
+}
+
+namespace SteamClient {
+    /*
+     * Framing for RPCs over a ShmRegion. Each frame is a fixed header followed by a serialized protobuf message.
+     * A call is one request frame from the client, then any number of response frames from the peer with the same
+     * callId, terminated by a frame flagged SHM_END_OF_STREAM (empty payload) or SHM_ERROR (payload is the message).
+     */
+    enum class ShmMethod : uint16_t {
+        POLL_CHAT_MESSAGES = 1,  // steam::PollRequest -> stream of steam::ResponseMessage
+    };
+
+    enum ShmFrameFlags : uint16_t {
+        SHM_END_OF_STREAM = 1,
+        SHM_ERROR = 2,
+    };
+
+    struct ShmFrameHeader {
+        uint64_t callId;
+        uint16_t method;
+        uint16_t flags;
+        uint32_t reserved;
+    };
+
+    std::string encode_shm_frame(const ShmFrameHeader &header, const google::protobuf::MessageLite *payload);
+
+    std::string encode_shm_frame(const ShmFrameHeader &header, std::string_view payload);
+
+    // `payload` points into `frame`
+    bool decode_shm_frame(std::string_view frame, ShmFrameHeader &header, std::string_view &payload);
+
+    /*
+     * In-process stand-in for a proxy speaking the shared-memory protocol, for tests and benchmarks: answers every
+     * PollChatMessages call with a synthetic history of `historyLength` messages (one per minute, ending at
+     * construction time), honouring the request's timestamp bounds.
+     */
+    class ShmStandInPeer {
+    public:
+        ShmStandInPeer(std::shared_ptr<ShmRegion> region, size_t historyLength);
+
+        ShmStandInPeer(const ShmStandInPeer &) = delete;
+
+        ShmStandInPeer &operator=(const ShmStandInPeer &) = delete;
+
+        ~ShmStandInPeer();
+
+    private:
+        void run();
+
+        void serve_poll(const ShmFrameHeader &request, std::string_view payload);
+
+        ShmEndpoint _endpoint;
+        size_t _historyLength;
+        int64_t _startedAtNs;
+        std::atomic<bool> _stop{false};
+        std::thread _thread;
+    };
+} // SteamClient
+
+#endif //PIDGIN_STEAM_SHM_TRANSPORT_H